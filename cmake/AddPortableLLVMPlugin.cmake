@@ -19,3 +19,37 @@ function(add_portable_llvm_plugin plugin_target_name)
       PUBLIC _SILENCE_CXX17_ITERATOR_BASE_CLASS_DEPRECATION_WARNING)
   endif()
 endfunction()
+
+# Builds a pass's sources once, as the object library <pass>-objects, which the
+# pseudo-passes plugin links along with every other pass. Unless
+# PSEUDO_PASSES_BUILD_PLUGINS is off, the objects are also linked into the
+# pass's own plugin, whose llvmGetPassPluginInfo() returns PLUGIN_INFO().
+function(add_pseudo_pass pass_name)
+  cmake_parse_arguments(ARG "" "PLUGIN_INFO" "LINK_LIBS" ${ARGN})
+  set(objects_target ${pass_name}-objects)
+  add_library(${objects_target} OBJECT ${ARG_UNPARSED_ARGUMENTS})
+  target_link_libraries(${objects_target} PUBLIC ${ARG_LINK_LIBS})
+  set_target_properties(${objects_target}
+    PROPERTIES
+      CXX_STANDARD 17
+      CXX_STANDARD_REQUIRED ON
+      POSITION_INDEPENDENT_CODE ON)
+  if (MSVC)
+    target_compile_definitions(${objects_target}
+      PUBLIC _SILENCE_CXX17_ITERATOR_BASE_CLASS_DEPRECATION_WARNING)
+  endif()
+
+  if (PSEUDO_PASSES_BUILD_PLUGINS)
+    # The pass's sources are compiled by the object library, not the plugin.
+    set(LLVM_OPTIONAL_SOURCES ${ARG_UNPARSED_ARGUMENTS})
+    add_portable_llvm_plugin(${pass_name}
+      ${CMAKE_SOURCE_DIR}/lib/passes/plugin-entry-point.cpp
+
+      LINK_LIBS
+      ${objects_target}
+      ${ARG_LINK_LIBS}
+      )
+    target_compile_definitions(${pass_name}
+      PRIVATE JVS_PSEUDO_PASSES_PLUGIN_INFO=${ARG_PLUGIN_INFO})
+  endif()
+endfunction()
@@ -9,6 +9,7 @@ namespace llvm
 {
 
 class Function;
+struct PassPluginLibraryInfo;
 
 } // namespace llvm
 
@@ -21,6 +22,8 @@ struct BreakpointNetPass : llvm::PassInfoMixin<BreakpointNetPass>
     llvm::FunctionAnalysisManager& manager);
 };
 
+llvm::PassPluginLibraryInfo getBreakpointNetPluginInfo();
+
 } // namespace jvs
 
 
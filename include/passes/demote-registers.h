@@ -15,6 +15,7 @@ namespace llvm
 class AllocaInst;
 class Function;
 class Module;
+struct PassPluginLibraryInfo;
 
 } // namespace llvm
 
@@ -46,6 +47,8 @@ struct DemoteRegistersPass : llvm::PassInfoMixin<DemoteRegistersPass>
 DemotedInstructions DemoteRegisters(llvm::Function& f, 
   bool demoteOperands = false);
 
+llvm::PassPluginLibraryInfo getDemoteRegistersPluginInfo();
+
 } // namespace jvs
 
 
@@ -1,6 +1,10 @@
 #if !defined(JVS_PSEUDO_PASSES_FUNCTION_NAME_TRACE_H_)
 #define JVS_PSEUDO_PASSES_FUNCTION_NAME_TRACE_H_
 
+#include <cstdint>
+#include <memory>
+#include <string>
+
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
 
@@ -8,19 +12,116 @@
 namespace llvm
 {
 
+class Function;
 class Module;
+struct PassPluginLibraryInfo;
 
 } // namespace llvm
 
 namespace jvs
 {
 
+class FunctionFilter;
+
+//!
+//! What function-name-trace inserts at function entry and exit.
+//!
+enum class FunctionNameTraceMode
+{
+  //! Print "Entering"/"Leaving" lines with puts().
+  Text,
+  //! Print the same lines through the function-name-trace runtime, which
+  //! looks names up by function ID in a compact per-module name table rather
+  //! than needing two string globals per function.
+  TextIds,
+  //! Record binary events through the function-name-trace runtime.
+  Binary,
+  //! Accumulate per-function call counts and latency histograms in the
+  //! function-name-trace runtime.
+  Latency,
+  //! Only count calls, with a relaxed atomic increment of a per-function
+  //! counter. The function-name-trace runtime writes the counts to a binary
+  //! profile at exit.
+  Counts,
+  //! Count the calls along each caller/callee edge of the dynamic call graph
+  //! in the function-name-trace runtime. Call sites record the caller, and
+  //! function entries record the edge.
+  Edges,
+  //! Keep a shadow stack of the instrumented functions each thread is in,
+  //! which a SIGPROF driven sampler in the function-name-trace runtime
+  //! snapshots to build a stack profile. Calls don't call the runtime.
+  Stacks,
+  //! Emit Linux SDT (USDT) probes, which cost a `nop` until a tracer such as
+  //! perf or bpftrace attaches to them. Needs no runtime.
+  Sdt,
+};
+
+//!
+//! Options for FunctionNameTracePass, parsed from the parameters of
+//! `function-name-trace<...>` (e.g. `function-name-trace<binary>`).
+//!
+struct FunctionNameTraceOptions
+{
+  FunctionNameTraceMode Mode{FunctionNameTraceMode::Text};
+  //! Trace only one in every SampleRate calls (per thread), or every call if
+  //! this is 1. Set by `sample=N`, which the stacks mode doesn't allow.
+  std::uint32_t SampleRate{1};
+  //! Only trace while the runtime has tracing enabled (see
+  //! __jvs_trace_set_enabled()), and in modes which identify functions by ID,
+  //! only functions the runtime hasn't disabled. Set by `guard`.
+  bool Guard{false};
+  //! File of patterns selecting the functions to trace (see
+  //! FunctionFilter), or empty to trace every function. Set by
+  //! `filter=path`.
+  std::string FilterPath{};
+  //! Whether the text and SDT modes use demangled names. Cleared by
+  //! `mangled`, which saves demangling every function at compile time;
+  //! pseudo-trace-decode can demangle text traces instead. The other modes
+  //! always record mangled names.
+  bool DemangleNames{true};
+};
+
 struct FunctionNameTracePass : llvm::PassInfoMixin<FunctionNameTracePass>
 {
+  FunctionNameTracePass(FunctionNameTraceOptions options = {});
+
   llvm::PreservedAnalyses run(llvm::Module& m,
     llvm::ModuleAnalysisManager& manager);
+
+  const FunctionNameTraceOptions Options;
+};
+
+//!
+//! Function pass version of FunctionNameTracePass, which can run in function
+//! and CGSCC pipelines (e.g. `function(function-name-trace<binary>)`)
+//! alongside other function passes.
+//!
+//! It keeps no state between functions. Each function gets its own private
+//! descriptor, which the runtime registers the first time the function runs
+//! instead of from a module constructor, and everything shared between
+//! functions (e.g. runtime declarations and text mode strings) is looked up
+//! in the module by name. The module is only ever given new globals and
+//! declarations, never new functions. Functions without a personality only
+//! have their unwinding traced if the module declares
+//! `__gxx_personality_v0`.
+//!
+struct FunctionNameTraceFunctionPass
+  : llvm::PassInfoMixin<FunctionNameTraceFunctionPass>
+{
+  FunctionNameTraceFunctionPass(FunctionNameTraceOptions options = {});
+
+  llvm::PreservedAnalyses run(llvm::Function& f,
+    llvm::FunctionAnalysisManager& manager);
+
+  const FunctionNameTraceOptions Options;
+
+private:
+  std::shared_ptr<const FunctionFilter> filter_{};
+  std::string filter_error_{};
 };
 
+llvm::PassPluginLibraryInfo getFunctionNameTracePluginInfo();
+
 } // namespace jvs
 
 
@@ -9,6 +9,7 @@ namespace llvm
 {
 
 class Module;
+struct PassPluginLibraryInfo;
 
 } // namespace llvm
 
@@ -25,6 +26,8 @@ struct FuseFunctionsPass : llvm::PassInfoMixin<FuseFunctionsPass>
   const bool IgnoreNoInline;
 };
 
+llvm::PassPluginLibraryInfo getFuseFunctionsPluginInfo();
+
 } // namespace jvs
 
 
@@ -9,6 +9,7 @@ namespace llvm
 {
 
 class Module;
+struct PassPluginLibraryInfo;
 
 } // namespace llvm
 
@@ -21,6 +22,8 @@ struct PachinkoCallsPass : llvm::PassInfoMixin<PachinkoCallsPass>
     llvm::ModuleAnalysisManager& manager);
 };
 
+llvm::PassPluginLibraryInfo getPachinkoCallsPluginInfo();
+
 } // namespace jvs
 
 
@@ -9,6 +9,7 @@ namespace llvm
 {
 
 class Module;
+struct PassPluginLibraryInfo;
 
 } // namespace llvm
 
@@ -25,6 +26,8 @@ struct PromoteBlocksPass : llvm::PassInfoMixin<PromoteBlocksPass>
   const bool PerInstruction;
 };
 
+llvm::PassPluginLibraryInfo getPromoteBlocksPluginInfo();
+
 } // namespace jvs
 
 
@@ -0,0 +1,25 @@
+#if !defined(JVS_PSEUDO_PASSES_PSEUDO_PASSES_H_)
+#define JVS_PSEUDO_PASSES_PSEUDO_PASSES_H_
+
+// forward declarations
+namespace llvm
+{
+
+struct PassPluginLibraryInfo;
+
+} // namespace llvm
+
+namespace jvs
+{
+
+//!
+//! Gets the plugin information for the combined plugin, which registers every
+//! pass in this project with a single PassBuilder callback.
+//!
+llvm::PassPluginLibraryInfo getPseudoPassesPluginInfo();
+
+} // namespace jvs
+
+
+
+#endif // !JVS_PSEUDO_PASSES_PSEUDO_PASSES_H_
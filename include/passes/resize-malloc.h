@@ -1,6 +1,8 @@
 #if !defined(JVS_PSEUDO_PASSES_RESIZE_MALLOC_H_)
 #define JVS_PSEUDO_PASSES_RESIZE_MALLOC_H_
 
+#include <cstdint>
+
 #include "llvm/IR/PassManager.h"
 #include "llvm/Pass.h"
 
@@ -9,18 +11,74 @@ namespace llvm
 {
 
 class Function;
+struct PassPluginLibraryInfo;
 
 } // namespace llvm
 
 namespace jvs
 {
 
+//!
+//! How resize-malloc rounds allocation sizes up. Sizes which are already
+//! rounded are left alone.
+//!
+enum class ResizeMallocRounding
+{
+  //! Round up to a multiple of ResizeMallocOptions::Multiple. Set by
+  //! `multiple=N`, `cache-line` (64 bytes) and `page` (4096 bytes).
+  Multiple,
+  //! Round up to a power of two. Set by `pow2`.
+  PowerOfTwo,
+  //! Round up to the size classes of allocators like jemalloc and tcmalloc:
+  //! 8 bytes, then multiples of 16 bytes up to 128 bytes, and then four
+  //! evenly spaced classes per doubling (160, 192, 224, 256, 320, ...). Set
+  //! by `size-classes`.
+  SizeClasses,
+};
+
+//!
+//! Options for ResizeMallocPass, parsed from the parameters of
+//! `resize-malloc<...>` (e.g. `resize-malloc<size-classes>`).
+//!
+struct ResizeMallocOptions
+{
+  ResizeMallocRounding Rounding{ResizeMallocRounding::Multiple};
+  //! Multiple that sizes are rounded up to with
+  //! ResizeMallocRounding::Multiple.
+  std::uint64_t Multiple{8192};
+  //! Whether the sizes passed to malloc(), calloc(), operator new and mmap()
+  //! which aren't constants are rounded too, by code inserted before the
+  //! call. Set by `dynamic`.
+  bool RoundDynamicSizes{false};
+  //! Whether malloc(), calloc() and operator new calls of a constant size no
+  //! larger than JVS_POOL_MAX_SIZE are redirected to the pool allocator in
+  //! lib/runtime/resize-malloc rather than rounded, along with every free(),
+  //! realloc() and operator delete call, which the pool passes on unless it
+  //! allocated the pointer. Set by `pool`.
+  bool UsePool{false};
+  //! Largest constant-size allocation moved to the stack when it never
+  //! escapes and is always freed (see promote_to_stack()), or zero to leave
+  //! allocations on the heap. Set by `stack` (256 bytes) or `stack=N`.
+  std::uint64_t StackLimit{0};
+  //! Largest block that constant-size malloc() and calloc() calls made in the
+  //! same block, which never escape and are freed together, are coalesced
+  //! into (see coalesce_allocations()), or zero to leave them apart. Set by
+  //! `coalesce` (4096 bytes) or `coalesce=N`.
+  std::uint64_t CoalesceLimit{0};
+};
+
 struct ResizeMallocPass : llvm::PassInfoMixin<ResizeMallocPass>
 {
+  ResizeMallocPass(ResizeMallocOptions options = {});
+
   llvm::PreservedAnalyses run(llvm::Function& f,
     llvm::FunctionAnalysisManager& manager);
+
+  const ResizeMallocOptions Options;
 };
 
+llvm::PassPluginLibraryInfo getResizeMallocPluginInfo();
+
 } // namespace jvs
 
 
@@ -9,6 +9,7 @@ namespace llvm
 {
 
 class Function;
+struct PassPluginLibraryInfo;
 
 } // namespace llvm
 
@@ -21,6 +22,8 @@ struct StackToGlobalPass : llvm::PassInfoMixin<StackToGlobalPass>
     llvm::FunctionAnalysisManager& manager);
 };
 
+llvm::PassPluginLibraryInfo getStackToGlobalPluginInfo();
+
 } // namespace jvs
 
 
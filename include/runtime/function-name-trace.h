@@ -0,0 +1,306 @@
+//!
+//! @file include/runtime/function-name-trace.h.
+//!
+//! Declares the runtime interface used by code instrumented with the
+//! function-name-trace pass, along with the layout of the trace files the
+//! runtime writes.
+//!
+//! This header is shared by the pass, the runtime and the tools reading trace
+//! files, so it must stay plain C with no LLVM dependencies.
+//!
+#if !defined(JVS_PSEUDO_PASSES_RUNTIME_FUNCTION_NAME_TRACE_H_)
+#define JVS_PSEUDO_PASSES_RUNTIME_FUNCTION_NAME_TRACE_H_
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+//!
+//! Version of the module descriptor layout emitted by the pass.
+//!
+#define JVS_TRACE_ABI_VERSION 5
+
+//!
+//! Describes the functions instrumented in one module. The pass emits one of
+//! these per module and registers it from a module constructor.
+//!
+typedef struct jvs_trace_module
+{
+  uint32_t version;
+  uint32_t function_count;
+  //! ID of the module's first function. Instrumented code adds the module
+  //! local function index to this, and it's assigned by the runtime when the
+  //! module is registered (see JVS_TRACE_UNREGISTERED).
+  uint32_t base_id;
+  //! Size of `name_table` in bytes.
+  uint32_t name_table_size;
+  //! The (mangled) names of the module's functions, each terminated by a NUL.
+  //! Functions with the same name share one entry.
+  const char* name_table;
+  //! Offset of each function's name in `name_table`, indexed by module local
+  //! function index.
+  const uint32_t* name_offsets;
+  //! Whether tracing of each function is enabled, indexed by module local
+  //! function index. Only present in modules instrumented with
+  //! `function-name-trace<...;guard>`.
+  uint8_t* function_enabled;
+  //! Number of calls of each function, indexed by module local function
+  //! index. Only present in modules instrumented with
+  //! `function-name-trace<counts>`, and incremented by the instrumented code
+  //! itself.
+  uint64_t* call_counts;
+  //! JVS_TRACE_MODULE_* flags.
+  uint32_t flags;
+  uint32_t reserved;
+} jvs_trace_module;
+
+//!
+//! Set in `jvs_trace_module::flags` when the module's functions maintain the
+//! calling thread's shadow stack (see jvs_trace_shadow_stack). Registering
+//! such a module starts the runtime's stack sampler.
+//!
+#define JVS_TRACE_MODULE_SHADOW_STACK 0x1u
+
+void __jvs_trace_register_module(jvs_trace_module* module);
+
+//!
+//! Initial `base_id` of the descriptors of modules instrumented by the
+//! function pass version of function-name-trace, which registers descriptors
+//! from the instrumented code the first time it finds one still has this ID,
+//! rather than from a module constructor.
+//!
+#define JVS_TRACE_UNREGISTERED UINT32_MAX
+
+//!
+//! Registers the given descriptor unless it already has been.
+//!
+//! @returns
+//!   The descriptor's base ID.
+//!
+uint32_t __jvs_trace_register_lazily(jvs_trace_module* module);
+
+//!
+//! Records function entry/exit events in the calling thread's event buffer.
+//!
+void __jvs_trace_enter(uint32_t function_id);
+void __jvs_trace_exit(uint32_t function_id);
+
+//!
+//! Prints "Entering"/"Leaving" lines for the given function to stdout, looking
+//! its name up in the registered modules.
+//!
+void __jvs_trace_print_enter(uint32_t function_id);
+void __jvs_trace_print_exit(uint32_t function_id);
+
+//!
+//! Reads the clock used for timestamps and latencies.
+//!
+uint64_t __jvs_trace_clock(void);
+
+//!
+//! Adds a call of the given function, which started at `start_time` (as read
+//! by __jvs_trace_clock()) and is returning now, to the latency profile.
+//!
+void __jvs_trace_latency(uint32_t function_id, uint64_t start_time);
+
+//!
+//! Caller ID passed to __jvs_trace_edge() when the caller isn't known, e.g.
+//! because it wasn't instrumented.
+//!
+#define JVS_TRACE_UNKNOWN_CALLER UINT32_MAX
+
+//!
+//! Adds a call along the given caller/callee edge to the call graph profile.
+//!
+void __jvs_trace_edge(uint32_t caller_id, uint32_t callee_id);
+
+//!
+//! Number of frames in a shadow stack. The last one is scratch space: entries
+//! deeper than that write their function ID there and are never sampled.
+//!
+#define JVS_TRACE_SHADOW_STACK_SIZE 512
+
+//!
+//! The IDs of the instrumented functions a thread is in, outermost first.
+//!
+//! Code instrumented with `function-name-trace<stacks>` maintains one per
+//! thread, in the thread local `__jvs_trace_shadow_stack` defined by the
+//! runtime, without calling the runtime. On entry it stores the function's
+//! ID in `frames[depth]` (or the scratch frame) and then increments `depth`
+//! with a relaxed atomic store, after a signal fence, so a signal handler
+//! interrupting the thread always sees complete frames. On exit it restores
+//! `depth` to its value on entry, which also recovers from exits that were
+//! skipped (e.g. by longjmp()).
+//!
+typedef struct jvs_trace_shadow_stack
+{
+  uint32_t depth;
+  uint32_t frames[JVS_TRACE_SHADOW_STACK_SIZE];
+} jvs_trace_shadow_stack;
+
+//!
+//! Writes out every event recorded so far.
+//!
+void __jvs_trace_flush(void);
+
+//!
+//! Writes the latency profile gathered so far.
+//!
+void __jvs_trace_dump_latency(void);
+
+//!
+//! Writes the call counts gathered so far.
+//!
+void __jvs_trace_dump_counts(void);
+
+//!
+//! Writes the call graph profile gathered so far.
+//!
+void __jvs_trace_dump_edges(void);
+
+//!
+//! Writes the stack samples gathered so far.
+//!
+void __jvs_trace_dump_stacks(void);
+
+//!
+//! Whether code instrumented with `function-name-trace<...;guard>` traces
+//! anything. Starts out zero unless the JVS_TRACE_ENABLED environment
+//! variable is set to something other than "0". Change it through
+//! __jvs_trace_set_enabled().
+//!
+extern uint32_t __jvs_trace_enabled;
+
+void __jvs_trace_set_enabled(int enabled);
+
+//!
+//! Enables or disables tracing of every guarded function with the given
+//! (mangled) name. Functions are enabled to start with.
+//!
+//! @returns
+//!   The number of functions found.
+//!
+uint32_t __jvs_trace_set_function_enabled(const char* name, int enabled);
+
+//!
+//! Enables or disables tracing of the guarded function with the given ID.
+//!
+//! @returns
+//!   Nonzero if the function was found.
+//!
+int __jvs_trace_set_function_id_enabled(uint32_t function_id, int enabled);
+
+
+//
+// Binary trace file layout
+//
+// A trace file starts with a jvs_trace_file_header followed by any number of
+// chunks, each of which starts with a jvs_trace_chunk_header. All values are
+// stored in the byte order of the traced process.
+//
+
+#define JVS_TRACE_FILE_MAGIC "JVSTRACE"
+#define JVS_TRACE_FILE_VERSION 2
+
+typedef struct jvs_trace_file_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+} jvs_trace_file_header;
+
+typedef enum jvs_trace_chunk_type
+{
+  //! jvs_trace_module_chunk followed by `function_count` uint32_t name
+  //! offsets and then the module's `name_table_size` byte name table.
+  JVS_TRACE_CHUNK_MODULE = 1,
+  //! jvs_trace_events_chunk followed by jvs_trace_event records.
+  JVS_TRACE_CHUNK_EVENTS = 2,
+  //! jvs_trace_clock_chunk.
+  JVS_TRACE_CHUNK_CLOCK = 3,
+} jvs_trace_chunk_type;
+
+typedef struct jvs_trace_chunk_header
+{
+  uint32_t type;
+  uint32_t reserved;
+  //! Size of the chunk, not including this header.
+  uint64_t size;
+} jvs_trace_chunk_header;
+
+typedef struct jvs_trace_module_chunk
+{
+  uint32_t base_id;
+  uint32_t function_count;
+  uint32_t name_table_size;
+  uint32_t reserved;
+} jvs_trace_module_chunk;
+
+typedef enum jvs_trace_event_kind
+{
+  JVS_TRACE_EVENT_ENTER = 0,
+  JVS_TRACE_EVENT_EXIT = 1,
+} jvs_trace_event_kind;
+
+typedef struct jvs_trace_event
+{
+  //! Clock ticks; see jvs_trace_clock_chunk.
+  uint64_t timestamp;
+  uint32_t function_id;
+  uint32_t kind;
+} jvs_trace_event;
+
+typedef struct jvs_trace_events_chunk
+{
+  //! Small sequential ID assigned to each thread by the runtime.
+  uint64_t thread_id;
+  //! Number of events the thread dropped (because its buffer was full) since
+  //! its previous events chunk.
+  uint64_t dropped;
+} jvs_trace_events_chunk;
+
+typedef struct jvs_trace_clock_chunk
+{
+  uint64_t ticks_per_second;
+} jvs_trace_clock_chunk;
+
+
+//
+// Call count file layout
+//
+// A call count file is a jvs_count_file_header followed by `function_count`
+// jvs_count_records, sorted by decreasing count, and then the
+// `name_table_size` byte table of the (mangled, NUL terminated) names the
+// records refer to. Functions with the same name (e.g. inline functions
+// instrumented in several modules) share one record. All values are stored in
+// the byte order of the traced process.
+//
+
+#define JVS_COUNT_FILE_MAGIC "JVSCOUNT"
+#define JVS_COUNT_FILE_VERSION 1
+
+typedef struct jvs_count_file_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t function_count;
+  uint64_t name_table_size;
+} jvs_count_file_header;
+
+typedef struct jvs_count_record
+{
+  uint64_t count;
+  //! Offset of the function's name in the name table.
+  uint32_t name_offset;
+  uint32_t reserved;
+} jvs_count_record;
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
+
+
+#endif // !JVS_PSEUDO_PASSES_RUNTIME_FUNCTION_NAME_TRACE_H_
@@ -0,0 +1,50 @@
+//!
+//! @file include/runtime/resize-malloc.h.
+//!
+//! Declares the pool allocator that `resize-malloc<pool>` redirects small
+//! constant-size allocations (and every deallocation) to.
+//!
+//! This header is shared by the pass and the runtime, so it must stay plain C
+//! with no LLVM dependencies.
+//!
+#if !defined(JVS_PSEUDO_PASSES_RUNTIME_RESIZE_MALLOC_H_)
+#define JVS_PSEUDO_PASSES_RUNTIME_RESIZE_MALLOC_H_
+
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+//!
+//! Largest allocation served by the pool. The pass only redirects constant
+//! sizes up to this, and larger requests reaching the runtime (e.g. through
+//! __jvs_pool_realloc()) go to malloc().
+//!
+#define JVS_POOL_MAX_SIZE 1024
+
+//!
+//! Allocate like malloc(), calloc() and operator new. They fall back to those
+//! for sizes the pool doesn't serve, or when it's out of space.
+//!
+void* __jvs_pool_malloc(size_t size);
+void* __jvs_pool_calloc(size_t count, size_t size);
+void* __jvs_pool_new(size_t size);
+
+//!
+//! Deallocate like free(), realloc() and operator delete. Pointers the pool
+//! didn't allocate (found with a range check) are passed on to those, so
+//! every deallocation in instrumented code can go through these.
+//!
+void __jvs_pool_free(void* ptr);
+void* __jvs_pool_realloc(void* ptr, size_t size);
+void __jvs_pool_delete(void* ptr);
+void __jvs_pool_delete_sized(void* ptr, size_t size);
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
+
+
+#endif // !JVS_PSEUDO_PASSES_RUNTIME_RESIZE_MALLOC_H_
@@ -0,0 +1,65 @@
+//!
+//! @file include/support/call-counts.h.
+//!
+//! Declares the reader of the call count profiles written by programs
+//! instrumented with `function-name-trace<counts>`.
+//!
+#if !defined(JVS_PSEUDO_PASSES_SUPPORT_CALL_COUNTS_H_)
+#define JVS_PSEUDO_PASSES_SUPPORT_CALL_COUNTS_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+
+namespace jvs
+{
+
+//!
+//! The number of calls of each function in a call count profile (see
+//! runtime/function-name-trace.h), looked up by mangled name.
+//!
+class CallCounts
+{
+public:
+  struct Function
+  {
+    std::string Name;
+    std::uint64_t Count;
+  };
+
+  static llvm::Expected<CallCounts> load(llvm::StringRef path);
+
+  static llvm::Expected<CallCounts> parse(llvm::StringRef data);
+
+  //!
+  //! Gets the number of calls of the function with the given (mangled) name.
+  //!
+  //! @returns
+  //!   The count, or zero if the profile doesn't have the function.
+  //!
+  std::uint64_t get(llvm::StringRef name) const;
+
+  //!
+  //! Gets the number of calls of the most called function.
+  //!
+  std::uint64_t max_count() const;
+
+  //!
+  //! Gets every function in the profile, in decreasing order of calls.
+  //!
+  llvm::ArrayRef<Function> functions() const;
+
+private:
+  std::vector<Function> functions_{};
+  llvm::StringMap<std::uint64_t> counts_{};
+};
+
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_SUPPORT_CALL_COUNTS_H_
@@ -0,0 +1,123 @@
+//!
+//! @file include/support/extension-point.h.
+//!
+//! Declares helpers for adding passes to PassBuilder's default pipelines
+//!
+#if !defined(JVS_PSEUDO_PASSES_SUPPORT_EXTENSION_POINT_H_)
+#define JVS_PSEUDO_PASSES_SUPPORT_EXTENSION_POINT_H_
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace jvs
+{
+
+//!
+//! The PassBuilder extension points a pass can be added to, so that it runs
+//! as part of the default pipelines (e.g. `clang -O2 -fpass-plugin=...`)
+//! instead of only when named in a pipeline passed to `opt`.
+//!
+enum class ExtensionPoint
+{
+  None,
+  PipelineStart,
+  ScalarOptimizerLate,
+  OptimizerLast,
+};
+
+//!
+//! Gets the command line values naming each extension point for an
+//! `llvm::cl::opt<ExtensionPoint>` which controls a function pass.
+//!
+llvm::cl::ValuesClass function_extension_point_values();
+
+//!
+//! Gets the command line values naming each extension point for an
+//! `llvm::cl::opt<ExtensionPoint>` which controls a module pass. Module passes
+//! can't be added to the function simplification pipeline, so
+//! ScalarOptimizerLate isn't one of them.
+//!
+llvm::cl::ValuesClass module_extension_point_values();
+
+//!
+//! Adds the function pass (or function pass manager) returned by `createPass`
+//! to the default pipelines at the given extension point. At the module-level
+//! extension points the pass is run on every function through a module
+//! adaptor.
+//!
+template <typename CreatePassFunction>
+void register_function_pass(llvm::PassBuilder& passBuilder,
+  ExtensionPoint extensionPoint, CreatePassFunction createPass)
+{
+  switch (extensionPoint)
+  {
+  case ExtensionPoint::None:
+    break;
+  case ExtensionPoint::PipelineStart:
+    passBuilder.registerPipelineStartEPCallback(
+      [createPass](llvm::ModulePassManager& mpm,
+        llvm::PassBuilder::OptimizationLevel)
+      {
+        mpm.addPass(llvm::createModuleToFunctionPassAdaptor(createPass()));
+      });
+    break;
+  case ExtensionPoint::ScalarOptimizerLate:
+    passBuilder.registerScalarOptimizerLateEPCallback(
+      [createPass](llvm::FunctionPassManager& fpm,
+        llvm::PassBuilder::OptimizationLevel)
+      {
+        fpm.addPass(createPass());
+      });
+    break;
+  case ExtensionPoint::OptimizerLast:
+    passBuilder.registerOptimizerLastEPCallback(
+      [createPass](llvm::ModulePassManager& mpm,
+        llvm::PassBuilder::OptimizationLevel)
+      {
+        mpm.addPass(llvm::createModuleToFunctionPassAdaptor(createPass()));
+      });
+    break;
+  }
+}
+
+//!
+//! Adds the module pass returned by `createPass` to the default pipelines at
+//! the given extension point.
+//!
+template <typename CreatePassFunction>
+void register_module_pass(llvm::PassBuilder& passBuilder,
+  ExtensionPoint extensionPoint, CreatePassFunction createPass)
+{
+  switch (extensionPoint)
+  {
+  case ExtensionPoint::None:
+    break;
+  case ExtensionPoint::PipelineStart:
+    passBuilder.registerPipelineStartEPCallback(
+      [createPass](llvm::ModulePassManager& mpm,
+        llvm::PassBuilder::OptimizationLevel)
+      {
+        mpm.addPass(createPass());
+      });
+    break;
+  case ExtensionPoint::ScalarOptimizerLate:
+    llvm::errs() << "Module passes can't be added to the "
+      "ScalarOptimizerLate extension point\n";
+    break;
+  case ExtensionPoint::OptimizerLast:
+    passBuilder.registerOptimizerLastEPCallback(
+      [createPass](llvm::ModulePassManager& mpm,
+        llvm::PassBuilder::OptimizationLevel)
+      {
+        mpm.addPass(createPass());
+      });
+    break;
+  }
+}
+
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_SUPPORT_EXTENSION_POINT_H_
@@ -0,0 +1,95 @@
+//!
+//! @file include/support/metadata-index.h.
+//!
+//! Declares the per-function metadata index analysis
+//!
+#if !defined(JVS_PSEUDO_PASSES_SUPPORT_METADATA_INDEX_H_)
+#define JVS_PSEUDO_PASSES_SUPPORT_METADATA_INDEX_H_
+
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/ValueHandle.h"
+
+// forward declarations
+namespace llvm
+{
+
+class Function;
+class Instruction;
+
+} // namespace llvm
+
+
+namespace jvs
+{
+
+//!
+//! Maps each custom (non-fixed) metadata kind attached to instructions in a
+//! function to the instructions carrying it.
+//!
+//! Entries are held by weak handles, so erasing an instruction or dropping its
+//! metadata never leaves a dangling result. Instructions which gain custom
+//! metadata while the index is alive must be added with insert() (the
+//! attach_metadata() and create_metadata() overloads taking an index do this);
+//! anything else which adds metadata must invalidate the analysis.
+//!
+class MetadataIndex
+{
+public:
+  explicit MetadataIndex(llvm::Function& f);
+
+  llvm::Function& function() const noexcept;
+
+  //!
+  //! Records that the given instruction now carries metadata of the given
+  //! kind.
+  //!
+  void insert(llvm::Instruction& inst, llvm::StringRef name);
+
+  //!
+  //! Finds the instructions carrying metadata of the given kind, in program
+  //! order. Entries for instructions which no longer carry it are pruned.
+  //!
+  std::vector<llvm::Instruction*> find_metadata(llvm::StringRef name) const;
+
+  std::vector<llvm::Instruction*> find_metadata(llvm::StringRef name,
+    llvm::StringRef value) const;
+
+  std::vector<llvm::Instruction*> find_metadata_markers(
+    llvm::StringRef name) const;
+
+  llvm::Instruction* find_metadata_marker(llvm::StringRef name) const;
+
+  llvm::Instruction* find_metadata_marker(llvm::StringRef name,
+    llvm::StringRef value) const;
+
+private:
+  void insert(llvm::Instruction& inst, unsigned int kindId);
+
+  llvm::Function* function_;
+  // Pruned and sorted by the (logically const) searches.
+  mutable llvm::DenseMap<unsigned int, std::vector<llvm::WeakVH>>
+    instructions_{};
+};
+
+//!
+//! Function analysis producing a MetadataIndex.
+//!
+struct MetadataIndexAnalysis : llvm::AnalysisInfoMixin<MetadataIndexAnalysis>
+{
+  using Result = MetadataIndex;
+
+  Result run(llvm::Function& f, llvm::FunctionAnalysisManager& manager);
+
+private:
+  friend llvm::AnalysisInfoMixin<MetadataIndexAnalysis>;
+  static llvm::AnalysisKey Key;
+};
+
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_SUPPORT_METADATA_INDEX_H_
@@ -30,6 +30,8 @@ class Value;
 namespace jvs
 {
 
+class MetadataIndex;
+
 using StringPredicate = std::function<bool(const llvm::StringRef&)>;
 
 //!
@@ -41,12 +43,15 @@ using StringPredicate = std::function<bool(const llvm::StringRef&)>;
 //!   Metadata name.
 //! @param          value
 //!   Metadata value.
+//! @param [in,out] index
+//!   (Optional) Metadata index of the instruction's function to keep up to
+//!   date.
 //!
 //! @returns
 //!   A pointer to a llvm::MDNode created by this function.
 //!
 llvm::MDNode* attach_metadata(llvm::Instruction& inst, llvm::StringRef name,
-  llvm::StringRef value);
+  llvm::StringRef value, MetadataIndex* index = nullptr);
 
 //!
 //! Attach custom metadata to the given instruction.
@@ -57,12 +62,15 @@ llvm::MDNode* attach_metadata(llvm::Instruction& inst, llvm::StringRef name,
 //!   Metadata name.
 //! @param value
 //!   Metadata value.
+//! @param [in,out] index
+//!   (Optional) Metadata index of the instruction's function to keep up to
+//!   date.
 //!
 //! @returns
 //!   A pointer to a llvm::MDNode created by this function.
 //!
 llvm::MDNode* attach_metadata(llvm::Instruction& inst, llvm::StringRef name,
-  std::uint64_t value);
+  std::uint64_t value, MetadataIndex* index = nullptr);
 
 //!
 //! Attach custom metadata to multiple instructions.
@@ -98,13 +106,13 @@ llvm::Instruction* create_metadata_marker(llvm::Instruction& insertBefore);
 //! Creates metadata no-op instruction with the given metadata already attached.
 //!
 llvm::Instruction* create_metadata(llvm::Instruction& insertBefore, 
-  llvm::StringRef name, llvm::StringRef value);
+  llvm::StringRef name, llvm::StringRef value, MetadataIndex* index = nullptr);
 
 //!
 //! Creates metadata no-op instruction with the given metadata already attached.
 //!
 llvm::Instruction* create_metadata(llvm::BasicBlock& insertAtEnd,
-  llvm::StringRef name, llvm::StringRef value);
+  llvm::StringRef name, llvm::StringRef value, MetadataIndex* index = nullptr);
 
 //!
 //! Searches for all metadata no-op instructions in the given block.
@@ -0,0 +1,41 @@
+//!
+//! @file include/support/pass-parameters.h.
+//!
+//! Declares helpers for parsing parameterized pass names
+//!
+#if !defined(JVS_PSEUDO_PASSES_SUPPORT_PASS_PARAMETERS_H_)
+#define JVS_PSEUDO_PASSES_SUPPORT_PASS_PARAMETERS_H_
+
+#include <optional>
+#include <utility>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace jvs
+{
+
+using PassParameter = std::pair<llvm::StringRef, llvm::StringRef>;
+
+//!
+//! Checks whether a pipeline element names the given pass, either on its own
+//! (`pass-name`) or with parameters (`pass-name<params>`).
+//!
+//! @returns
+//!   The (possibly empty) parameter text if the element names the pass, and
+//!   no value otherwise.
+//!
+std::optional<llvm::StringRef> match_pass_name(llvm::StringRef name,
+  llvm::StringRef passName);
+
+//!
+//! Splits `;`-separated pass parameters into (key, value) pairs. The value of
+//! a parameter without an `=` is empty.
+//!
+llvm::SmallVector<PassParameter, 4> split_pass_parameters(
+  llvm::StringRef params);
+
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_SUPPORT_PASS_PARAMETERS_H_
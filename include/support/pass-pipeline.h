@@ -58,6 +58,18 @@ public:
   llvm::PreservedAnalyses run(llvm::Module& m);
   llvm::PreservedAnalyses run(llvm::Function& f);
 
+  //!
+  //! Runs the pipeline using the given (borrowed) analysis manager instead of
+  //! the pipeline's own. Analyses already cached by the caller are reused and
+  //! anything the pipeline changes is invalidated in the caller's managers.
+  //! The manager must have its proxies cross-registered, as the managers
+  //! handed to passes by `opt` and clang do.
+  //!
+  llvm::PreservedAnalyses run(llvm::Module& m,
+    llvm::ModuleAnalysisManager& manager);
+  llvm::PreservedAnalyses run(llvm::Function& f,
+    llvm::FunctionAnalysisManager& manager);
+
   static PassPipeline create_function_pipeline(std::string_view passes);
   static PassPipeline create_module_pipeline(std::string_view passes);
 };
@@ -67,6 +79,24 @@ std::tuple<llvm::PreservedAnalyses, std::string> run_pass_pipeline(
 std::tuple<llvm::PreservedAnalyses, std::string> run_pass_pipeline(
   llvm::Function& f, std::string_view passes);
 
+//!
+//! Runs the given passes using the caller's analysis manager. The passes are
+//! parsed once per thread and cached by their pipeline text; running them
+//! concurrently is not supported.
+//!
+std::tuple<llvm::PreservedAnalyses, std::string> run_pass_pipeline(
+  llvm::Module& m, std::string_view passes,
+  llvm::ModuleAnalysisManager& manager);
+
+//!
+//! Runs the given passes using the caller's analysis manager. The passes are
+//! parsed once per thread and cached by their pipeline text; running them
+//! concurrently is not supported.
+//!
+std::tuple<llvm::PreservedAnalyses, std::string> run_pass_pipeline(
+  llvm::Function& f, std::string_view passes,
+  llvm::FunctionAnalysisManager& manager);
+
 } // namespace jvs
 
 
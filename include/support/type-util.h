@@ -99,6 +99,15 @@ struct TypeCreator<ir_types::IntN>
   }
 };
 
+template <>
+struct TypeCreator<void>
+{
+  llvm::Type* operator()(llvm::Module& m) const noexcept
+  {
+    return llvm::Type::getVoidTy(m.getContext());
+  }
+};
+
 template <>
 struct TypeCreator<void*>
 {
@@ -144,7 +153,7 @@ struct TypeCreator<ReturnT(ArgsT...)>
   llvm::FunctionType* operator()(llvm::Module& m) const noexcept
   {
     return llvm::FunctionType::get(TypeCreator<ReturnT>{}(m),
-      {(TypeCreator<ArgsT>{}(m), ...)}, false);
+      {TypeCreator<ArgsT>{}(m)...}, false);
   }
 };
 
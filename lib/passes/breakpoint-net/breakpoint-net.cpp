@@ -10,6 +10,8 @@
 #include "llvm/IR/Module.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "support/extension-point.h"
 #include "support/value-util.h"
 
 namespace
@@ -17,8 +19,16 @@ namespace
 
 static constexpr char PluginName[] = "BreakpointNet";
 
+static llvm::cl::opt<jvs::ExtensionPoint> BreakpointNetExtensionPoint(
+  "breakpoint-net-ep",
+  llvm::cl::desc("Where to add breakpoint-net to the default pipelines"),
+  llvm::cl::init(jvs::ExtensionPoint::None),
+  jvs::function_extension_point_values());
+
+} // namespace
+
 // Pass registration
-static llvm::PassPluginLibraryInfo getBreakpointNetPluginInfo()
+llvm::PassPluginLibraryInfo jvs::getBreakpointNetPluginInfo()
 {
   return
   {
@@ -40,20 +50,13 @@ static llvm::PassPluginLibraryInfo getBreakpointNetPluginInfo()
 
           return false;
         });
+
+      jvs::register_function_pass(passBuilder, BreakpointNetExtensionPoint,
+        [] { return jvs::BreakpointNetPass(); });
     }
   };
 }
 
-} // namespace
-
-// This function is required for `opt` to be able to recognize this pass when
-// requested in the pass pipeline.
-extern "C" LLVM_ATTRIBUTE_WEAK auto llvmGetPassPluginInfo()
--> ::llvm::PassPluginLibraryInfo
-{
-  return getBreakpointNetPluginInfo();
-}
-
 
 
 llvm::PreservedAnalyses jvs::BreakpointNetPass::run(llvm::Function& f, 
@@ -1,16 +1,26 @@
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
 
 
 #include "passes/demote-registers.h"
+#include "support/extension-point.h"
 
 namespace
 {
 
 static constexpr char PluginName[] = "DemoteRegisters";
 
+static llvm::cl::opt<jvs::ExtensionPoint> DemoteRegistersExtensionPoint(
+  "demote-registers-ep",
+  llvm::cl::desc("Where to add demote-registers to the default pipelines"),
+  llvm::cl::init(jvs::ExtensionPoint::None),
+  jvs::function_extension_point_values());
+
+} // namespace
+
 // Pass registration
-static llvm::PassPluginLibraryInfo getDemoteRegistersPluginInfo()
+llvm::PassPluginLibraryInfo jvs::getDemoteRegistersPluginInfo()
 {
   return
   {
@@ -31,16 +41,9 @@ static llvm::PassPluginLibraryInfo getDemoteRegistersPluginInfo()
 
           return false;
         });
+
+      jvs::register_function_pass(passBuilder, DemoteRegistersExtensionPoint,
+        [] { return jvs::DemoteRegistersPass(); });
     }
   };
 }
-
-} // namespace
-
-// This function is required for `opt` to be able to recognize this pass when
-// requested in the pass pipeline.
-extern "C" LLVM_ATTRIBUTE_WEAK auto llvmGetPassPluginInfo()
--> ::llvm::PassPluginLibraryInfo
-{
-  return getDemoteRegistersPluginInfo();
-}
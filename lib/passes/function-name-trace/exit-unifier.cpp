@@ -0,0 +1,223 @@
+#include "exit-unifier.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Analysis/EHPersonalities.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+namespace
+{
+
+static bool is_landing_pad_personality(llvm::Value* personality)
+{
+  return !llvm::isScopedEHPersonality(
+    llvm::classifyEHPersonality(personality));
+}
+
+//!
+//! Makes every return in `returns` branch to a single new return block.
+//!
+//! @returns
+//!   The only return left, or null if there were no returns.
+//!
+static llvm::ReturnInst* merge_returns(llvm::Function& f,
+  llvm::ArrayRef<llvm::ReturnInst*> returns)
+{
+  if (returns.size() <= 1)
+  {
+    return returns.empty() ? nullptr : returns.front();
+  }
+
+  auto* returnBlock = llvm::BasicBlock::Create(f.getContext(), "trace.return",
+    &f);
+  llvm::IRBuilder<> builder(returnBlock);
+  llvm::PHINode* valuePhi = nullptr;
+  llvm::ReturnInst* mergedReturn = nullptr;
+  if (f.getReturnType()->isVoidTy())
+  {
+    mergedReturn = builder.CreateRetVoid();
+  }
+  else
+  {
+    valuePhi = builder.CreatePHI(f.getReturnType(), returns.size());
+    mergedReturn = builder.CreateRet(valuePhi);
+  }
+
+  for (llvm::ReturnInst* retInst : returns)
+  {
+    if (valuePhi)
+    {
+      valuePhi->addIncoming(retInst->getReturnValue(), retInst->getParent());
+    }
+
+    llvm::BranchInst::Create(returnBlock, retInst);
+    retInst->eraseFromParent();
+  }
+
+  return mergedReturn;
+}
+
+//!
+//! Makes every resume in `resumes` branch to a single new resume block, and
+//! turns every call in `calls` into an invoke unwinding to a new cleanup
+//! landing pad which also branches there.
+//!
+//! @returns
+//!   The only resume left.
+//!
+static llvm::ResumeInst* merge_unwinds(llvm::Function& f,
+  llvm::Type* exceptionType, llvm::ArrayRef<llvm::ResumeInst*> resumes,
+  llvm::ArrayRef<llvm::CallInst*> calls)
+{
+  if (resumes.size() == 1 && calls.empty())
+  {
+    return resumes.front();
+  }
+
+  llvm::LLVMContext& context = f.getContext();
+  auto* resumeBlock = llvm::BasicBlock::Create(context, "trace.resume", &f);
+  llvm::IRBuilder<> builder(resumeBlock);
+  llvm::PHINode* exceptionPhi = builder.CreatePHI(exceptionType,
+    resumes.size() + 1);
+  llvm::ResumeInst* mergedResume = builder.CreateResume(exceptionPhi);
+  for (llvm::ResumeInst* resumeInst : resumes)
+  {
+    exceptionPhi->addIncoming(resumeInst->getValue(),
+      resumeInst->getParent());
+    llvm::BranchInst::Create(resumeBlock, resumeInst);
+    resumeInst->eraseFromParent();
+  }
+
+  if (calls.empty())
+  {
+    return mergedResume;
+  }
+
+  auto* cleanupBlock = llvm::BasicBlock::Create(context, "trace.cleanup", &f,
+    resumeBlock);
+  builder.SetInsertPoint(cleanupBlock);
+  llvm::LandingPadInst* landingPad = builder.CreateLandingPad(exceptionType,
+    0);
+  landingPad->setCleanup(true);
+  builder.CreateBr(resumeBlock);
+  exceptionPhi->addIncoming(landingPad, cleanupBlock);
+  for (llvm::CallInst* callInst : calls)
+  {
+    llvm::changeToInvokeAndSplitBasicBlock(callInst, cleanupBlock);
+  }
+
+  return mergedResume;
+}
+
+} // namespace
+
+
+jvs::ExitUnifier::ExitUnifier(llvm::Module& m)
+{
+  for (llvm::Function& f : m)
+  {
+    if (f.hasPersonalityFn() &&
+      is_landing_pad_personality(f.getPersonalityFn()))
+    {
+      personality_ = f.getPersonalityFn();
+      break;
+    }
+  }
+}
+
+jvs::ExitUnifier::ExitUnifier(llvm::Constant* personality)
+  : personality_(personality && is_landing_pad_personality(personality)
+    ? personality
+    : nullptr)
+{
+}
+
+void jvs::ExitUnifier::unify(llvm::Function& f,
+  std::vector<llvm::Instruction*>& exits)
+{
+  llvm::Constant* personality = f.hasPersonalityFn()
+    ? f.getPersonalityFn()
+    : personality_;
+  bool catchesUnwinding = personality && !f.doesNotThrow() &&
+    is_landing_pad_personality(personality);
+
+  std::vector<llvm::ReturnInst*> returns{};
+  std::vector<llvm::ResumeInst*> resumes{};
+  std::vector<llvm::CallInst*> throwingCalls{};
+  llvm::Type* exceptionType = nullptr;
+  for (llvm::Instruction& inst : llvm::instructions(f))
+  {
+    if (auto* retInst = llvm::dyn_cast<llvm::ReturnInst>(&inst))
+    {
+      // Nothing can go between a musttail call and its return.
+      if (llvm::CallInst* mustTailCall =
+        retInst->getParent()->getTerminatingMustTailCall())
+      {
+        exits.push_back(mustTailCall);
+      }
+      else
+      {
+        returns.push_back(retInst);
+      }
+    }
+    else if (auto* resumeInst = llvm::dyn_cast<llvm::ResumeInst>(&inst))
+    {
+      resumes.push_back(resumeInst);
+      exceptionType = resumeInst->getValue()->getType();
+    }
+    else if (auto* landingPad = llvm::dyn_cast<llvm::LandingPadInst>(&inst))
+    {
+      exceptionType = landingPad->getType();
+    }
+    else if (auto* callInst = llvm::dyn_cast<llvm::CallInst>(&inst))
+    {
+      const llvm::Function* callee = callInst->getCalledFunction();
+      if (callInst->isMustTailCall() || callInst->isInlineAsm() ||
+        (callee && callee->isIntrinsic()))
+      {
+        continue;
+      }
+
+      if (catchesUnwinding && !callInst->doesNotThrow())
+      {
+        throwingCalls.push_back(callInst);
+      }
+      else if (callInst->doesNotReturn())
+      {
+        exits.push_back(callInst);
+      }
+    }
+  }
+
+  if (llvm::ReturnInst* retInst = merge_returns(f, returns))
+  {
+    exits.push_back(retInst);
+  }
+
+  if (resumes.empty() && throwingCalls.empty())
+  {
+    return;
+  }
+
+  if (!exceptionType)
+  {
+    // The usual { i8*, i32 } of the Itanium ABI.
+    llvm::LLVMContext& context = f.getContext();
+    exceptionType = llvm::StructType::get(context,
+      {llvm::Type::getInt8PtrTy(context), llvm::Type::getInt32Ty(context)});
+  }
+
+  if (!throwingCalls.empty() && !f.hasPersonalityFn())
+  {
+    f.setPersonalityFn(personality);
+  }
+
+  exits.push_back(merge_unwinds(f, exceptionType, resumes, throwingCalls));
+}
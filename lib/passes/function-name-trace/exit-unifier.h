@@ -0,0 +1,72 @@
+#if !defined(JVS_PSEUDO_PASSES_FUNCTION_NAME_TRACE_EXIT_UNIFIER_H_)
+#define JVS_PSEUDO_PASSES_FUNCTION_NAME_TRACE_EXIT_UNIFIER_H_
+
+#include <vector>
+
+// forward declarations
+namespace llvm
+{
+
+class Constant;
+class Function;
+class Instruction;
+class Module;
+
+} // namespace llvm
+
+
+namespace jvs
+{
+
+//!
+//! Funnels every way a function can leave through as few instructions as
+//! possible, so exit instrumentation is emitted a bounded number of times:
+//!
+//! - Returns branch to one shared return block (except those following a
+//!   `musttail` call, which are left in place and exit before the call).
+//! - Calls which may throw become invokes unwinding to one shared cleanup
+//!   landing pad, which, along with any `resume` already in the function,
+//!   branches to one shared block resuming the exception.
+//! - Calls which never return (and won't unwind through the landing pad),
+//!   such as exit(), exit before the call.
+//!
+//! Functions without a personality are given the one the rest of the module
+//! uses, if any, so exceptions unwinding through them can be seen. Unwinding
+//! isn't instrumented in modules with no landing pad based personality (e.g.
+//! C code, or the funclet based Windows exception handling), where only the
+//! returns and noreturn calls are.
+//!
+class ExitUnifier
+{
+public:
+  //!
+  //! Creates a unifier giving functions without a personality the one used
+  //! by the rest of `m`.
+  //!
+  explicit ExitUnifier(llvm::Module& m);
+
+  //!
+  //! Creates a unifier giving functions without a personality the given one,
+  //! or leaving their unwinding alone if it's null.
+  //!
+  explicit ExitUnifier(llvm::Constant* personality);
+
+  //!
+  //! Rewrites `f` as described above.
+  //!
+  //! @param [out] exits
+  //!   Gets the instructions before which the exit instrumentation should be
+  //!   emitted.
+  //!
+  void unify(llvm::Function& f, std::vector<llvm::Instruction*>& exits);
+
+private:
+  // Personality given to functions that have none, or null if unwinding
+  // isn't instrumented.
+  llvm::Constant* personality_{nullptr};
+};
+
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_FUNCTION_NAME_TRACE_EXIT_UNIFIER_H_
@@ -0,0 +1,219 @@
+#include "function-filter.h"
+
+#include <memory>
+#include <utility>
+
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+namespace
+{
+
+static constexpr char RegexPrefix[] = "re:";
+
+//!
+//! Converts a glob to an (unanchored) extended regular expression.
+//!
+//! @returns
+//!   The regular expression, or no value if the glob has no wildcards, in
+//!   which case `literal` is set to the name it matches.
+//!
+static std::optional<std::string> glob_to_regex(llvm::StringRef glob,
+  std::string& literal)
+{
+  std::string regex{};
+  bool hasWildcards = false;
+  for (std::size_t index = 0; index < glob.size(); ++index)
+  {
+    char c = glob[index];
+    switch (c)
+    {
+    case '*':
+      regex += ".*";
+      hasWildcards = true;
+      continue;
+    case '?':
+      regex += '.';
+      hasWildcards = true;
+      continue;
+    case '[':
+    {
+      std::size_t end = glob.find(']', index + 1);
+      if (end != llvm::StringRef::npos)
+      {
+        llvm::StringRef bracket = glob.slice(index, end + 1);
+        regex += bracket.startswith("[!")
+          ? ("[^" + bracket.drop_front(2)).str()
+          : bracket.str();
+        hasWildcards = true;
+        index = end;
+        continue;
+      }
+
+      break;
+    }
+    case '\\':
+      if (index + 1 < glob.size())
+      {
+        c = glob[++index];
+      }
+
+      break;
+    default:
+      break;
+    }
+
+    literal += c;
+    if (llvm::StringRef("^$.|()[]{}*+?\\").contains(c))
+    {
+      regex += '\\';
+    }
+
+    regex += c;
+  }
+
+  if (!hasWildcards)
+  {
+    return {};
+  }
+
+  return regex;
+}
+
+} // namespace
+
+
+llvm::Expected<jvs::FunctionFilter> jvs::FunctionFilter::load(
+  llvm::StringRef path)
+{
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (!buffer)
+  {
+    return llvm::createStringError(buffer.getError(),
+      "unable to read filter file '%s': %s", path.str().c_str(),
+      buffer.getError().message().c_str());
+  }
+
+  return parse((*buffer)->getBuffer());
+}
+
+llvm::Expected<jvs::FunctionFilter> jvs::FunctionFilter::parse(
+  llvm::StringRef text)
+{
+  FunctionFilter filter{};
+  llvm::SmallVector<llvm::StringRef, 32> lines{};
+  text.split(lines, '\n');
+  for (llvm::StringRef line : lines)
+  {
+    line = line.trim();
+    if (line.empty() || line.startswith("#"))
+    {
+      continue;
+    }
+
+    PatternSet& patterns = line.consume_front("!")
+      ? filter.deny_
+      : filter.allow_;
+    line.consume_front("+");
+    if (line.consume_front(RegexPrefix))
+    {
+      if (auto error = patterns.add_regex(line))
+      {
+        return error;
+      }
+
+      continue;
+    }
+
+    std::string literal{};
+    if (auto regex = glob_to_regex(line, literal))
+    {
+      if (auto error = patterns.add_regex(*regex))
+      {
+        return error;
+      }
+    }
+    else
+    {
+      patterns.add_name(literal);
+    }
+  }
+
+  if (auto error = filter.allow_.compile())
+  {
+    return error;
+  }
+
+  if (auto error = filter.deny_.compile())
+  {
+    return error;
+  }
+
+  return filter;
+}
+
+bool jvs::FunctionFilter::matches(llvm::StringRef mangledName) const
+{
+  std::string demangledName = llvm::demangle(mangledName.str());
+  auto matchesEither = [&](const PatternSet& patterns)
+  {
+    return patterns.matches(mangledName) ||
+      (demangledName != mangledName && patterns.matches(demangledName));
+  };
+
+  if (matchesEither(deny_))
+  {
+    return false;
+  }
+
+  return allow_.empty() || matchesEither(allow_);
+}
+
+void jvs::FunctionFilter::PatternSet::add_name(llvm::StringRef name)
+{
+  names_.insert(name);
+}
+
+llvm::Error jvs::FunctionFilter::PatternSet::add_regex(llvm::StringRef regex)
+{
+  // Check each pattern on its own so errors point at the right one.
+  std::string error{};
+  if (!llvm::Regex(regex).isValid(error))
+  {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+      "invalid filter pattern '%s': %s", regex.str().c_str(), error.c_str());
+  }
+
+  combined_regex_ += combined_regex_.empty() ? "^((" : ")|(";
+  combined_regex_ += regex.str();
+  return llvm::Error::success();
+}
+
+llvm::Error jvs::FunctionFilter::PatternSet::compile()
+{
+  if (combined_regex_.empty())
+  {
+    return llvm::Error::success();
+  }
+
+  combined_regex_ += "))$";
+  regex_.emplace(combined_regex_);
+  std::string error{};
+  if (!regex_->isValid(error))
+  {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+      "invalid filter patterns: %s", error.c_str());
+  }
+
+  return llvm::Error::success();
+}
+
+bool jvs::FunctionFilter::PatternSet::empty() const
+{
+  return names_.empty() && !regex_;
+}
+
+bool jvs::FunctionFilter::PatternSet::matches(llvm::StringRef name) const
+{
+  return names_.count(name) != 0 || (regex_ && regex_->match(name));
+}
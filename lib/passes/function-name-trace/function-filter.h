@@ -0,0 +1,77 @@
+#if !defined(JVS_PSEUDO_PASSES_FUNCTION_NAME_TRACE_FUNCTION_FILTER_H_)
+#define JVS_PSEUDO_PASSES_FUNCTION_NAME_TRACE_FUNCTION_FILTER_H_
+
+#include <optional>
+#include <string>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Regex.h"
+
+namespace jvs
+{
+
+//!
+//! Selects the functions function-name-trace instruments, from a file of
+//! patterns given by `function-name-trace<filter=path>`.
+//!
+//! Each line of the file holds one pattern, matched against both the mangled
+//! and the demangled name of a function. A pattern is a glob (`*`, `?` and
+//! `[...]`, with `\` escaping the next character), or a regular expression if
+//! it starts with `re:`. Patterns starting with `!` deny functions, and all
+//! others (optionally starting with `+`) allow them. Blank lines and lines
+//! starting with `#` are ignored.
+//!
+//! A function is selected if no deny pattern matches it and either an allow
+//! pattern matches it or there are no allow patterns.
+//!
+//! Patterns without wildcards are looked up in a set of names, and the rest
+//! of each list is compiled into a single regular expression, so the cost of
+//! matching a name doesn't grow with the number of patterns.
+//!
+class FunctionFilter
+{
+public:
+  //!
+  //! Reads and compiles the patterns in the given file.
+  //!
+  static llvm::Expected<FunctionFilter> load(llvm::StringRef path);
+
+  //!
+  //! Compiles the patterns in the given text (in the format of a filter file).
+  //!
+  static llvm::Expected<FunctionFilter> parse(llvm::StringRef text);
+
+  bool matches(llvm::StringRef mangledName) const;
+
+private:
+  //!
+  //! One of the allow/deny lists.
+  //!
+  class PatternSet
+  {
+  public:
+    void add_name(llvm::StringRef name);
+    llvm::Error add_regex(llvm::StringRef regex);
+    llvm::Error compile();
+
+    bool empty() const;
+    bool matches(llvm::StringRef name) const;
+
+  private:
+    llvm::StringSet<> names_{};
+    std::string combined_regex_{};
+    std::optional<llvm::Regex> regex_{};
+  };
+
+  FunctionFilter() = default;
+
+  PatternSet allow_{};
+  PatternSet deny_{};
+};
+
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_FUNCTION_NAME_TRACE_FUNCTION_FILTER_H_
@@ -1,191 +1,462 @@
 #include "passes/function-name-trace.h"
 
-#include <string>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
 
-#include "llvm/ADT/DenseMap.h"
-#include "llvm/Demangle/Demangle.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/Attributes.h"
 #include "llvm/IR/BasicBlock.h"
-#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Instructions.h"
-#include "llvm/IR/IntrinsicInst.h"
-#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
-#include "llvm/Passes/PassBuilder.h"
-#include "llvm/Passes/PassPlugin.h"
-#include "llvm/Support/Casting.h"
-#include "llvm/Support/FormatVariadic.h"
-#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Instrumentation.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
-#include "support/type-util.h"
-#include "support/value-util.h"
+
+#include "exit-unifier.h"
+#include "function-filter.h"
+#include "trace-emitter.h"
 
 namespace
 {
 
-static constexpr char PluginName[] = "FunctionNameTrace";
+static constexpr char SampleCountdownName[] = "__jvs_trace_sample_countdown";
+static constexpr char EnabledWordName[] = "__jvs_trace_enabled";
+
+// Personality the function pass gives functions without one, if the module
+// declares it.
+static constexpr char CxxPersonalityName[] = "__gxx_personality_v0";
+
+// Weight of the (usual) disabled side of the guard branches.
+static constexpr std::uint32_t GuardedBranchWeight = 1000;
 
-// Pass registration
-static llvm::PassPluginLibraryInfo getFunctionNameTracePluginInfo()
+//!
+//! Gets the thread local countdown to the next sampled call. It's shared by
+//! every module in the same binary, so the rate applies to the calls of all
+//! of them together.
+//!
+static llvm::GlobalVariable* get_sample_countdown(llvm::Module& m)
 {
-  return
+  if (auto* countdown = m.getGlobalVariable(SampleCountdownName))
   {
-    LLVM_PLUGIN_API_VERSION,
-    PluginName,
-    LLVM_VERSION_STRING,
-    [](llvm::PassBuilder& passBuilder)
-    {
-      passBuilder.registerPipelineParsingCallback(
-        [&](llvm::StringRef name, llvm::ModulePassManager& mpm,
-          llvm::ArrayRef<llvm::PassBuilder::PipelineElement>)
-        {
-          if (name.equals("function-name-trace"))
-          {
-            mpm.addPass(jvs::FunctionNameTracePass());
-            return true;
-          }
-
-          return false;
-        });
-    }
-  };
-}
+    return countdown;
+  }
 
-} // namespace
+  auto* int32Type = llvm::Type::getInt32Ty(m.getContext());
+  auto* countdown = new llvm::GlobalVariable(m, int32Type, false,
+    llvm::GlobalValue::LinkOnceODRLinkage,
+    llvm::ConstantInt::get(int32Type, 0), SampleCountdownName, nullptr,
+    llvm::GlobalValue::GeneralDynamicTLSModel);
+  countdown->setVisibility(llvm::GlobalValue::HiddenVisibility);
+  return countdown;
+}
 
-// This function is required for `opt` to be able to recognize this pass when
-// requested in the pass pipeline.
-extern "C" LLVM_ATTRIBUTE_WEAK auto llvmGetPassPluginInfo()
--> ::llvm::PassPluginLibraryInfo
+//!
+//! Gets the word through which the runtime switches guarded tracing on and
+//! off as a whole.
+//!
+static llvm::GlobalVariable* get_enabled_word(llvm::Module& m)
 {
-  return getFunctionNameTracePluginInfo();
+  if (auto* enabled = m.getGlobalVariable(EnabledWordName))
+  {
+    return enabled;
+  }
+
+  return new llvm::GlobalVariable(m, llvm::Type::getInt32Ty(m.getContext()),
+    false, llvm::GlobalValue::ExternalLinkage, nullptr, EnabledWordName);
 }
 
-namespace
+//!
+//! One of the conditions deciding whether a call is traced.
+//!
+struct EntryCondition
 {
+  //! Block testing the condition.
+  llvm::BasicBlock* Head;
+  //! Terminator of the block run when the condition holds.
+  llvm::Instruction* ThenTerm;
+};
+
 //!
-//! Gets an llvm::FunctionCallee for the puts() function.
+//! Emits `if (condition)` at the builder's insertion point, leaving the
+//! builder in the conditional block. Conditions are nested by emitting them
+//! in turn.
 //!
-//! @param [in,out] m
-//!   the llvm::Module to process.
+static EntryCondition emit_entry_condition(llvm::IRBuilder<>& builder,
+  llvm::Value* condition, llvm::MDNode* weights)
+{
+  llvm::Instruction* splitPt = &*builder.GetInsertPoint();
+  EntryCondition entryCondition{};
+  entryCondition.Head = splitPt->getParent();
+  entryCondition.ThenTerm = llvm::SplitBlockAndInsertIfThen(condition,
+    splitPt, false, weights);
+  builder.SetInsertPoint(entryCondition.ThenTerm);
+  return entryCondition;
+}
+
 //!
-//! @returns
-//!   The puts() llvm::FunctionCallee.
+//! Makes a value computed inside the innermost of the (nested) conditions
+//! available after the outermost one, taking the value `otherValue` when any
+//! of the conditions didn't hold.
 //!
-static llvm::FunctionCallee get_puts(llvm::Module& m) noexcept
+static llvm::Value* merge_conditional_value(llvm::IRBuilder<>& builder,
+  llvm::ArrayRef<EntryCondition> conditions, llvm::Value* value,
+  llvm::Value* otherValue)
 {
-  auto* putsType = 
-    jvs::create_type<jvs::ir_types::Int<32>(jvs::ir_types::Int<8>*)>(m);
-  auto putsCallee = m.getOrInsertFunction("puts", putsType);
-  llvm::cast<llvm::Function>(putsCallee.getCallee())->setDSOLocal(true);
-  return putsCallee;
+  for (const EntryCondition& condition : llvm::reverse(conditions))
+  {
+    llvm::BasicBlock* tail = condition.ThenTerm->getSuccessor(0);
+    builder.SetInsertPoint(tail, tail->getFirstInsertionPt());
+    auto* valuePhi = builder.CreatePHI(value->getType(), 2);
+    valuePhi->addIncoming(value, condition.ThenTerm->getParent());
+    valuePhi->addIncoming(otherValue, condition.Head);
+    value = valuePhi;
+  }
+
+  return value;
 }
 
-} // namespace 
+//!
+//! Emits the check of the runtime's enable word at the builder's insertion
+//! point, the first of the guard checks. While tracing is disabled the whole
+//! cost is the load of the enable word and one branch.
+//!
+static void emit_enabled_check(llvm::IRBuilder<>& builder, llvm::Module& m,
+  llvm::SmallVectorImpl<EntryCondition>& conditions)
+{
+  auto* int32Type = builder.getInt32Ty();
+  auto* enabledLoad = builder.CreateAlignedLoad(int32Type,
+    get_enabled_word(m), llvm::Align(4));
+  enabledLoad->setAtomic(llvm::AtomicOrdering::Monotonic);
+  conditions.push_back(emit_entry_condition(builder,
+    builder.CreateICmpNE(enabledLoad, builder.getInt32(0)),
+    llvm::MDBuilder(builder.getContext())
+      .createBranchWeights(1, GuardedBranchWeight)));
+}
 
+//!
+//! Emits the check of the function's own enable flag at the builder's
+//! insertion point, if the emitter can switch individual functions.
+//!
+static void emit_function_enabled_check(llvm::IRBuilder<>& builder,
+  jvs::TraceEmitter& emitter, llvm::Function& f,
+  llvm::SmallVectorImpl<EntryCondition>& conditions)
+{
+  if (llvm::Value* functionEnabled = emitter.emit_function_enabled(builder, f))
+  {
+    conditions.push_back(emit_entry_condition(builder, functionEnabled,
+      llvm::MDBuilder(builder.getContext())
+        .createBranchWeights(1, GuardedBranchWeight)));
+  }
+}
 
-llvm::PreservedAnalyses jvs::FunctionNameTracePass::run(llvm::Module& m, 
-  llvm::ModuleAnalysisManager& manager)
+//!
+//! Emits the sampling decision at the builder's insertion point: the call is
+//! sampled when the countdown is zero, in which case the countdown restarts,
+//! and otherwise the countdown decrements. The countdown update is branch
+//! free, so the fast path only costs the (predictable) branch on the
+//! decision.
+//!
+static void emit_sample_check(llvm::IRBuilder<>& builder, llvm::Module& m,
+  std::uint32_t sampleRate, llvm::SmallVectorImpl<EntryCondition>& conditions)
 {
-  llvm::DenseMap<llvm::Function*, llvm::GlobalVariable*> enteringMap{};
-  llvm::DenseMap<llvm::Function*, llvm::GlobalVariable*> leavingMap{};
-  // Get a FunctionCallee that refers to the "puts" function.
-  auto putsCallee = get_puts(m);
-  if (!putsCallee)
+  llvm::GlobalVariable* countdown = get_sample_countdown(m);
+  auto* int32Type = builder.getInt32Ty();
+  llvm::Value* count = builder.CreateLoad(int32Type, countdown);
+  llvm::Value* sampled = builder.CreateICmpEQ(count, builder.getInt32(0));
+  builder.CreateStore(builder.CreateSelect(sampled,
+    builder.getInt32(sampleRate - 1),
+    builder.CreateSub(count, builder.getInt32(1))), countdown);
+  conditions.push_back(emit_entry_condition(builder, sampled,
+    llvm::MDBuilder(builder.getContext())
+      .createBranchWeights(1, sampleRate - 1)));
+}
+
+//!
+//! Checks whether a call site could call an instrumented function, as
+//! opposed to an intrinsic or inline assembly.
+//!
+static bool is_traced_call_site(const llvm::CallBase& callSite)
+{
+  if (callSite.isInlineAsm())
   {
-    // WEIRD.
-    m.getContext().emitError("puts() function wasn't found.");
-    LLVM_BUILTIN_UNREACHABLE;
+    return false;
   }
 
-  auto putsFunc = llvm::cast<llvm::Function>(putsCallee.getCallee());
-  llvm::IRBuilder<> builder(m.getContext());
-  for (llvm::Function& f : m)
+  const llvm::Function* callee = callSite.getCalledFunction();
+  return !callee || !callee->isIntrinsic();
+}
+
+//!
+//! Checks whether a function can be instrumented at all.
+//!
+static bool is_traceable(const llvm::Function& f)
+{
+  return !f.empty() && !f.hasFnAttribute(llvm::Attribute::OptimizeNone);
+}
+
+//!
+//! Instruments the call sites of a function, using the values the emitter's
+//! call site entry instrumentation created under the given conditions (the
+//! guard's enable word check, if any). While those don't hold, the call sites
+//! are skipped with one branch each.
+//!
+static void instrument_call_sites(llvm::IRBuilder<>& builder,
+  jvs::TraceEmitter& emitter, llvm::Function& f,
+  llvm::ArrayRef<llvm::CallBase*> callSites, jvs::TraceEntry callSiteEntry,
+  llvm::ArrayRef<EntryCondition> conditions)
+{
+  if (conditions.empty())
   {
-    if (f.empty() || f.hasFnAttribute(llvm::Attribute::OptimizeNone))
+    for (llvm::CallBase* callSite : callSites)
     {
-      continue;
+      builder.SetInsertPoint(callSite);
+      emitter.emit_call_site(builder, f, callSiteEntry);
     }
 
-    if (auto* putsFunc = llvm::dyn_cast<llvm::Function>(putsCallee.getCallee()))
+    return;
+  }
+
+  llvm::Value* enabled = merge_conditional_value(builder, conditions,
+    builder.getTrue(), builder.getFalse());
+  if (llvm::Value* functionId = callSiteEntry.FunctionId)
+  {
+    callSiteEntry.FunctionId = merge_conditional_value(builder, conditions,
+      functionId, llvm::UndefValue::get(functionId->getType()));
+  }
+
+  for (llvm::CallBase* callSite : callSites)
+  {
+    builder.SetInsertPoint(llvm::SplitBlockAndInsertIfThen(enabled, callSite,
+      false));
+    emitter.emit_call_site(builder, f, callSiteEntry);
+  }
+}
+
+//!
+//! Instruments the entry, the exits and (if the emitter wants them) the call
+//! sites of one function.
+//!
+static void instrument_function(llvm::Function& f, jvs::TraceEmitter& emitter,
+  const jvs::FunctionNameTraceOptions& options, jvs::ExitUnifier& exitUnifier)
+{
+  llvm::IRBuilder<> builder(f.getContext());
+  bool tracesExits = emitter.traces_exits();
+  bool tracesCallSites = emitter.traces_call_sites();
+  std::vector<llvm::Instruction*> exits{};
+  std::vector<llvm::CallBase*> callSites{};
+
+  // Funnel the exits (including unwinding) into as few places as possible
+  // first, as it rewrites calls.
+  if (tracesExits)
+  {
+    exitUnifier.unify(f, exits);
+  }
+
+  if (tracesCallSites)
+  {
+    for (llvm::Instruction& inst : llvm::instructions(f))
     {
-      if (putsFunc == &f)
+      auto* callSite = llvm::dyn_cast<llvm::CallBase>(&inst);
+      if (callSite && is_traced_call_site(*callSite))
       {
-        continue;
+        callSites.push_back(callSite);
       }
     }
+  }
+
+  // Make sure the entry block for this function is arranged properly.
+  auto insertPt = llvm::PrepareToSplitEntryBlock(f.getEntryBlock(),
+    f.getEntryBlock().begin());
+
+  // Decide whether to trace the call, if tracing is conditional.
+  builder.SetInsertPoint(&*insertPt);
+  llvm::SmallVector<EntryCondition, 3> conditions{};
+  if (options.Guard)
+  {
+    emit_enabled_check(builder, *f.getParent(), conditions);
+  }
 
-    // Make sure the entry block for this function is arranged properly.
-    auto insertPt = llvm::PrepareToSplitEntryBlock(f.getEntryBlock(),
-      f.getEntryBlock().begin());
-
-    auto zeroConst = 
-      llvm::ConstantInt::get(jvs::create_type<jvs::ir_types::Int<64>>(m), 
-        static_cast<std::uint64_t>(0));
-    llvm::Constant* enteringConst{nullptr};
-    llvm::GlobalVariable* enteringVar{nullptr};
-    auto funcNameIter = enteringMap.find(&f);
-    if (funcNameIter != enteringMap.end())
+  // The call sites are instrumented whenever tracing is enabled, even in
+  // calls which aren't traced themselves, as the calls they make may be.
+  jvs::TraceEntry callSiteEntry{};
+  if (tracesCallSites)
+  {
+    callSiteEntry = emitter.emit_call_site_entry(builder, f);
+  }
+
+  if (options.Guard)
+  {
+    emit_function_enabled_check(builder, emitter, f, conditions);
+  }
+
+  if (options.SampleRate > 1)
+  {
+    emit_sample_check(builder, *f.getParent(), options.SampleRate, conditions);
+  }
+
+  // Create the entry function call.
+  jvs::TraceEntry entry = emitter.emit_entry(builder, f, callSiteEntry);
+  if (!callSites.empty())
+  {
+    instrument_call_sites(builder, emitter, f, callSites, callSiteEntry,
+      options.Guard ? llvm::makeArrayRef(conditions).take_front(1)
+        : llvm::ArrayRef<EntryCondition>{});
+  }
+
+  if (exits.empty())
+  {
+    return;
+  }
+
+  if (conditions.empty())
+  {
+    for (llvm::Instruction* exitInst : exits)
     {
-      enteringVar = funcNameIter->second;
+      // Create an exit function call.
+      builder.SetInsertPoint(exitInst);
+      emitter.emit_exit(builder, f, entry);
     }
-    else
+
+    return;
+  }
+
+  // Only trace the exits of the calls whose entries were traced.
+  llvm::Value* traced = merge_conditional_value(builder, conditions,
+    builder.getTrue(), builder.getFalse());
+  for (llvm::Value** value :
+    {&entry.FunctionId, &entry.StartTime, &entry.StackDepth})
+  {
+    if (*value)
     {
-      // Generate a string for this entering point.
-      std::string enterName = llvm::formatv(
-        "\n[>] Entering {0}\n", llvm::demangle(f.getName().str()));
-      enteringConst =
-        jvs::create_string_constant(m, llvm::StringRef(enterName));
-      enteringVar = new llvm::GlobalVariable(m, enteringConst->getType(), 
-        true, llvm::GlobalValue::LinkageTypes::LinkOnceODRLinkage, 
-        enteringConst, enterName);
-      enteringVar->setDSOLocal(true);
-      enteringVar->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
-      auto [insertIter, wasInserted] = enteringMap.try_emplace(&f, enteringVar);
+      *value = merge_conditional_value(builder, conditions, *value,
+        llvm::UndefValue::get((*value)->getType()));
     }
+  }
 
-    // Create the entry function call.
-    builder.SetInsertPoint(&*insertPt);
-    builder.CreateCall(putsCallee,
-      builder.CreateInBoundsGEP(enteringVar, {zeroConst, zeroConst}));
+  for (llvm::Instruction* exitInst : exits)
+  {
+    llvm::Instruction* tracedExitTerm = llvm::SplitBlockAndInsertIfThen(
+      traced, exitInst, false);
+    builder.SetInsertPoint(tracedExitTerm);
+    emitter.emit_exit(builder, f, entry);
+  }
+}
+
+} // namespace
 
-    // Create the exit points string (if it doesn't exist).
-    llvm::Constant* exitingConst{nullptr};
-    llvm::GlobalVariable* exitingVar{nullptr};
-    funcNameIter = leavingMap.find(&f);
-    if (funcNameIter != leavingMap.end())
+jvs::FunctionNameTracePass::FunctionNameTracePass(
+  FunctionNameTraceOptions options /*= {}*/)
+  : Options(std::move(options))
+{
+}
+
+llvm::PreservedAnalyses jvs::FunctionNameTracePass::run(llvm::Module& m, 
+  llvm::ModuleAnalysisManager&)
+{
+  std::optional<FunctionFilter> filter{};
+  if (!Options.FilterPath.empty())
+  {
+    auto loadedFilter = FunctionFilter::load(Options.FilterPath);
+    if (!loadedFilter)
     {
-      exitingVar = funcNameIter->second;
+      m.getContext().emitError("function-name-trace: "
+        + llvm::toString(loadedFilter.takeError()));
+      return llvm::PreservedAnalyses::all();
     }
-    else
+
+    filter.emplace(std::move(*loadedFilter));
+  }
+
+  auto emitter = create_trace_emitter(m, Options,
+    /*lazyRegistration*/ false);
+
+  // Collect the functions to trace up front so nothing the emitter adds to
+  // the module gets instrumented.
+  std::vector<llvm::Function*> functions{};
+  for (llvm::Function& f : m)
+  {
+    if (!is_traceable(f) || emitter->is_trace_function(f) ||
+      (filter && !filter->matches(f.getName())))
     {
-      // Generate a string for this entering point.
-      std::string exitName =
-        llvm::formatv("\n[<] Leaving {0}\n", llvm::demangle(f.getName().str()));
-      exitingConst = jvs::create_string_constant(m, llvm::StringRef(exitName));
-      exitingVar = new llvm::GlobalVariable(m, exitingConst->getType(),
-        true, llvm::GlobalVariable::LinkageTypes::LinkOnceODRLinkage, 
-        exitingConst, exitName);
-      exitingVar->setDSOLocal(true);
-      exitingVar->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
-      auto [insertIter, wasInserted] = enteringMap.try_emplace(&f, exitingVar);
+      continue;
     }
 
-    for (llvm::Instruction& inst : llvm::instructions(f))
+    functions.push_back(&f);
+  }
+
+  ExitUnifier exitUnifier(m);
+  for (llvm::Function* f : functions)
+  {
+    instrument_function(*f, *emitter, Options, exitUnifier);
+  }
+
+  emitter->finish();
+  return functions.empty()
+    ? llvm::PreservedAnalyses::all()
+    : llvm::PreservedAnalyses::none();
+}
+
+jvs::FunctionNameTraceFunctionPass::FunctionNameTraceFunctionPass(
+  FunctionNameTraceOptions options /*= {}*/)
+  : Options(std::move(options))
+{
+  // Load the filter once, rather than for every function. It's never changed
+  // after this, so copies of the pass can share it.
+  if (!Options.FilterPath.empty())
+  {
+    auto loadedFilter = FunctionFilter::load(Options.FilterPath);
+    if (loadedFilter)
     {
-      if (auto* retInst = llvm::dyn_cast<llvm::ReturnInst>(&inst))
-      {
-        // Create an exit function call.
-        builder.SetInsertPoint(retInst);
-        builder.CreateCall(putsCallee,
-          builder.CreateInBoundsGEP(exitingVar, {zeroConst, zeroConst}));
-      }
+      filter_ = std::make_shared<const FunctionFilter>(
+        std::move(*loadedFilter));
     }
+    else
+    {
+      filter_error_ = llvm::toString(loadedFilter.takeError());
+    }
+  }
+}
+
+llvm::PreservedAnalyses jvs::FunctionNameTraceFunctionPass::run(
+  llvm::Function& f, llvm::FunctionAnalysisManager&)
+{
+  if (!filter_error_.empty())
+  {
+    f.getContext().emitError("function-name-trace: " + filter_error_);
+    return llvm::PreservedAnalyses::all();
+  }
+
+  // Runtime functions are skipped before the emitter is created, since
+  // creating it already adds module state (such as the module descriptor).
+  if (!is_traceable(f) || is_trace_runtime_function(f) ||
+    (filter_ && !filter_->matches(f.getName())))
+  {
+    return llvm::PreservedAnalyses::all();
+  }
+
+  // Everything the emitter creates is either private to this function or
+  // looked up in the module by name, so no state is kept between functions.
+  llvm::Module& m = *f.getParent();
+  auto emitter = create_trace_emitter(m, Options,
+    /*lazyRegistration*/ true);
+  if (emitter->is_trace_function(f))
+  {
+    // Whatever the emitter added still has to be completed.
+    emitter->finish();
+    return llvm::PreservedAnalyses::none();
   }
 
+  ExitUnifier exitUnifier(m.getFunction(CxxPersonalityName));
+  instrument_function(f, *emitter, Options, exitUnifier);
+  emitter->finish();
   return llvm::PreservedAnalyses::none();
 }
@@ -0,0 +1,197 @@
+#include <optional>
+#include <string>
+
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "passes/function-name-trace.h"
+#include "support/extension-point.h"
+#include "support/pass-parameters.h"
+
+namespace
+{
+
+static constexpr char PassName[] = "function-name-trace";
+static constexpr char PluginName[] = "FunctionNameTrace";
+
+static llvm::cl::opt<jvs::ExtensionPoint> FunctionNameTraceExtensionPoint(
+  "function-name-trace-ep",
+  llvm::cl::desc("Where to add function-name-trace to the default pipelines"),
+  llvm::cl::init(jvs::ExtensionPoint::None),
+  jvs::function_extension_point_values());
+
+static llvm::cl::opt<std::string> FunctionNameTraceParameters(
+  "function-name-trace-options",
+  llvm::cl::desc("Parameters (as in function-name-trace<...>) used when "
+    "adding function-name-trace to the default pipelines"),
+  llvm::cl::init(""));
+
+//!
+//! Parses the parameters of `function-name-trace<...>`.
+//!
+//! @returns
+//!   The options, or no value (after printing the problem) if the parameters
+//!   aren't valid.
+//!
+static std::optional<jvs::FunctionNameTraceOptions> parse_options(
+  llvm::StringRef params)
+{
+  jvs::FunctionNameTraceOptions options{};
+  for (auto& [key, value] : jvs::split_pass_parameters(params))
+  {
+    if (key.equals("text"))
+    {
+      options.Mode = jvs::FunctionNameTraceMode::Text;
+    }
+    else if (key.equals("ids"))
+    {
+      options.Mode = jvs::FunctionNameTraceMode::TextIds;
+    }
+    else if (key.equals("binary"))
+    {
+      options.Mode = jvs::FunctionNameTraceMode::Binary;
+    }
+    else if (key.equals("latency"))
+    {
+      options.Mode = jvs::FunctionNameTraceMode::Latency;
+    }
+    else if (key.equals("counts"))
+    {
+      options.Mode = jvs::FunctionNameTraceMode::Counts;
+    }
+    else if (key.equals("edges"))
+    {
+      options.Mode = jvs::FunctionNameTraceMode::Edges;
+    }
+    else if (key.equals("stacks"))
+    {
+      options.Mode = jvs::FunctionNameTraceMode::Stacks;
+    }
+    else if (key.equals("sdt"))
+    {
+      options.Mode = jvs::FunctionNameTraceMode::Sdt;
+    }
+    else if (key.equals("guard"))
+    {
+      options.Guard = true;
+    }
+    else if (key.equals("mangled"))
+    {
+      options.DemangleNames = false;
+    }
+    else if (key.equals("filter"))
+    {
+      options.FilterPath = value.str();
+    }
+    else if (key.equals("sample"))
+    {
+      if (value.getAsInteger(10, options.SampleRate) ||
+        options.SampleRate == 0)
+      {
+        llvm::errs() << PassName << ": invalid sample rate '" << value
+          << "'\n";
+        return {};
+      }
+    }
+    else
+    {
+      llvm::errs() << PassName << ": unknown parameter '" << key << "'\n";
+      return {};
+    }
+  }
+
+  // Sampled stacks would be missing the frames of the calls not sampled.
+  if (options.Mode == jvs::FunctionNameTraceMode::Stacks &&
+    options.SampleRate > 1)
+  {
+    llvm::errs() << PassName << ": sample=N can't be used with stacks\n";
+    return {};
+  }
+
+  return options;
+}
+
+} // namespace
+
+// Pass registration
+llvm::PassPluginLibraryInfo jvs::getFunctionNameTracePluginInfo()
+{
+  return
+  {
+    LLVM_PLUGIN_API_VERSION,
+    PluginName,
+    LLVM_VERSION_STRING,
+    [](llvm::PassBuilder& passBuilder)
+    {
+      passBuilder.registerPipelineParsingCallback(
+        [&](llvm::StringRef name, llvm::ModulePassManager& mpm,
+          llvm::ArrayRef<llvm::PassBuilder::PipelineElement>)
+        {
+          auto params = jvs::match_pass_name(name, PassName);
+          if (!params)
+          {
+            return false;
+          }
+
+          auto options = parse_options(*params);
+          if (!options)
+          {
+            return false;
+          }
+
+          mpm.addPass(jvs::FunctionNameTracePass(std::move(*options)));
+          return true;
+        });
+
+      // Inside function(...) (or a CGSCC pipeline), the same name gives the
+      // function pass version.
+      passBuilder.registerPipelineParsingCallback(
+        [&](llvm::StringRef name, llvm::FunctionPassManager& fpm,
+          llvm::ArrayRef<llvm::PassBuilder::PipelineElement>)
+        {
+          auto params = jvs::match_pass_name(name, PassName);
+          if (!params)
+          {
+            return false;
+          }
+
+          auto options = parse_options(*params);
+          if (!options)
+          {
+            return false;
+          }
+
+          fpm.addPass(jvs::FunctionNameTraceFunctionPass(
+            std::move(*options)));
+          return true;
+        });
+
+      if (auto options = parse_options(FunctionNameTraceParameters))
+      {
+        // Only the function pass version can go in the function
+        // simplification pipeline.
+        if (FunctionNameTraceExtensionPoint ==
+          jvs::ExtensionPoint::ScalarOptimizerLate)
+        {
+          jvs::register_function_pass(passBuilder,
+            FunctionNameTraceExtensionPoint,
+            [options = std::move(*options)]
+            {
+              return jvs::FunctionNameTraceFunctionPass(options);
+            });
+        }
+        else
+        {
+          jvs::register_module_pass(passBuilder,
+            FunctionNameTraceExtensionPoint,
+            [options = std::move(*options)]
+            {
+              return jvs::FunctionNameTracePass(options);
+            });
+        }
+      }
+    }
+  };
+}
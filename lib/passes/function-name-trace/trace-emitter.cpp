@@ -0,0 +1,704 @@
+#include "trace-emitter.h"
+
+#include <cstdint>
+#include <string>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/IR/Attributes.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/FormatVariadic.h"
+
+#include "runtime/function-name-trace.h"
+#include "support/type-util.h"
+#include "support/value-util.h"
+#include "trace-module.h"
+
+namespace
+{
+
+static constexpr char TraceFunctionPrefix[] = "__jvs_trace_";
+static constexpr char ClockHookName[] = "__jvs_trace_clock";
+static constexpr char LatencyHookName[] = "__jvs_trace_latency";
+static constexpr char EdgeHookName[] = "__jvs_trace_edge";
+static constexpr char CallerSlotName[] = "__jvs_trace_caller";
+static constexpr char ShadowStackName[] = "__jvs_trace_shadow_stack";
+
+// Names of the SDT probes, and prefix of the names of their name strings.
+static constexpr char SdtProviderName[] = "function_name_trace";
+static constexpr char SdtEntryProbeName[] = "entry";
+static constexpr char SdtExitProbeName[] = "exit";
+static constexpr char SdtNamePrefix[] = "__jvs_trace_sdt_name.";
+
+// Indices of the jvs_trace_shadow_stack fields.
+static constexpr unsigned int StackDepthField = 0;
+static constexpr unsigned int StackFramesField = 1;
+
+//!
+//! Gets an llvm::FunctionCallee for the puts() function.
+//!
+//! @param [in,out] m
+//!   the llvm::Module to process.
+//!
+//! @returns
+//!   The puts() llvm::FunctionCallee.
+//!
+static llvm::FunctionCallee get_puts(llvm::Module& m) noexcept
+{
+  auto* putsType =
+    jvs::create_type<jvs::ir_types::Int<32>(jvs::ir_types::Int<8>*)>(m);
+  auto putsCallee = m.getOrInsertFunction("puts", putsType);
+  llvm::cast<llvm::Function>(putsCallee.getCallee())->setDSOLocal(true);
+  return putsCallee;
+}
+
+//!
+//! Gets an llvm::FunctionCallee for one of the `void(i32)` runtime hooks.
+//!
+static llvm::FunctionCallee get_id_hook(llvm::Module& m, llvm::StringRef name)
+{
+  auto* hookType = llvm::FunctionType::get(
+    llvm::Type::getVoidTy(m.getContext()),
+    {jvs::create_type<jvs::ir_types::Int<32>>(m)}, false);
+  auto hookCallee = m.getOrInsertFunction(name, hookType);
+  if (auto* hookFunc = llvm::dyn_cast<llvm::Function>(hookCallee.getCallee()))
+  {
+    hookFunc->addFnAttr(llvm::Attribute::NoUnwind);
+  }
+
+  return hookCallee;
+}
+
+//!
+//! Gets the thread local slot through which call sites pass the caller's ID
+//! to the callee. Like the sampling countdown, it's shared by every module in
+//! the same binary.
+//!
+static llvm::GlobalVariable* get_caller_slot(llvm::Module& m)
+{
+  if (auto* callerSlot = m.getGlobalVariable(CallerSlotName))
+  {
+    return callerSlot;
+  }
+
+  auto* int32Type = llvm::Type::getInt32Ty(m.getContext());
+  auto* callerSlot = new llvm::GlobalVariable(m, int32Type, false,
+    llvm::GlobalValue::LinkOnceODRLinkage,
+    llvm::ConstantInt::get(int32Type, JVS_TRACE_UNKNOWN_CALLER),
+    CallerSlotName, nullptr, llvm::GlobalValue::GeneralDynamicTLSModel);
+  callerSlot->setVisibility(llvm::GlobalValue::HiddenVisibility);
+  return callerSlot;
+}
+
+//!
+//! Gets the runtime's thread local shadow stack.
+//!
+static llvm::GlobalVariable* get_shadow_stack(llvm::Module& m)
+{
+  if (auto* shadowStack = m.getGlobalVariable(ShadowStackName))
+  {
+    return shadowStack;
+  }
+
+  auto* int32Type = llvm::Type::getInt32Ty(m.getContext());
+  auto* stackType = llvm::StructType::get(m.getContext(),
+    {int32Type, llvm::ArrayType::get(int32Type, JVS_TRACE_SHADOW_STACK_SIZE)});
+  return new llvm::GlobalVariable(m, stackType, false,
+    llvm::GlobalValue::ExternalLinkage, nullptr, ShadowStackName, nullptr,
+    llvm::GlobalValue::GeneralDynamicTLSModel);
+}
+
+//!
+//! Gets the string global with the given name and contents, creating it if
+//! needed. Strings are looked up by name so emitters for the same module
+//! share them (see FunctionNameTraceFunctionPass).
+//!
+static llvm::GlobalVariable* get_string_var(llvm::Module& m,
+  const std::string& name, const std::string& text)
+{
+  if (llvm::GlobalVariable* stringVar = m.getNamedGlobal(name))
+  {
+    return stringVar;
+  }
+
+  llvm::Constant* stringConst = jvs::create_string_constant(m, text);
+  auto* stringVar = new llvm::GlobalVariable(m, stringConst->getType(), true,
+    llvm::GlobalValue::LinkageTypes::LinkOnceODRLinkage, stringConst, name);
+  stringVar->setDSOLocal(true);
+  stringVar->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+  return stringVar;
+}
+
+//!
+//! Prints "Entering"/"Leaving" lines with puts(), using a pair of string
+//! globals per function.
+//!
+class TextTraceEmitter : public jvs::TraceEmitter
+{
+public:
+  TextTraceEmitter(llvm::Module& m, bool demangleNames)
+    : module_(m),
+    puts_callee_(get_puts(m)),
+    demangle_names_(demangleNames)
+  {
+    if (!puts_callee_)
+    {
+      // WEIRD.
+      m.getContext().emitError("puts() function wasn't found.");
+      LLVM_BUILTIN_UNREACHABLE;
+    }
+
+    puts_function_ = llvm::cast<llvm::Function>(puts_callee_.getCallee());
+  }
+
+  bool is_trace_function(const llvm::Function& f) const override
+  {
+    return puts_function_ == &f;
+  }
+
+  jvs::TraceEntry emit_entry(llvm::IRBuilder<>& builder,
+    llvm::Function& f, const jvs::TraceEntry&) override
+  {
+    emit_puts(builder, get_string_vars(f).Entering);
+    return {};
+  }
+
+  void emit_exit(llvm::IRBuilder<>& builder, llvm::Function& f,
+    const jvs::TraceEntry&) override
+  {
+    emit_puts(builder, get_string_vars(f).Leaving);
+  }
+
+private:
+  struct StringVars
+  {
+    llvm::GlobalVariable* Entering;
+    llvm::GlobalVariable* Leaving;
+  };
+
+  //!
+  //! Gets the entering and leaving strings of a function, creating both the
+  //! first time so the name is only demangled once.
+  //!
+  const StringVars& get_string_vars(llvm::Function& f)
+  {
+    auto funcNameIter = string_vars_.find(&f);
+    if (funcNameIter != string_vars_.end())
+    {
+      return funcNameIter->second;
+    }
+
+    std::string name = demangle_names_
+      ? llvm::demangle(f.getName().str())
+      : f.getName().str();
+    std::string entering = llvm::formatv("\n[>] Entering {0}\n", name);
+    std::string leaving = llvm::formatv("\n[<] Leaving {0}\n", name);
+    StringVars stringVars{
+      get_string_var(module_, entering, entering),
+      get_string_var(module_, leaving, leaving)
+    };
+    return string_vars_.try_emplace(&f, stringVars).first->second;
+  }
+
+  void emit_puts(llvm::IRBuilder<>& builder, llvm::GlobalVariable* stringVar)
+  {
+    auto zeroConst =
+      llvm::ConstantInt::get(jvs::create_type<jvs::ir_types::Int<64>>(module_),
+        static_cast<std::uint64_t>(0));
+    builder.CreateCall(puts_callee_,
+      builder.CreateInBoundsGEP(stringVar->getValueType(), stringVar,
+        {zeroConst, zeroConst}));
+  }
+
+  llvm::Module& module_;
+  llvm::FunctionCallee puts_callee_;
+  const llvm::Function* puts_function_{nullptr};
+  const bool demangle_names_;
+  llvm::DenseMap<llvm::Function*, StringVars> string_vars_{};
+};
+
+//!
+//! Emits a Linux SDT probe (the USDT probes of systemtap's sys/sdt.h, which
+//! perf, bpftrace and the like can attach to) on every entry and exit, named
+//! `function_name_trace:entry` and `function_name_trace:exit`, and passing
+//! the function's name as the one argument. A probe is a `nop` plus a
+//! `.note.stapsdt` entry pointing at it, so it costs next to nothing until a
+//! tracer replaces the `nop` with a breakpoint, and needs no runtime.
+//!
+class SdtTraceEmitter : public jvs::TraceEmitter
+{
+public:
+  SdtTraceEmitter(llvm::Module& m, bool demangleNames)
+    : module_(m),
+    demangle_names_(demangleNames)
+  {
+    llvm::Triple triple(m.getTargetTriple());
+    if (!triple.isOSBinFormatELF())
+    {
+      m.getContext().emitError("function-name-trace: SDT probes need an ELF "
+        "target, not '" + triple.str() + "'");
+    }
+
+    entry_probe_ = create_probe(SdtEntryProbeName);
+    exit_probe_ = create_probe(SdtExitProbeName);
+  }
+
+  bool is_trace_function(const llvm::Function&) const override
+  {
+    return false;
+  }
+
+  jvs::TraceEntry emit_entry(llvm::IRBuilder<>& builder,
+    llvm::Function& f, const jvs::TraceEntry&) override
+  {
+    builder.CreateCall(entry_probe_, {get_name_pointer(builder, f)});
+    return {};
+  }
+
+  void emit_exit(llvm::IRBuilder<>& builder, llvm::Function& f,
+    const jvs::TraceEntry&) override
+  {
+    builder.CreateCall(exit_probe_, {get_name_pointer(builder, f)});
+  }
+
+private:
+  //!
+  //! Creates the inline assembly of a probe taking one pointer argument,
+  //! following the template of sys/sdt.h. The numeric labels are local, so
+  //! the probe can be emitted any number of times.
+  //!
+  llvm::InlineAsm* create_probe(llvm::StringRef probeName)
+  {
+    // Addresses and the argument are pointer sized.
+    unsigned int pointerSize = module_.getDataLayout().getPointerSize();
+    std::string addressDirective = pointerSize == 8 ? ".8byte" : ".4byte";
+    std::string probeAsm = llvm::formatv(
+      "990: nop\n"
+      ".pushsection .note.stapsdt,\"?\",\"note\"\n"
+      ".balign 4\n"
+      ".4byte 992f-991f, 994f-993f, 3\n"
+      "991: .asciz \"stapsdt\"\n"
+      "992: .balign 4\n"
+      "993: {0} 990b\n"
+      "{0} _.stapsdt.base\n"
+      // No semaphore; the argument is cheap enough to compute regardless.
+      "{0} 0\n"
+      ".asciz \"{1}\"\n"
+      ".asciz \"{2}\"\n"
+      ".asciz \"{3}@$0\"\n"
+      "994: .balign 4\n"
+      ".popsection\n"
+      // The base address tracers use to adjust the probe addresses of
+      // prelinked binaries, once per object file.
+      ".ifndef _.stapsdt.base\n"
+      ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,"
+      "comdat\n"
+      ".weak _.stapsdt.base\n"
+      ".hidden _.stapsdt.base\n"
+      "_.stapsdt.base: .space 1\n"
+      ".size _.stapsdt.base, 1\n"
+      ".popsection\n"
+      ".endif",
+      addressDirective, SdtProviderName, probeName, pointerSize);
+    auto* probeType = llvm::FunctionType::get(
+      llvm::Type::getVoidTy(module_.getContext()),
+      {jvs::create_type<jvs::ir_types::Int<8>*>(module_)}, false);
+    return llvm::InlineAsm::get(probeType, probeAsm, "r",
+      /*hasSideEffects*/ true);
+  }
+
+  llvm::Value* get_name_pointer(llvm::IRBuilder<>& builder, llvm::Function& f)
+  {
+    llvm::GlobalVariable*& nameVar = name_vars_[&f];
+    if (!nameVar)
+    {
+      std::string name = demangle_names_
+        ? llvm::demangle(f.getName().str())
+        : f.getName().str();
+      nameVar = get_string_var(module_,
+        (SdtNamePrefix + f.getName()).str(), name);
+    }
+
+    return builder.CreateConstInBoundsGEP2_64(nameVar->getValueType(),
+      nameVar, 0, 0);
+  }
+
+  llvm::Module& module_;
+  const bool demangle_names_;
+  llvm::InlineAsm* entry_probe_{nullptr};
+  llvm::InlineAsm* exit_probe_{nullptr};
+  llvm::DenseMap<llvm::Function*, llvm::GlobalVariable*> name_vars_{};
+};
+
+//!
+//! Base of the emitters which identify functions to the trace runtime by ID.
+//!
+class RuntimeTraceEmitter : public jvs::TraceEmitter
+{
+public:
+  RuntimeTraceEmitter(llvm::Module& m, bool lazyRegistration)
+    : trace_module_(m, lazyRegistration)
+  {
+  }
+
+  bool is_trace_function(const llvm::Function& f) const override
+  {
+    return jvs::is_trace_runtime_function(f);
+  }
+
+  llvm::Value* emit_function_enabled(llvm::IRBuilder<>& builder,
+    llvm::Function& f) override
+  {
+    return trace_module_.emit_function_enabled(builder, get_local_id(f));
+  }
+
+  void finish() override
+  {
+    trace_module_.finish();
+  }
+
+protected:
+  jvs::TraceEntry emit_function_id(llvm::IRBuilder<>& builder,
+    llvm::Function& f)
+  {
+    jvs::TraceEntry entry{};
+    entry.FunctionId = trace_module_.emit_function_id(builder,
+      get_local_id(f));
+    return entry;
+  }
+
+  void emit_call_count(llvm::IRBuilder<>& builder, llvm::Function& f)
+  {
+    trace_module_.emit_call_count(builder, get_local_id(f));
+  }
+
+  void add_module_flags(std::uint32_t flags)
+  {
+    trace_module_.add_flags(flags);
+  }
+
+private:
+  std::uint32_t get_local_id(llvm::Function& f)
+  {
+    auto [localIdIter, inserted] = local_ids_.try_emplace(&f, 0);
+    if (inserted)
+    {
+      localIdIter->second = trace_module_.add_function(f);
+    }
+
+    return localIdIter->second;
+  }
+
+  jvs::TraceModule trace_module_;
+  llvm::DenseMap<const llvm::Function*, std::uint32_t> local_ids_{};
+};
+
+//!
+//! Passes the ID of the function entered or left to a pair of trace runtime
+//! hooks, which look its name up in the module's name table if they need it.
+//!
+class IdTraceEmitter : public RuntimeTraceEmitter
+{
+public:
+  IdTraceEmitter(llvm::Module& m, bool lazyRegistration,
+    llvm::StringRef enterHookName, llvm::StringRef exitHookName)
+    : RuntimeTraceEmitter(m, lazyRegistration),
+    enter_callee_(get_id_hook(m, enterHookName)),
+    exit_callee_(get_id_hook(m, exitHookName))
+  {
+  }
+
+  jvs::TraceEntry emit_entry(llvm::IRBuilder<>& builder,
+    llvm::Function& f, const jvs::TraceEntry&) override
+  {
+    jvs::TraceEntry entry = emit_function_id(builder, f);
+    builder.CreateCall(enter_callee_, {entry.FunctionId});
+    return entry;
+  }
+
+  void emit_exit(llvm::IRBuilder<>& builder, llvm::Function&,
+    const jvs::TraceEntry& entry) override
+  {
+    builder.CreateCall(exit_callee_, {entry.FunctionId});
+  }
+
+private:
+  llvm::FunctionCallee enter_callee_;
+  llvm::FunctionCallee exit_callee_;
+};
+
+//!
+//! Reads the clock on entry and hands the reading to the trace runtime on
+//! exit, which reads the clock again and accumulates the difference in the
+//! function's latency histogram.
+//!
+class LatencyTraceEmitter : public RuntimeTraceEmitter
+{
+public:
+  LatencyTraceEmitter(llvm::Module& m, bool lazyRegistration)
+    : RuntimeTraceEmitter(m, lazyRegistration)
+  {
+    auto* int32Type = jvs::create_type<jvs::ir_types::Int<32>>(m);
+    auto* int64Type = jvs::create_type<jvs::ir_types::Int<64>>(m);
+    auto* voidType = llvm::Type::getVoidTy(m.getContext());
+
+    // The runtime's clock is the time stamp counter on x86, which the entry
+    // instrumentation can read inline. Elsewhere it has to ask the runtime,
+    // as llvm.readcyclecounter isn't necessarily readable from user mode.
+    if (llvm::Triple(m.getTargetTriple()).isX86())
+    {
+      clock_callee_ = llvm::Intrinsic::getDeclaration(&m,
+        llvm::Intrinsic::readcyclecounter);
+    }
+    else
+    {
+      clock_callee_ = m.getOrInsertFunction(ClockHookName,
+        llvm::FunctionType::get(int64Type, false));
+      if (auto* clockFunc =
+        llvm::dyn_cast<llvm::Function>(clock_callee_.getCallee()))
+      {
+        clockFunc->addFnAttr(llvm::Attribute::NoUnwind);
+      }
+    }
+
+    latency_callee_ = m.getOrInsertFunction(LatencyHookName,
+      llvm::FunctionType::get(voidType, {int32Type, int64Type}, false));
+    if (auto* latencyFunc =
+      llvm::dyn_cast<llvm::Function>(latency_callee_.getCallee()))
+    {
+      latencyFunc->addFnAttr(llvm::Attribute::NoUnwind);
+    }
+  }
+
+  jvs::TraceEntry emit_entry(llvm::IRBuilder<>& builder,
+    llvm::Function& f, const jvs::TraceEntry&) override
+  {
+    jvs::TraceEntry entry = emit_function_id(builder, f);
+    entry.StartTime = builder.CreateCall(clock_callee_);
+    return entry;
+  }
+
+  void emit_exit(llvm::IRBuilder<>& builder, llvm::Function&,
+    const jvs::TraceEntry& entry) override
+  {
+    builder.CreateCall(latency_callee_, {entry.FunctionId, entry.StartTime});
+  }
+
+private:
+  llvm::FunctionCallee clock_callee_{};
+  llvm::FunctionCallee latency_callee_{};
+};
+
+//!
+//! Stores the caller's ID in a thread local slot before each call, and on
+//! entry hands the slot's value and the callee's ID to the trace runtime,
+//! which counts the calls along each edge. The slot is reset on entry so
+//! calls from code which isn't instrumented are attributed to an unknown
+//! caller, rather than to whichever instrumented function called last. The
+//! exception is the first call back from uninstrumented code, which is
+//! attributed to the instrumented function that called out.
+//!
+class EdgeTraceEmitter : public RuntimeTraceEmitter
+{
+public:
+  EdgeTraceEmitter(llvm::Module& m, bool lazyRegistration)
+    : RuntimeTraceEmitter(m, lazyRegistration),
+    caller_slot_(get_caller_slot(m))
+  {
+    auto* int32Type = jvs::create_type<jvs::ir_types::Int<32>>(m);
+    edge_callee_ = m.getOrInsertFunction(EdgeHookName,
+      llvm::FunctionType::get(llvm::Type::getVoidTy(m.getContext()),
+        {int32Type, int32Type}, false));
+    if (auto* edgeFunc =
+      llvm::dyn_cast<llvm::Function>(edge_callee_.getCallee()))
+    {
+      edgeFunc->addFnAttr(llvm::Attribute::NoUnwind);
+    }
+  }
+
+  jvs::TraceEntry emit_entry(llvm::IRBuilder<>& builder,
+    llvm::Function&, const jvs::TraceEntry& callSiteEntry) override
+  {
+    builder.CreateCall(edge_callee_,
+      {callSiteEntry.CallerId, callSiteEntry.FunctionId});
+    jvs::TraceEntry entry{};
+    entry.FunctionId = callSiteEntry.FunctionId;
+    return entry;
+  }
+
+  bool traces_exits() const override
+  {
+    return false;
+  }
+
+  void emit_exit(llvm::IRBuilder<>&, llvm::Function&,
+    const jvs::TraceEntry&) override
+  {
+  }
+
+  bool traces_call_sites() const override
+  {
+    return true;
+  }
+
+  jvs::TraceEntry emit_call_site_entry(llvm::IRBuilder<>& builder,
+    llvm::Function& f) override
+  {
+    // The slot is reset even when the call isn't sampled, so it never holds
+    // a stale caller.
+    jvs::TraceEntry entry = emit_function_id(builder, f);
+    entry.CallerId = builder.CreateLoad(builder.getInt32Ty(), caller_slot_);
+    builder.CreateStore(builder.getInt32(JVS_TRACE_UNKNOWN_CALLER),
+      caller_slot_);
+    return entry;
+  }
+
+  void emit_call_site(llvm::IRBuilder<>& builder, llvm::Function&,
+    const jvs::TraceEntry& callSiteEntry) override
+  {
+    builder.CreateStore(callSiteEntry.FunctionId, caller_slot_);
+  }
+
+private:
+  llvm::GlobalVariable* caller_slot_;
+  llvm::FunctionCallee edge_callee_{};
+};
+
+//!
+//! Counts calls in a per-function counter, which the trace runtime writes to
+//! a call count profile at exit. Nothing is done on exit.
+//!
+class CountTraceEmitter : public RuntimeTraceEmitter
+{
+public:
+  CountTraceEmitter(llvm::Module& m, bool lazyRegistration)
+    : RuntimeTraceEmitter(m, lazyRegistration)
+  {
+  }
+
+  jvs::TraceEntry emit_entry(llvm::IRBuilder<>& builder,
+    llvm::Function& f, const jvs::TraceEntry&) override
+  {
+    emit_call_count(builder, f);
+    return {};
+  }
+
+  bool traces_exits() const override
+  {
+    return false;
+  }
+
+  void emit_exit(llvm::IRBuilder<>&, llvm::Function&,
+    const jvs::TraceEntry&) override
+  {
+  }
+};
+
+//!
+//! Pushes the function's ID onto the thread's shadow stack on entry and pops
+//! it on exit, inline and without calling the trace runtime, which samples
+//! the stacks from a SIGPROF handler (see jvs_trace_shadow_stack).
+//!
+class StackTraceEmitter : public RuntimeTraceEmitter
+{
+public:
+  StackTraceEmitter(llvm::Module& m, bool lazyRegistration)
+    : RuntimeTraceEmitter(m, lazyRegistration),
+    shadow_stack_(get_shadow_stack(m))
+  {
+    add_module_flags(JVS_TRACE_MODULE_SHADOW_STACK);
+  }
+
+  jvs::TraceEntry emit_entry(llvm::IRBuilder<>& builder,
+    llvm::Function& f, const jvs::TraceEntry&) override
+  {
+    jvs::TraceEntry entry = emit_function_id(builder, f);
+    auto* int32Type = builder.getInt32Ty();
+    auto* depthLoad = builder.CreateAlignedLoad(int32Type,
+      get_depth_pointer(builder), llvm::Align(4));
+    depthLoad->setAtomic(llvm::AtomicOrdering::Monotonic);
+    entry.StackDepth = depthLoad;
+
+    // Frames past the end of the stack all go in the scratch frame, so the
+    // push is branch free.
+    llvm::Value* lastFrame = builder.getInt32(JVS_TRACE_SHADOW_STACK_SIZE - 1);
+    llvm::Value* frameIndex = builder.CreateSelect(
+      builder.CreateICmpULT(depthLoad, lastFrame), depthLoad, lastFrame);
+    builder.CreateStore(entry.FunctionId,
+      builder.CreateInBoundsGEP(shadow_stack_->getValueType(), shadow_stack_,
+        {builder.getInt32(0), builder.getInt32(StackFramesField),
+          frameIndex}));
+
+    // The sampler runs on the same thread, so it only needs the frame to be
+    // stored before the depth covering it, as far as the compiler's concerned.
+    builder.CreateFence(llvm::AtomicOrdering::Release,
+      llvm::SyncScope::SingleThread);
+    store_depth(builder, builder.CreateAdd(depthLoad, builder.getInt32(1)));
+    return entry;
+  }
+
+  void emit_exit(llvm::IRBuilder<>& builder, llvm::Function&,
+    const jvs::TraceEntry& entry) override
+  {
+    store_depth(builder, entry.StackDepth);
+  }
+
+private:
+  llvm::Value* get_depth_pointer(llvm::IRBuilder<>& builder)
+  {
+    return builder.CreateStructGEP(shadow_stack_->getValueType(),
+      shadow_stack_, StackDepthField);
+  }
+
+  void store_depth(llvm::IRBuilder<>& builder, llvm::Value* depth)
+  {
+    builder.CreateAlignedStore(depth, get_depth_pointer(builder),
+      llvm::Align(4))->setAtomic(llvm::AtomicOrdering::Monotonic);
+  }
+
+  llvm::GlobalVariable* shadow_stack_;
+};
+
+} // namespace
+
+
+bool jvs::is_trace_runtime_function(const llvm::Function& f)
+{
+  return f.getName().startswith(TraceFunctionPrefix);
+}
+
+std::unique_ptr<jvs::TraceEmitter> jvs::create_trace_emitter(llvm::Module& m,
+  const FunctionNameTraceOptions& options, bool lazyRegistration)
+{
+  switch (options.Mode)
+  {
+  case FunctionNameTraceMode::Text:
+    return std::make_unique<TextTraceEmitter>(m, options.DemangleNames);
+  case FunctionNameTraceMode::TextIds:
+    return std::make_unique<IdTraceEmitter>(m, lazyRegistration,
+      "__jvs_trace_print_enter", "__jvs_trace_print_exit");
+  case FunctionNameTraceMode::Binary:
+    return std::make_unique<IdTraceEmitter>(m, lazyRegistration,
+      "__jvs_trace_enter", "__jvs_trace_exit");
+  case FunctionNameTraceMode::Latency:
+    return std::make_unique<LatencyTraceEmitter>(m, lazyRegistration);
+  case FunctionNameTraceMode::Counts:
+    return std::make_unique<CountTraceEmitter>(m, lazyRegistration);
+  case FunctionNameTraceMode::Edges:
+    return std::make_unique<EdgeTraceEmitter>(m, lazyRegistration);
+  case FunctionNameTraceMode::Stacks:
+    return std::make_unique<StackTraceEmitter>(m, lazyRegistration);
+  case FunctionNameTraceMode::Sdt:
+    return std::make_unique<SdtTraceEmitter>(m, options.DemangleNames);
+  }
+
+  return nullptr;
+}
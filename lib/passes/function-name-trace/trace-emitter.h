@@ -0,0 +1,154 @@
+#if !defined(JVS_PSEUDO_PASSES_FUNCTION_NAME_TRACE_TRACE_EMITTER_H_)
+#define JVS_PSEUDO_PASSES_FUNCTION_NAME_TRACE_TRACE_EMITTER_H_
+
+#include <memory>
+
+#include "llvm/IR/IRBuilder.h"
+
+#include "passes/function-name-trace.h"
+
+// forward declarations
+namespace llvm
+{
+
+class Function;
+class Module;
+class Value;
+
+} // namespace llvm
+
+
+namespace jvs
+{
+
+//!
+//! Values created by TraceEmitter::emit_entry() which the exit
+//! instrumentation of the same function uses, or by
+//! TraceEmitter::emit_call_site_entry() for the entry and call site
+//! instrumentation.
+//!
+struct TraceEntry
+{
+  llvm::Value* FunctionId{nullptr};
+  //! ID of the caller, read on entry for tracing call edges.
+  llvm::Value* CallerId{nullptr};
+  //! Clock reading taken on entry, for measuring the function's latency.
+  llvm::Value* StartTime{nullptr};
+  //! Depth of the thread's shadow stack on entry, which exits restore.
+  llvm::Value* StackDepth{nullptr};
+};
+
+//!
+//! Emits the instrumentation for one FunctionNameTraceMode.
+//!
+class TraceEmitter
+{
+public:
+  virtual ~TraceEmitter() = default;
+
+  //!
+  //! Checks whether the given function is one the instrumentation calls, and
+  //! so mustn't itself be instrumented.
+  //!
+  virtual bool is_trace_function(const llvm::Function& f) const = 0;
+
+  //!
+  //! Emits the entry instrumentation of `f` at the builder's insertion point
+  //! (in the entry block).
+  //!
+  //! @param callSiteEntry
+  //!   The values emit_call_site_entry() created, if the emitter traces call
+  //!   sites.
+  //!
+  virtual TraceEntry emit_entry(llvm::IRBuilder<>& builder,
+    llvm::Function& f, const TraceEntry& callSiteEntry) = 0;
+
+  //!
+  //! Emits the check of whether the runtime has tracing of the given function
+  //! enabled, at the builder's insertion point.
+  //!
+  //! @returns
+  //!   The (i1) result, or null if the emitter can't switch functions
+  //!   individually.
+  //!
+  virtual llvm::Value* emit_function_enabled(llvm::IRBuilder<>&,
+    llvm::Function&)
+  {
+    return nullptr;
+  }
+
+  //!
+  //! Whether emit_exit() emits anything, i.e. whether the function exits need
+  //! instrumenting at all.
+  //!
+  virtual bool traces_exits() const
+  {
+    return true;
+  }
+
+  //!
+  //! Emits exit instrumentation of `f` at the builder's insertion point.
+  //!
+  virtual void emit_exit(llvm::IRBuilder<>& builder, llvm::Function& f,
+    const TraceEntry& entry) = 0;
+
+  //!
+  //! Whether emit_call_site() emits anything, i.e. whether the calls made by
+  //! the instrumented functions need instrumenting.
+  //!
+  virtual bool traces_call_sites() const
+  {
+    return false;
+  }
+
+  //!
+  //! Emits the part of the entry instrumentation of the given function which
+  //! its call sites rely on, at the builder's insertion point (in the entry
+  //! block). Unlike emit_entry(), it runs whenever tracing is enabled,
+  //! whether or not the call is traced (see `sample=N` and the per-function
+  //! switches of `guard`). Only called if traces_call_sites().
+  //!
+  virtual TraceEntry emit_call_site_entry(llvm::IRBuilder<>&,
+    llvm::Function&)
+  {
+    return {};
+  }
+
+  //!
+  //! Emits the instrumentation of a call made by the given function at the
+  //! builder's insertion point (just before the call), given the values
+  //! emit_call_site_entry() created.
+  //!
+  virtual void emit_call_site(llvm::IRBuilder<>&, llvm::Function&,
+    const TraceEntry&)
+  {
+  }
+
+  //!
+  //! Emits any module level state once every function is instrumented.
+  //!
+  virtual void finish()
+  {
+  }
+};
+
+//!
+//! Checks whether the given function belongs to the trace runtime (by its
+//! `__jvs_trace_` prefix). These are never instrumented, in any mode.
+//!
+bool is_trace_runtime_function(const llvm::Function& f);
+
+//!
+//! Creates the emitter for `options.Mode`.
+//!
+//! @param lazyRegistration
+//!   Whether the modes using the trace runtime register their descriptor
+//!   lazily (see TraceModule) rather than from a module constructor.
+//!
+std::unique_ptr<TraceEmitter> create_trace_emitter(llvm::Module& m,
+  const FunctionNameTraceOptions& options, bool lazyRegistration);
+
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_FUNCTION_NAME_TRACE_TRACE_EMITTER_H_
@@ -0,0 +1,280 @@
+#include "trace-module.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+#include "runtime/function-name-trace.h"
+#include "support/type-util.h"
+
+namespace
+{
+
+static constexpr char DescriptorName[] = "__jvs_trace_module";
+static constexpr char ConstructorName[] = "__jvs_trace_module_ctor";
+static constexpr char RegisterModuleName[] = "__jvs_trace_register_module";
+static constexpr char RegisterLazilyName[] = "__jvs_trace_register_lazily";
+
+// Sections holding the name tables, so they're kept together (and away from
+// the data the program actually uses) in the final image.
+static constexpr char NameTableSection[] = "jvs_trace_names";
+static constexpr char MachONameTableSection[] = "__TEXT,__jvs_trc_names";
+
+// Index of jvs_trace_module::base_id.
+static constexpr unsigned int BaseIdField = 2;
+
+// Runs ahead of ordinary constructors so functions they call already have
+// their IDs.
+static constexpr int ConstructorPriority = 1;
+
+// Weight of the (usual) registered side of the lazy registration branch.
+static constexpr std::uint32_t RegisteredBranchWeight = 100000;
+
+//!
+//! Gets the placeholder standing in for one of the per-function arrays,
+//! creating it the first time.
+//!
+static llvm::GlobalVariable* get_placeholder(llvm::Module& m,
+  llvm::GlobalVariable*& placeholder, llvm::Type* elementType)
+{
+  if (!placeholder)
+  {
+    placeholder = new llvm::GlobalVariable(m,
+      llvm::ArrayType::get(elementType, 0), false,
+      llvm::GlobalValue::ExternalLinkage, nullptr);
+  }
+
+  return placeholder;
+}
+
+//!
+//! Replaces a placeholder with the real per-function array, with every
+//! element starting out as `initialValue`.
+//!
+//! @returns
+//!   A pointer to the array's first element, or a null pointer if the
+//!   placeholder was never used.
+//!
+static llvm::Constant* replace_placeholder(llvm::Module& m,
+  llvm::GlobalVariable*& placeholder, llvm::Constant* initialValue,
+  std::size_t functionCount)
+{
+  auto* pointerType = initialValue->getType()->getPointerTo();
+  if (!placeholder)
+  {
+    return llvm::Constant::getNullValue(pointerType);
+  }
+
+  auto* arrayType = llvm::ArrayType::get(initialValue->getType(),
+    functionCount);
+  llvm::Constant* arrayConst = initialValue->isNullValue()
+    ? llvm::ConstantAggregateZero::get(arrayType)
+    : llvm::ConstantArray::get(arrayType,
+      std::vector<llvm::Constant*>(functionCount, initialValue));
+  auto* arrayVar = new llvm::GlobalVariable(m, arrayType, false,
+    llvm::GlobalValue::PrivateLinkage, arrayConst);
+  placeholder->replaceAllUsesWith(
+    llvm::ConstantExpr::getBitCast(arrayVar, placeholder->getType()));
+  placeholder->eraseFromParent();
+  placeholder = nullptr;
+  return llvm::ConstantExpr::getPointerCast(arrayVar, pointerType);
+}
+
+} // namespace
+
+
+jvs::TraceModule::TraceModule(llvm::Module& m, bool lazyRegistration)
+  : module_(m),
+  lazy_registration_(lazyRegistration)
+{
+  auto* int32Type = create_type<ir_types::Int<32>>(m);
+  descriptor_type_ = llvm::StructType::get(m.getContext(),
+    {int32Type, int32Type, int32Type, int32Type,
+      create_type<ir_types::Int<8>*>(m), int32Type->getPointerTo(),
+      create_type<ir_types::Int<8>*>(m), create_type<ir_types::Int<64>*>(m),
+      int32Type, int32Type});
+  descriptor_ = new llvm::GlobalVariable(m, descriptor_type_, false,
+    llvm::GlobalValue::InternalLinkage, nullptr, DescriptorName);
+}
+
+std::uint32_t jvs::TraceModule::add_function(llvm::Function& f)
+{
+  // Names are stored mangled; pseudo-trace-decode demangles them.
+  function_names_.push_back(f.getName().str());
+  return static_cast<std::uint32_t>(function_names_.size() - 1);
+}
+
+llvm::Value* jvs::TraceModule::emit_function_id(llvm::IRBuilder<>& builder,
+  std::uint32_t localId)
+{
+  auto* int32Type = builder.getInt32Ty();
+  llvm::Value* baseIdPtr = builder.CreateStructGEP(descriptor_type_,
+    descriptor_, BaseIdField);
+  if (!lazy_registration_)
+  {
+    llvm::Value* baseId = builder.CreateLoad(int32Type, baseIdPtr);
+    return builder.CreateAdd(baseId, builder.getInt32(localId), "",
+      /*HasNUW*/ true);
+  }
+
+  // Register the descriptor if this is the first time any of its functions
+  // ran. The runtime sets the base ID with a relaxed atomic store.
+  auto* baseIdLoad = builder.CreateAlignedLoad(int32Type, baseIdPtr,
+    llvm::Align(4));
+  baseIdLoad->setAtomic(llvm::AtomicOrdering::Monotonic);
+  llvm::Instruction* splitPt = &*builder.GetInsertPoint();
+  llvm::BasicBlock* head = builder.GetInsertBlock();
+  llvm::Instruction* registerTerm = llvm::SplitBlockAndInsertIfThen(
+    builder.CreateICmpEQ(baseIdLoad,
+      builder.getInt32(JVS_TRACE_UNREGISTERED)),
+    splitPt, false, llvm::MDBuilder(module_.getContext())
+      .createBranchWeights(1, RegisteredBranchWeight));
+  builder.SetInsertPoint(registerTerm);
+  auto registerLazily = module_.getOrInsertFunction(RegisterLazilyName,
+    llvm::FunctionType::get(int32Type, {descriptor_type_->getPointerTo()},
+      false));
+  llvm::Value* registeredId = builder.CreateCall(registerLazily,
+    {descriptor_});
+
+  builder.SetInsertPoint(splitPt);
+  auto* baseIdPhi = builder.CreatePHI(int32Type, 2);
+  baseIdPhi->addIncoming(baseIdLoad, head);
+  baseIdPhi->addIncoming(registeredId, registerTerm->getParent());
+  return builder.CreateAdd(baseIdPhi, builder.getInt32(localId), "",
+    /*HasNUW*/ true);
+}
+
+llvm::Value* jvs::TraceModule::emit_function_enabled(
+  llvm::IRBuilder<>& builder, std::uint32_t localId)
+{
+  auto* int8Type = builder.getInt8Ty();
+  llvm::GlobalVariable* enabledFlags = get_placeholder(module_,
+    enabled_placeholder_, int8Type);
+  auto* enabledLoad = builder.CreateAlignedLoad(int8Type,
+    builder.CreateConstInBoundsGEP2_64(enabledFlags->getValueType(),
+      enabledFlags, 0, localId),
+    llvm::Align(1));
+  enabledLoad->setAtomic(llvm::AtomicOrdering::Monotonic);
+  return builder.CreateICmpNE(enabledLoad, builder.getInt8(0));
+}
+
+void jvs::TraceModule::emit_call_count(llvm::IRBuilder<>& builder,
+  std::uint32_t localId)
+{
+  // Relaxed increments are enough, since the counts are only read at exit,
+  // and need no function ID, system call or string.
+  llvm::GlobalVariable* callCounts = get_placeholder(module_,
+    counts_placeholder_, builder.getInt64Ty());
+  builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add,
+    builder.CreateConstInBoundsGEP2_64(callCounts->getValueType(),
+      callCounts, 0, localId),
+    builder.getInt64(1), llvm::AtomicOrdering::Monotonic);
+}
+
+void jvs::TraceModule::add_flags(std::uint32_t flags)
+{
+  flags_ |= flags;
+}
+
+void jvs::TraceModule::finish()
+{
+  if (function_names_.empty())
+  {
+    descriptor_->eraseFromParent();
+    descriptor_ = nullptr;
+    return;
+  }
+
+  // Every function starts out enabled, and with no calls.
+  llvm::Constant* enabledFlags = replace_placeholder(module_,
+    enabled_placeholder_,
+    llvm::ConstantInt::get(create_type<ir_types::Int<8>>(module_), 1),
+    function_names_.size());
+  llvm::Constant* callCounts = replace_placeholder(module_,
+    counts_placeholder_,
+    llvm::ConstantInt::get(create_type<ir_types::Int<64>>(module_), 0),
+    function_names_.size());
+
+  // All the names go in one NUL separated table, with each distinct name
+  // stored once, and functions refer to theirs by offset. This keeps the
+  // names out of the symbol table and needs no relocations beyond the two in
+  // the descriptor.
+  llvm::LLVMContext& context = module_.getContext();
+  llvm::SmallString<4096> nameTable{};
+  llvm::StringMap<std::uint32_t> nameOffsets{};
+  std::vector<std::uint32_t> offsets{};
+  offsets.reserve(function_names_.size());
+  for (const std::string& name : function_names_)
+  {
+    auto [nameIter, inserted] = nameOffsets.try_emplace(name,
+      static_cast<std::uint32_t>(nameTable.size()));
+    if (inserted)
+    {
+      nameTable.append(name);
+      nameTable.push_back('\0');
+    }
+
+    offsets.push_back(nameIter->second);
+  }
+
+  // Names are only ever read by the runtime, so they're private and unnamed.
+  bool isMachO = llvm::Triple(module_.getTargetTriple()).isOSBinFormatMachO();
+  auto* nameTableConst = llvm::ConstantDataArray::getString(context,
+    nameTable.str(), false);
+  auto* nameTableVar = new llvm::GlobalVariable(module_,
+    nameTableConst->getType(), true, llvm::GlobalValue::PrivateLinkage,
+    nameTableConst);
+  nameTableVar->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+  nameTableVar->setAlignment(llvm::Align(1));
+  nameTableVar->setSection(isMachO ? MachONameTableSection : NameTableSection);
+
+  auto* offsetsConst = llvm::ConstantDataArray::get(context, offsets);
+  auto* offsetsVar = new llvm::GlobalVariable(module_,
+    offsetsConst->getType(), true, llvm::GlobalValue::PrivateLinkage,
+    offsetsConst);
+  offsetsVar->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+
+  auto* int32Type = create_type<ir_types::Int<32>>(module_);
+  descriptor_->setInitializer(llvm::ConstantStruct::get(descriptor_type_,
+    {
+      llvm::ConstantInt::get(int32Type, JVS_TRACE_ABI_VERSION),
+      llvm::ConstantInt::get(int32Type, function_names_.size()),
+      llvm::ConstantInt::get(int32Type,
+        lazy_registration_ ? JVS_TRACE_UNREGISTERED : 0),
+      llvm::ConstantInt::get(int32Type, nameTable.size()),
+      llvm::ConstantExpr::getPointerCast(nameTableVar,
+        create_type<ir_types::Int<8>*>(module_)),
+      llvm::ConstantExpr::getPointerCast(offsetsVar,
+        int32Type->getPointerTo()),
+      enabledFlags,
+      callCounts,
+      llvm::ConstantInt::get(int32Type, flags_),
+      llvm::ConstantInt::get(int32Type, 0),
+    }));
+
+  if (lazy_registration_)
+  {
+    return;
+  }
+
+  // Register the descriptor with the runtime from a module constructor.
+  auto* voidType = llvm::Type::getVoidTy(context);
+  auto registerModule = module_.getOrInsertFunction(RegisterModuleName,
+    llvm::FunctionType::get(voidType, {descriptor_type_->getPointerTo()},
+      false));
+  auto* ctor = llvm::Function::Create(
+    llvm::FunctionType::get(voidType, false),
+    llvm::GlobalValue::InternalLinkage, ConstructorName, module_);
+  llvm::IRBuilder<> builder(llvm::BasicBlock::Create(context, "", ctor));
+  builder.CreateCall(registerModule, {descriptor_});
+  builder.CreateRetVoid();
+  llvm::appendToGlobalCtors(module_, ctor, ConstructorPriority);
+}
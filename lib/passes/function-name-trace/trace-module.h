@@ -0,0 +1,103 @@
+#if !defined(JVS_PSEUDO_PASSES_FUNCTION_NAME_TRACE_TRACE_MODULE_H_)
+#define JVS_PSEUDO_PASSES_FUNCTION_NAME_TRACE_TRACE_MODULE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llvm/IR/IRBuilder.h"
+
+// forward declarations
+namespace llvm
+{
+
+class Function;
+class GlobalVariable;
+class Module;
+class StructType;
+class Value;
+
+} // namespace llvm
+
+
+namespace jvs
+{
+
+//!
+//! Builds the module descriptor (a `jvs_trace_module`, see
+//! runtime/function-name-trace.h) through which the trace runtime assigns
+//! IDs to the functions instrumented in a module.
+//!
+//! Each instrumented function gets a dense module local index. At run time
+//! its ID is the module's base ID (filled in by the runtime when the module's
+//! constructor registers the descriptor) plus that index.
+//!
+//! With lazy registration, there's no constructor. Instead the code computing
+//! a function ID registers the descriptor itself if it hasn't been yet, so
+//! descriptors can be created for one function at a time without adding
+//! functions to the module (see FunctionNameTraceFunctionPass).
+//!
+class TraceModule
+{
+public:
+  TraceModule(llvm::Module& m, bool lazyRegistration);
+
+  TraceModule(const TraceModule&) = delete;
+  TraceModule& operator=(const TraceModule&) = delete;
+
+  //!
+  //! Assigns the next module local index to the given function.
+  //!
+  std::uint32_t add_function(llvm::Function& f);
+
+  //!
+  //! Emits the computation of the run time ID of the function with the given
+  //! module local index.
+  //!
+  llvm::Value* emit_function_id(llvm::IRBuilder<>& builder,
+    std::uint32_t localId);
+
+  //!
+  //! Emits the check of the runtime's enable flag for the function with the
+  //! given module local index. The module only gets the flags (see
+  //! `jvs_trace_module::function_enabled`) if this is used.
+  //!
+  llvm::Value* emit_function_enabled(llvm::IRBuilder<>& builder,
+    std::uint32_t localId);
+
+  //!
+  //! Emits the increment of the call counter of the function with the given
+  //! module local index. The module only gets the counters (see
+  //! `jvs_trace_module::call_counts`) if this is used.
+  //!
+  void emit_call_count(llvm::IRBuilder<>& builder, std::uint32_t localId);
+
+  //!
+  //! Sets the given JVS_TRACE_MODULE_* flags in the descriptor.
+  //!
+  void add_flags(std::uint32_t flags);
+
+  //!
+  //! Fills in the descriptor and, unless it's registered lazily, emits the
+  //! module constructor registering it. Does nothing if no functions were
+  //! added.
+  //!
+  void finish();
+
+private:
+  llvm::Module& module_;
+  const bool lazy_registration_;
+  llvm::StructType* descriptor_type_;
+  llvm::GlobalVariable* descriptor_;
+  // Stand in for the enable flags and call counters until finish() knows how
+  // many functions there are.
+  llvm::GlobalVariable* enabled_placeholder_{nullptr};
+  llvm::GlobalVariable* counts_placeholder_{nullptr};
+  std::uint32_t flags_{0};
+  std::vector<std::string> function_names_{};
+};
+
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_FUNCTION_NAME_TRACE_TRACE_MODULE_H_
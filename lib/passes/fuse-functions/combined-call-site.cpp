@@ -18,14 +18,17 @@
 #include "llvm/IR/Value.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 
+#include "support/metadata-index.h"
 #include "support/metadata-util.h"
 
 std::vector<jvs::CombinedCallSite> jvs::find_combined_call_sites(
-  llvm::Function& caller)
+  llvm::Function& caller, MetadataIndex* metadataIndex)
 {
   std::vector<jvs::CombinedCallSite> combinedCallSites{};
   // Generate ranges of existing callee-name-tagged instructions.
-  auto funcNameInstRange = jvs::find_metadata(caller, jvs::FuseFunctionName);
+  auto funcNameInstRange = metadataIndex
+    ? metadataIndex->find_metadata(jvs::FuseFunctionName)
+    : jvs::find_metadata(caller, jvs::FuseFunctionName);
   std::vector<llvm::Instruction*> funcNameInsts(funcNameInstRange.begin(),
     funcNameInstRange.end());
 
@@ -50,18 +53,19 @@ std::vector<jvs::CombinedCallSite> jvs::find_combined_call_sites(
     llvm::LoadInst* condLoad =
       llvm::cast<llvm::LoadInst>(switchInst->getCondition());
     CombinedCallSite combinedCallElement(caller, calleeName, *switchInst, 
-      *condLoad);
+      *condLoad, metadataIndex);
     combinedCallSites.push_back(std::move(combinedCallElement));
   }
 
   return combinedCallSites;
 }
 
-auto jvs::map_combined_call_sites(llvm::Function& caller) noexcept
+auto jvs::map_combined_call_sites(llvm::Function& caller,
+  MetadataIndex* metadataIndex) noexcept
   -> llvm::DenseMap<llvm::StringRef, std::vector<jvs::CombinedCallSite>>
 {
   llvm::DenseMap<llvm::StringRef, std::vector<jvs::CombinedCallSite>> results{};
-  auto combinedSites = find_combined_call_sites(caller);
+  auto combinedSites = find_combined_call_sites(caller, metadataIndex);
   while (!combinedSites.empty())
   {
     auto combinedSite = std::move(combinedSites.back());
@@ -75,11 +79,12 @@ auto jvs::map_combined_call_sites(llvm::Function& caller) noexcept
 
 jvs::CombinedCallSite::CombinedCallSite(llvm::Function& caller,
   llvm::StringRef calleeName, llvm::SwitchInst& returnSwitch, 
-  llvm::LoadInst& parentBlockIdLoad)
+  llvm::LoadInst& parentBlockIdLoad, MetadataIndex* metadataIndex)
   : caller_(&caller),
   callee_name_(calleeName),
   return_switch_(&returnSwitch),
-  parent_block_id_load_(&parentBlockIdLoad)
+  parent_block_id_load_(&parentBlockIdLoad),
+  metadata_index_(metadataIndex)
 {
 }
 
@@ -90,19 +95,26 @@ llvm::Function& jvs::CombinedCallSite::caller() const noexcept
 
 std::vector<std::uint64_t> jvs::CombinedCallSite::get_block_ids() const noexcept
 {
+  const IdBlockMap& returnBlockMap = get_return_blocks();
   std::vector<std::uint64_t> blockIds{};
-  blockIds.reserve(return_switch_->getNumCases());
-  llvm::transform(return_switch_->cases(), std::back_inserter(blockIds),
-    [](const llvm::SwitchInst::CaseHandle& c)
+  blockIds.reserve(returnBlockMap.size());
+  llvm::transform(returnBlockMap, std::back_inserter(blockIds),
+    [](const IdBlockPair& idBlock)
     {
-      return c.getCaseValue()->getZExtValue();
+      return idBlock.first;
     });
   return blockIds;
 }
 
-jvs::IdStoreMap jvs::CombinedCallSite::get_block_id_stores() const noexcept
+auto jvs::CombinedCallSite::get_block_id_stores() const noexcept
+-> const IdStoreMap&
 {
-  IdStoreMap idStoreMap{};
+  if (block_id_stores_)
+  {
+    return *block_id_stores_;
+  }
+
+  IdStoreMap& idStoreMap = block_id_stores_.emplace();
   auto condAlloca =
     llvm::cast<llvm::Instruction>(parent_block_id_load_->getPointerOperand());
   for (auto user : condAlloca->users())
@@ -126,6 +138,28 @@ jvs::IdStoreMap jvs::CombinedCallSite::get_block_id_stores() const noexcept
   return idStoreMap;
 }
 
+void jvs::CombinedCallSite::add_block_id(std::uint64_t blockId,
+  llvm::StoreInst* store, llvm::BasicBlock* returnBlock)
+{
+  if (block_id_stores_)
+  {
+    (*block_id_stores_)[blockId] = store;
+  }
+
+  if (return_blocks_)
+  {
+    (*return_blocks_)[blockId] = returnBlock;
+  }
+}
+
+void jvs::CombinedCallSite::clear_cached_state() noexcept
+{
+  block_id_stores_.reset();
+  return_blocks_.reset();
+  argument_pointers_.reset();
+  return_store_ = nullptr;
+}
+
 llvm::AllocaInst* jvs::CombinedCallSite::get_block_id_pointer() const noexcept
 {
   return llvm::dyn_cast<llvm::AllocaInst>(
@@ -134,37 +168,23 @@ llvm::AllocaInst* jvs::CombinedCallSite::get_block_id_pointer() const noexcept
 
 std::uint64_t jvs::CombinedCallSite::get_max_block_id() const noexcept
 {
-  auto blockIds = get_block_ids();
-  if (blockIds.empty())
+  // The return blocks are ordered by ID.
+  const IdBlockMap& returnBlockMap = get_return_blocks();
+  if (returnBlockMap.empty())
   {
     return ~static_cast<std::uint64_t>(0);
   }
 
-  return *std::max_element(blockIds.begin(), blockIds.end());
+  return returnBlockMap.rbegin()->first;
 }
 
 jvs::IdBlockMap jvs::CombinedCallSite::get_branching_blocks()
   const noexcept
 {
   IdBlockMap idBranchBlockMap{};
-  auto condAlloca = 
-    llvm::cast<llvm::Instruction>(parent_block_id_load_->getPointerOperand());
-  for (auto user : condAlloca->users())
+  for (auto& [blockId, blockIdStore] : get_block_id_stores())
   {
-    if (auto storeInst = llvm::dyn_cast<llvm::StoreInst>(user))
-    {
-      auto storeBlock = storeInst->getParent();
-      auto predRange = llvm::predecessors(parent_block_id_load_->getParent());
-      if (llvm::is_contained(predRange, storeBlock))
-      {
-        if (auto idConstant = 
-          llvm::dyn_cast<llvm::ConstantInt>(storeInst->getValueOperand()))
-        {
-          // Found a predecessor that sets its branch ID.
-          idBranchBlockMap.emplace(idConstant->getZExtValue(), storeBlock);
-        }
-      }
-    }
+    idBranchBlockMap.emplace(blockId, blockIdStore->getParent());
   }
   
   return idBranchBlockMap;
@@ -173,26 +193,30 @@ jvs::IdBlockMap jvs::CombinedCallSite::get_branching_blocks()
 llvm::BasicBlock* jvs::CombinedCallSite::get_branching_block(
   std::uint64_t blockId) const noexcept
 {
-  auto branchBlockMap = get_branching_blocks();
-  if (auto foundIt = branchBlockMap.find(blockId);
-    foundIt != branchBlockMap.end())
+  const IdStoreMap& idStoreMap = get_block_id_stores();
+  if (auto foundIt = idStoreMap.find(blockId); foundIt != idStoreMap.end())
   {
-    return foundIt->second;
+    return foundIt->second->getParent();
   }
 
   return nullptr;
 }
 
-jvs::IdBlockMap jvs::CombinedCallSite::get_return_blocks() const
-  noexcept
-{  
+auto jvs::CombinedCallSite::get_return_blocks() const noexcept
+-> const IdBlockMap&
+{
+  if (return_blocks_)
+  {
+    return *return_blocks_;
+  }
+
   auto idBlockRange = llvm::map_range(return_switch_->cases(),
     [](const llvm::SwitchInst::CaseHandle& c)
     {
       return std::make_pair(
         c.getCaseValue()->getZExtValue(), c.getCaseSuccessor());
     });
-  IdBlockMap idReturnBlockMap{};
+  IdBlockMap& idReturnBlockMap = return_blocks_.emplace();
   idReturnBlockMap.insert(idBlockRange.begin(), idBlockRange.end());
   return idReturnBlockMap;
 }
@@ -200,7 +224,7 @@ jvs::IdBlockMap jvs::CombinedCallSite::get_return_blocks() const
 llvm::BasicBlock* jvs::CombinedCallSite::get_return_block(std::uint64_t blockId)
   const noexcept
 {
-  auto returnBlockMap = get_return_blocks();
+  const IdBlockMap& returnBlockMap = get_return_blocks();
   if (auto foundIt = returnBlockMap.find(blockId);
     foundIt != returnBlockMap.end())
   {
@@ -210,13 +234,20 @@ llvm::BasicBlock* jvs::CombinedCallSite::get_return_block(std::uint64_t blockId)
   return nullptr;
 }
 
-jvs::ArgIdxAllocaMap jvs::CombinedCallSite::get_argument_pointers() const 
-  noexcept
+auto jvs::CombinedCallSite::get_argument_pointers() const noexcept
+-> const ArgIdxAllocaMap&
 {
-  ArgIdxAllocaMap argPtrMap{};
+  if (argument_pointers_)
+  {
+    return *argument_pointers_;
+  }
+
+  ArgIdxAllocaMap& argPtrMap = argument_pointers_.emplace();
   llvm::Function* func = parent_block_id_load_->getFunction();
-  for (llvm::Instruction* inst : 
-    jvs::find_metadata(*func, jvs::FuseFunctionArgIdx))
+  auto argIdxInsts = metadata_index_
+    ? metadata_index_->find_metadata(jvs::FuseFunctionArgIdx)
+    : jvs::find_metadata(*func, jvs::FuseFunctionArgIdx);
+  for (llvm::Instruction* inst : argIdxInsts)
   {
     if (auto funcNameBuffer = jvs::get_metadata(*inst, jvs::FuseFunctionName))
     {
@@ -243,7 +274,7 @@ llvm::AllocaInst* jvs::CombinedCallSite::get_argument_pointer(
   std::size_t argIdx) 
   const noexcept
 {
-  auto argPtrMap = get_argument_pointers();
+  const ArgIdxAllocaMap& argPtrMap = get_argument_pointers();
   if (auto foundIt = argPtrMap.find(argIdx); foundIt != argPtrMap.end())
   {
     return foundIt->second;
@@ -254,6 +285,11 @@ llvm::AllocaInst* jvs::CombinedCallSite::get_argument_pointer(
 
 llvm::StoreInst* jvs::CombinedCallSite::get_return_store() const noexcept
 {
+  if (return_store_)
+  {
+    return return_store_;
+  }
+
   llvm::Instruction* blockFront = &*return_switch_->getParent()->begin();
   auto prevNode = return_switch_->getPrevNode();
   while (prevNode && prevNode != blockFront)
@@ -265,6 +301,7 @@ llvm::StoreInst* jvs::CombinedCallSite::get_return_store() const noexcept
         jvs::FuseFunctionRet);
       if (retNameBuf && retNameBuf->equals(callee_name_))
       {
+        return_store_ = storeInst;
         return storeInst;
       }
     }
@@ -301,7 +338,7 @@ bool jvs::CombinedCallSite::combine_call(llvm::CallInst& callInst) noexcept
 
   auto calleeReturnType = callInst.getCalledFunction()->getReturnType();
   auto argCount = callInst.getNumArgOperands();
-  auto argPtrMap = get_argument_pointers();
+  const ArgIdxAllocaMap& argPtrMap = get_argument_pointers();
   if (argPtrMap.size() != argCount)
   {
     return false;
@@ -312,8 +349,8 @@ bool jvs::CombinedCallSite::combine_call(llvm::CallInst& callInst) noexcept
   auto blockIdConst = llvm::ConstantInt::get(llvm::IntegerType::get(
     callInst.getModule()->getContext(), 32), blockId);
   // Store the block ID in the appropriate allocation.
-  new llvm::StoreInst(blockIdConst, parent_block_id_load_->getPointerOperand(),
-    &callInst);
+  auto* blockIdStore = new llvm::StoreInst(blockIdConst, 
+    parent_block_id_load_->getPointerOperand(), &callInst);
   // Store the call arguments (if any).
   if (!argPtrMap.empty())
   {
@@ -378,13 +415,14 @@ bool jvs::CombinedCallSite::combine_call(llvm::CallInst& callInst) noexcept
     parentBlock->splitBasicBlock(callInst.getNextNode());
   auto* callBranch =
     llvm::cast<llvm::BranchInst>(parentBlock->getTerminator());
-  callBranch->setSuccessor(0, retBlock);
+  callBranch->setSuccessor(0, parent_block_id_load_->getParent());
 
   // We no longer need the existing call site.
   callInst.eraseFromParent();
   
   // Add a new switch case for the return block.
   return_switch_->addCase(blockIdConst, retBlock);
+  add_block_id(blockId, blockIdStore, retBlock);
   return true;
 }
 
@@ -413,23 +451,30 @@ bool jvs::CombinedCallSite::combine(CombinedCallSite& other) noexcept
   // call block.
   std::uint64_t startBlockId = get_max_block_id() + 1;
   auto& ctx = return_switch_->getContext();
+  const IdBlockMap& otherReturnBlocks = other.get_return_blocks();
   for (auto& [blockId, blockIdStore] : other.get_block_id_stores())
   {
     std::uint64_t newBlockId = blockId + startBlockId;
-    auto oldIdConstant = 
-      llvm::ConstantInt::get(llvm::Type::getInt32Ty(ctx), blockId);
     auto idConstant = llvm::ConstantInt::get(llvm::Type::getInt32Ty(ctx), 
       newBlockId);
-    new llvm::StoreInst(idConstant, blockIdStore->getPointerOperand(), 
-      blockIdStore);
+    auto* newBlockIdStore = new llvm::StoreInst(idConstant,
+      blockIdStore->getPointerOperand(), blockIdStore);
     llvm::BranchInst* blockBranch = llvm::cast<llvm::BranchInst>(
       blockIdStore->getParent()->getTerminator());
     blockBranch->setSuccessor(0, parent_block_id_load_->getParent());
     blockIdStore->eraseFromParent();
-    return_switch_->addCase(idConstant, 
-      other.return_switch_->findCaseValue(oldIdConstant)->getCaseSuccessor());
+    auto returnIt = otherReturnBlocks.find(blockId);
+    llvm::BasicBlock* returnBlock = returnIt != otherReturnBlocks.end()
+      ? returnIt->second
+      : other.return_switch_->getDefaultDest();
+    return_switch_->addCase(idConstant, returnBlock);
+    add_block_id(newBlockId, newBlockIdStore, returnBlock);
   }
 
+  // Everything the other call site knew about itself now refers to erased
+  // instructions or belongs to this one.
+  other.clear_cached_state();
+
   // Replace the switch instruction in the other call block with an 
   // unreachable instruction.
   new llvm::UnreachableInst(ctx, other.return_switch_->getParent());
@@ -4,6 +4,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <map>
+#include <optional>
 #include <vector>
 
 #include "llvm/ADT/DenseMap.h"
@@ -29,6 +30,8 @@ class Value;
 namespace jvs
 {
 
+class MetadataIndex;
+
 // String constants for metadata names.
 static constexpr char FuseFunctionName[] = "fuse.function";
 static constexpr char FuseFunctionStart[] = "fuse.function.start";
@@ -45,7 +48,8 @@ using ArgIdxAllocaMap = std::map<std::size_t, llvm::AllocaInst*>;
 class CombinedCallSite
 {
   CombinedCallSite(llvm::Function& caller, llvm::StringRef calleeName,
-    llvm::SwitchInst& returnSwitch, llvm::LoadInst& parentBlockIdLoad);
+    llvm::SwitchInst& returnSwitch, llvm::LoadInst& parentBlockIdLoad,
+    MetadataIndex* metadataIndex);
 
 public:
   
@@ -63,7 +67,7 @@ public:
   }
 
   std::vector<std::uint64_t> get_block_ids() const noexcept;
-  IdStoreMap get_block_id_stores() const noexcept;
+  const IdStoreMap& get_block_id_stores() const noexcept;
   llvm::AllocaInst* get_block_id_pointer() const noexcept;
 
   std::uint64_t get_max_block_id() const noexcept;
@@ -71,11 +75,11 @@ public:
   IdBlockMap get_branching_blocks() const noexcept;
   llvm::BasicBlock* get_branching_block(std::uint64_t blockId) const noexcept;
 
-  IdBlockMap get_return_blocks() const noexcept;
+  const IdBlockMap& get_return_blocks() const noexcept;
   llvm::BasicBlock* get_return_block(std::uint64_t blockId) const
     noexcept;
 
-  ArgIdxAllocaMap get_argument_pointers() const noexcept;
+  const ArgIdxAllocaMap& get_argument_pointers() const noexcept;
   llvm::AllocaInst* get_argument_pointer(std::size_t argIdx) const noexcept;
 
   llvm::StoreInst* get_return_store() const noexcept;
@@ -85,19 +89,39 @@ public:
   bool combine(CombinedCallSite& other) noexcept;
 
   friend std::vector<CombinedCallSite> find_combined_call_sites(
-    llvm::Function& caller);
+    llvm::Function& caller, MetadataIndex* metadataIndex);
 
 private:
+  void add_block_id(std::uint64_t blockId, llvm::StoreInst* store,
+    llvm::BasicBlock* returnBlock);
+  void clear_cached_state() noexcept;
+
   llvm::Function* caller_;
   llvm::StringRef callee_name_;
   llvm::SwitchInst* return_switch_{nullptr};
   llvm::LoadInst* parent_block_id_load_{nullptr};
+  MetadataIndex* metadata_index_{nullptr};
+
+  // State derived from the IR the first time it's requested and kept up to
+  // date by combine_call() and combine() afterwards, so merging calls doesn't
+  // have to rediscover it for every call.
+  mutable std::optional<IdStoreMap> block_id_stores_{};
+  mutable std::optional<IdBlockMap> return_blocks_{};
+  mutable std::optional<ArgIdxAllocaMap> argument_pointers_{};
+  // Only set once found, since a call site may gain its return store later.
+  mutable llvm::StoreInst* return_store_{nullptr};
 };
 
+//!
+//! Finds the combined call sites in the given caller. If a metadata index for
+//! the caller is given, it is used (and kept by the returned call sites) in
+//! place of scanning the caller's instructions.
+//!
 std::vector<CombinedCallSite> find_combined_call_sites(
-  llvm::Function& caller);
+  llvm::Function& caller, MetadataIndex* metadataIndex = nullptr);
 
-auto map_combined_call_sites(llvm::Function& caller) noexcept
+auto map_combined_call_sites(llvm::Function& caller,
+  MetadataIndex* metadataIndex = nullptr) noexcept
 -> llvm::DenseMap<llvm::StringRef, std::vector<jvs::CombinedCallSite>>;
 
 } // namespace jvs
@@ -11,6 +11,7 @@
 #include <utility>
 #include <vector>
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/MapVector.h"
@@ -43,6 +44,7 @@
 #include "llvm/Transforms/Utils/LowerInvoke.h"
 
 #include "combined-call-site.h"
+#include "support/metadata-index.h"
 #include "support/metadata-util.h"
 #include "support/pass-pipeline.h"
 #include "support/unqualified.h"
@@ -117,7 +119,7 @@ static bool does_value_escape(const llvm::Instruction& inst)
   return false;
 }
 
-static void demote_registers(llvm::Function& f)
+static void demote_registers(llvm::Function& f, jvs::MetadataIndex& index)
 {
   // Find the first non-alloca instruction and create an insertion point. This 
   // is safe if the block is well-formed: it will always have a terminator;
@@ -165,18 +167,21 @@ static void demote_registers(llvm::Function& f)
     {
       if (!calleeName.empty())
       {
-        jvs::attach_metadata(*instAllocaInst, jvs::FuseFunctionRet, calleeName);
+        jvs::attach_metadata(*instAllocaInst, jvs::FuseFunctionRet, calleeName,
+          &index);
         for (auto user : instAllocaInst->users())
         {
           if (auto storeInst = llvm::dyn_cast<llvm::StoreInst>(user))
           {
-            jvs::attach_metadata(*storeInst, jvs::FuseFunctionRet, calleeName);
+            jvs::attach_metadata(*storeInst, jvs::FuseFunctionRet, calleeName,
+              &index);
           }
           else if (auto userInst = llvm::dyn_cast<llvm::Instruction>(user))
           {
             if (llvm::isa<llvm::SwitchInst>(userInst->getNextNode()))
             {
-              jvs::attach_metadata(*userInst, jvs::FuseFunctionRet, calleeName);
+              jvs::attach_metadata(*userInst, jvs::FuseFunctionRet, calleeName,
+                &index);
             }
           }
         }
@@ -224,13 +229,14 @@ static void demote_registers(llvm::Function& f)
         {
           if (funcName)
           {
-            jvs::attach_metadata(*loadInst, jvs::FuseFunctionName, *funcName);
+            jvs::attach_metadata(*loadInst, jvs::FuseFunctionName, *funcName,
+              &index);
           }
 
           if (funcArgIdx)
           {
             jvs::attach_metadata(*loadInst, jvs::FuseFunctionArgIdx,
-              *funcArgIdx);
+              *funcArgIdx, &index);
           }
         }
       }
@@ -272,6 +278,15 @@ static void get_candidate_call_sites(llvm::Function& func,
   }
 }
 
+/// Returns true if the given function may have its call sites inlined into it.
+static bool is_candidate_caller(const llvm::Function& f, bool ignoreNoInline)
+{
+  return (!f.hasFnAttribute(llvm::Attribute::OptimizeNone)
+    && !f.isDeclaration()
+    && !f.empty()
+    && (ignoreNoInline || !f.hasFnAttribute(llvm::Attribute::NoInline)));
+}
+
 /// This finds all the call sites in a module that are potential candidates for
 /// inlining. This could be turned into an analysis pass.
 static CallerCalleeCallSitesMap get_candidate_call_sites(llvm::Module& m,
@@ -280,10 +295,7 @@ static CallerCalleeCallSitesMap get_candidate_call_sites(llvm::Module& m,
   CallerCalleeCallSitesMap candidateCallMap{};
   auto funcs = llvm::make_filter_range(m, [=](llvm::Function& f)
     {
-      return (!f.hasFnAttribute(llvm::Attribute::OptimizeNone)
-        && !f.isDeclaration()
-        && !f.empty()
-        && (ignoreNoInline || !f.hasFnAttribute(llvm::Attribute::NoInline)));
+      return is_candidate_caller(f, ignoreNoInline);
     });
   for (llvm::Function& func : funcs)
   {
@@ -294,6 +306,50 @@ static CallerCalleeCallSitesMap get_candidate_call_sites(llvm::Module& m,
   return candidateCallMap;
 }
 
+/// Re-derives the candidate call sites of only the given callers. Entries for
+/// every other caller in the map are left untouched, so the cost is
+/// proportional to the size of the callers that actually changed rather than
+/// to the size of the module. The map is kept in module order (as given by
+/// `functionOrder`), the order in which a full scan would have found them.
+static void update_candidate_call_sites(CallerCalleeCallSitesMap& callMap,
+  llvm::ArrayRef<llvm::Function*> dirtyCallers, bool ignoreNoInline,
+  const llvm::DenseSet<llvm::CallInst*>& callsToIgnore,
+  const llvm::DenseMap<llvm::Function*, std::size_t>& functionOrder)
+{
+  llvm::DenseSet<llvm::Function*> dirtySet(dirtyCallers.begin(), 
+    dirtyCallers.end());
+  callMap.remove_if(
+    [&](const std::pair<llvm::Function*, CalleeCallSitesMap>& entry)
+    {
+      return dirtySet.count(entry.first) > 0;
+    });
+  for (llvm::Function* caller : dirtyCallers)
+  {
+    if (is_candidate_caller(*caller, ignoreNoInline))
+    {
+      get_candidate_call_sites(*caller, ignoreNoInline, callsToIgnore,
+        callMap);
+    }
+  }
+
+  // Rescanned callers were appended to the end of the map, so put them back
+  // in their place.
+  using Entry = std::pair<llvm::Function*, CalleeCallSitesMap>;
+  auto isBefore = [&](const Entry& lhs, const Entry& rhs)
+    {
+      return functionOrder.lookup(lhs.first) < functionOrder.lookup(rhs.first);
+    };
+  if (!llvm::is_sorted(callMap, isBefore))
+  {
+    auto entries = callMap.takeVector();
+    llvm::stable_sort(entries, isBefore);
+    for (auto& entry : entries)
+    {
+      callMap.insert(std::move(entry));
+    }
+  }
+}
+
 /// Returns the first block in the given function containing only an 
 // 'unreachable' instruction, or creates one if it doesn't exist.
 static llvm::BasicBlock* get_or_create_unreachable_block(llvm::Function& func)
@@ -316,7 +372,7 @@ static llvm::BasicBlock* get_or_create_unreachable_block(llvm::Function& func)
 }
 
 static CombinedCallSiteWorkLists combine_calls(
-  CallerCalleeCallSitesMap& callMap)
+  CallerCalleeCallSitesMap& callMap, llvm::FunctionAnalysisManager& fam)
 {
   CombinedCallSiteWorkLists workLists{};
   for (auto& [caller, calleeCallSites] : callMap)
@@ -328,7 +384,9 @@ static CombinedCallSiteWorkLists combine_calls(
     }
 
     // Generate ranges of existing callee-name-tagged instructions.
-    auto combinedCallSites = jvs::map_combined_call_sites(*caller);
+    auto& metadataIndex = fam.getResult<jvs::MetadataIndexAnalysis>(*caller);
+    auto combinedCallSites = 
+      jvs::map_combined_call_sites(*caller, &metadataIndex);
 
     for (auto& [callee, callSites] : calleeCallSites)
     {
@@ -404,10 +462,10 @@ static CombinedCallSiteWorkLists combine_calls(
           // Attach the original function name and the argument index to the PHI 
           // node.
           jvs::attach_metadata(*argNode, jvs::FuseFunctionName,
-            callee->getName());
+            callee->getName(), &metadataIndex);
           jvs::attach_metadata(*argNode, jvs::FuseFunctionArgIdx,
             llvm::StringRef(reinterpret_cast<char*>(&argCount),
-              sizeof(argCount)));
+              sizeof(argCount)), &metadataIndex);
           for (llvm::CallInst* c : callSites)
           {
             argNode->addIncoming(
@@ -438,8 +496,10 @@ static CombinedCallSiteWorkLists combine_calls(
         auto storeRetInst = new llvm::StoreInst(combinedCallInst, allocaRetInst,
           combinedCallInst);
         storeRetInst->moveAfter(combinedCallInst);
-        jvs::attach_metadata(jvs::FuseFunctionRet, callee->getName(),
-          *allocaRetInst, *storeRetInst);
+        jvs::attach_metadata(*allocaRetInst, jvs::FuseFunctionRet,
+          callee->getName(), &metadataIndex);
+        jvs::attach_metadata(*storeRetInst, jvs::FuseFunctionRet,
+          callee->getName(), &metadataIndex);
       }
 
       std::size_t callCount{0};
@@ -458,12 +518,14 @@ static CombinedCallSiteWorkLists combine_calls(
         llvm::Type::getInt32Ty(caller->getContext()), callCount, "",
         combinedCallInst);
       // Attach the name of the function to the PHI node.
-      jvs::attach_metadata(*fromNode, jvs::FuseFunctionName, callee->getName());
+      jvs::attach_metadata(*fromNode, jvs::FuseFunctionName, callee->getName(),
+        &metadataIndex);
       // Add a marker for the beggining of the function.
       jvs::create_metadata(*combinedCallInst, jvs::FuseFunctionStart, 
-        callee->getName());
+        callee->getName(), &metadataIndex);
       // Add a marker for the end of the function.
-      jvs::create_metadata(*callBlock, jvs::FuseFunctionEnd, callee->getName());
+      jvs::create_metadata(*callBlock, jvs::FuseFunctionEnd, callee->getName(),
+        &metadataIndex);
       // Since we must have a default case, we point it at an unreachable block
       // (since all cases are being accounted for).
       auto* switchBack = llvm::SwitchInst::Create(fromNode,
@@ -471,7 +533,7 @@ static CombinedCallSiteWorkLists combine_calls(
         callBlock);
       // Attach the name of the associated function.
       jvs::attach_metadata(*switchBack, jvs::FuseFunctionName,
-        callee->getName());
+        callee->getName(), &metadataIndex);
       std::size_t switchCount{0};
       for (auto& [parentBlock, retBlock] : callSiteRet)
       {
@@ -501,25 +563,71 @@ llvm::PreservedAnalyses jvs::FuseFunctionsPass::run(llvm::Module& m,
   llvm::ModuleAnalysisManager& manager)
 {
   // We lower invoke instructions to call instructions to be able to inline more
-  // code.
+  // code. The nested pipelines share our analysis managers, so anything they
+  // change has already been invalidated by the time they return.
   llvm::PreservedAnalyses result;
   std::string parseError{};
-  std::tie(result, parseError) =
-    run_pass_pipeline(m, "module(function(lowerinvoke,simplifycfg),mergefunc)");
+  std::tie(result, parseError) = run_pass_pipeline(m,
+    "module(function(lowerinvoke,simplifycfg),mergefunc)", manager);
   if (!parseError.empty())
   {
     llvm::errs() << "Error parsing passes: " << parseError << '\n';
     return result;
   }
 
+  // The metadata index of each caller is fetched from (and kept up to date in)
+  // the function analysis manager.
+  auto& fam =
+    manager.getResult<llvm::FunctionAnalysisManagerModuleProxy>(m).getManager();
+  auto demoteRegisters = [&](llvm::Function& f)
+    {
+      demote_registers(f, fam.getResult<jvs::MetadataIndexAnalysis>(f));
+    };
+
   llvm::DenseSet<llvm::CallInst*> failedInlineCallSites{};
   llvm::SetVector<llvm::Function*> callTargets{};
+  // Module order of every function. Callers touched during an iteration are
+  // revisited in this order so the result doesn't depend on the order in which
+  // they happened to be modified.
+  llvm::DenseMap<llvm::Function*, std::size_t> functionOrder{};
+  for (llvm::Function& f : m)
+  {
+    functionOrder.try_emplace(&f, functionOrder.size());
+  }
+
+  // Callers whose bodies changed since their call sites were last collected.
+  // Only these are rescanned; nothing else in the module can have gained or
+  // lost candidate call sites.
+  llvm::SetVector<llvm::Function*> dirtyCallers{};
+  auto takeDirtyCallers = [&]
+    {
+      std::vector<llvm::Function*> callers(dirtyCallers.begin(),
+        dirtyCallers.end());
+      llvm::sort(callers, [&](llvm::Function* lhs, llvm::Function* rhs)
+        {
+          return functionOrder.lookup(lhs) < functionOrder.lookup(rhs);
+        });
+      dirtyCallers.clear();
+      return callers;
+    };
+
   CallerCalleeCallSitesMap callMap =
     get_candidate_call_sites(m, IgnoreNoInline, failedInlineCallSites);
-  auto combinedCalls = combine_calls(callMap);
+  auto combinedCalls = combine_calls(callMap, fam);
+  // Every entry in the map has now either been combined or queued for 
+  // inlining, so none of it can be reused: a caller either gets modified by
+  // either of them (and is rescanned) or only has call sites which failed to
+  // inline, which a rescan would ignore anyway.
+  callMap.clear();
   for (llvm::Function* f : combinedCalls.ModifiedCallers)
   {
-    demote_registers(*f);
+    demoteRegisters(*f);
+    dirtyCallers.insert(f);
+  }
+
+  if (!combinedCalls.ModifiedCallers.empty())
+  {
+    result = llvm::PreservedAnalyses::none();
   }
   
   do
@@ -537,6 +645,7 @@ llvm::PreservedAnalyses jvs::FuseFunctionsPass::run(llvm::Module& m,
       //failedInlineCallSites.insert(callInst);
       ///*
       llvm::Function* candidateCallTarget = callInst->getCalledFunction();
+      llvm::Function* caller = callInst->getFunction();
       llvm::InlineFunctionInfo inlineFuncInfo{};
       auto inlineResult = llvm::InlineFunction(*callInst, inlineFuncInfo);
       if (!inlineResult.isSuccess())
@@ -549,21 +658,33 @@ llvm::PreservedAnalyses jvs::FuseFunctionsPass::run(llvm::Module& m,
         continue;
       }
   
+      // The inlined body brings its own metadata along with it, so whatever is
+      // cached for the caller (including its metadata index) is stale now.
+      fam.invalidate(*caller, llvm::PreservedAnalyses::none());
       result = llvm::PreservedAnalyses::none();
       ++NumInlinedCalls;
       callTargets.insert(candidateCallTarget);
+      dirtyCallers.insert(caller);
       //*/
     }
 
-    callMap =
-      get_candidate_call_sites(m, IgnoreNoInline, failedInlineCallSites);
+    auto touchedCallers = takeDirtyCallers();
+    update_candidate_call_sites(callMap, touchedCallers, IgnoreNoInline,
+      failedInlineCallSites, functionOrder);
     // Clean up multiple combined call sites for the same callee (if any exist).
-    bool shouldUpdateCallMap{false};
+    // Inlining is the only way a caller can end up with more than one, so only
+    // the callers touched since the last iteration need to be checked.
     llvm::SetVector<llvm::Function*> modifiedCombinedCallers{};
-    for (auto& [caller, calleeCallSites] : callMap)
+    for (llvm::Function* caller : touchedCallers)
     {
+      if (!callMap.count(caller))
+      {
+        continue;
+      }
+
       bool callerUpdated{false};
-      auto combinedCallSites = jvs::map_combined_call_sites(*caller);
+      auto combinedCallSites = jvs::map_combined_call_sites(*caller,
+        &fam.getResult<jvs::MetadataIndexAnalysis>(*caller));
       for (auto& [calleeName, combinedSites] : combinedCallSites)
       {
         if (combinedSites.size() > 1)
@@ -573,7 +694,6 @@ llvm::PreservedAnalyses jvs::FuseFunctionsPass::run(llvm::Module& m,
           for (; it != combinedSites.end(); ++it)
           {
             callerUpdated |= mainCombinedSite.combine(*it);
-            shouldUpdateCallMap |= callerUpdated;
           }
         }
       }
@@ -588,23 +708,26 @@ llvm::PreservedAnalyses jvs::FuseFunctionsPass::run(llvm::Module& m,
     {
       for (llvm::Function* f : modifiedCombinedCallers)
       {
-        demote_registers(*f);
+        demoteRegisters(*f);
       }
-    }
 
-    if (shouldUpdateCallMap)
-    {
-      callMap =
-        get_candidate_call_sites(m, IgnoreNoInline, failedInlineCallSites);
+      update_candidate_call_sites(callMap,
+        modifiedCombinedCallers.getArrayRef(), IgnoreNoInline,
+        failedInlineCallSites, functionOrder);
     }
 
-    combinedCalls = combine_calls(callMap);
+    combinedCalls = combine_calls(callMap, fam);
+    // As above, nothing in the map outlives the iteration.
+    callMap.clear();
     if (!combinedCalls.ModifiedCallers.empty())
     {
       for (llvm::Function* f : combinedCalls.ModifiedCallers)
       {
-        demote_registers(*f);
+        demoteRegisters(*f);
+        dirtyCallers.insert(f);
       }
+
+      result = llvm::PreservedAnalyses::none();
     }
   } while (!combinedCalls.CallSites.empty());
   
@@ -613,15 +736,19 @@ llvm::PreservedAnalyses jvs::FuseFunctionsPass::run(llvm::Module& m,
     callTarget->removeDeadConstantUsers();
     if (callTarget->isDefTriviallyDead())
     {
+      fam.clear(*callTarget, callTarget->getName());
       callTarget->eraseFromParent();
       ++NumFusedFunctions;
     }
   }
 
+  // Let the analysis managers know what we changed before the cleanup pipeline
+  // starts using them.
+  manager.invalidate(m, result);
   llvm::PreservedAnalyses mem2regPA;
   std::tie(mem2regPA, parseError) = 
-    //run_pass_pipeline(m, "module(function(adce,mem2reg))");
-    run_pass_pipeline(m, "module(constmerge,globalopt,globaldce)");
+    //run_pass_pipeline(m, "module(function(adce,mem2reg))", manager);
+    run_pass_pipeline(m, "module(constmerge,globalopt,globaldce)", manager);
   if (!parseError.empty())
   {
     llvm::errs() << parseError << '\n';
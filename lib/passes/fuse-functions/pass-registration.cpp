@@ -1,15 +1,26 @@
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
 
 #include "passes/fuse-functions.h"
+#include "support/extension-point.h"
+#include "support/metadata-index.h"
 
 namespace
 {
 
 static constexpr char PluginName[] = "FuseFunctions";
 
+static llvm::cl::opt<jvs::ExtensionPoint> FuseFunctionsExtensionPoint(
+  "fuse-functions-ep",
+  llvm::cl::desc("Where to add fuse-functions to the default pipelines"),
+  llvm::cl::init(jvs::ExtensionPoint::None),
+  jvs::module_extension_point_values());
+
+} // namespace
+
 // Pass registration
-static llvm::PassPluginLibraryInfo getFuseFunctionsPluginInfo()
+llvm::PassPluginLibraryInfo jvs::getFuseFunctionsPluginInfo()
 {
   return
   {
@@ -17,7 +28,13 @@ static llvm::PassPluginLibraryInfo getFuseFunctionsPluginInfo()
     PluginName,
     LLVM_VERSION_STRING,
     [](llvm::PassBuilder& passBuilder)
-    {      
+    {
+      passBuilder.registerAnalysisRegistrationCallback(
+        [](llvm::FunctionAnalysisManager& fam)
+        {
+          fam.registerPass([] { return jvs::MetadataIndexAnalysis(); });
+        });
+
       passBuilder.registerPipelineParsingCallback(
         [](llvm::StringRef name, llvm::ModulePassManager& mpm,
           llvm::ArrayRef<llvm::PassBuilder::PipelineElement>)
@@ -36,16 +53,9 @@ static llvm::PassPluginLibraryInfo getFuseFunctionsPluginInfo()
 
           return false;
         });
+
+      jvs::register_module_pass(passBuilder, FuseFunctionsExtensionPoint,
+        [] { return jvs::FuseFunctionsPass(); });
     }
   };
 }
-
-} // namespace
-
-// This function is required for `opt` to be able to recognize this pass when
-// requested in the pass pipeline.
-extern "C" LLVM_ATTRIBUTE_WEAK auto llvmGetPassPluginInfo()
--> ::llvm::PassPluginLibraryInfo
-{
-  return getFuseFunctionsPluginInfo();
-}
@@ -21,14 +21,24 @@
 #include "llvm/IR/Type.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "support/extension-point.h"
 
 namespace
 {
 
 static constexpr char PluginName[] = "PachinkoCalls";
 
+static llvm::cl::opt<jvs::ExtensionPoint> PachinkoCallsExtensionPoint(
+  "pachinko-calls-ep",
+  llvm::cl::desc("Where to add pachinko-calls to the default pipelines"),
+  llvm::cl::init(jvs::ExtensionPoint::None),
+  jvs::module_extension_point_values());
+
+} // namespace
+
 // Pass registration
-static llvm::PassPluginLibraryInfo getPachinkoCallsPluginInfo()
+llvm::PassPluginLibraryInfo jvs::getPachinkoCallsPluginInfo()
 {
   return
   {
@@ -50,20 +60,13 @@ static llvm::PassPluginLibraryInfo getPachinkoCallsPluginInfo()
 
           return false;
         });
+
+      jvs::register_module_pass(passBuilder, PachinkoCallsExtensionPoint,
+        [] { return jvs::PachinkoCallsPass(); });
     }
   };
 }
 
-} // namespace
-
-// This function is required for `opt` to be able to recognize this pass when
-// requested in the pass pipeline.
-extern "C" LLVM_ATTRIBUTE_WEAK auto llvmGetPassPluginInfo()
--> ::llvm::PassPluginLibraryInfo
-{
-  return getPachinkoCallsPluginInfo();
-}
-
 namespace
 {
 
@@ -0,0 +1,28 @@
+//!
+//! @file lib/passes/plugin-entry-point.cpp
+//!
+//! Defines the entry point of a pass built as its own plugin. The pass's
+//! sources are shared with the pseudo-passes plugin, so each standalone plugin
+//! compiles this file with JVS_PSEUDO_PASSES_PLUGIN_INFO naming the function
+//! returning the pass's plugin info.
+//!
+#include "llvm/Passes/PassPlugin.h"
+
+#if !defined(JVS_PSEUDO_PASSES_PLUGIN_INFO)
+#error "JVS_PSEUDO_PASSES_PLUGIN_INFO must name the plugin info function"
+#endif
+
+namespace jvs
+{
+
+llvm::PassPluginLibraryInfo JVS_PSEUDO_PASSES_PLUGIN_INFO();
+
+} // namespace jvs
+
+// This function is required for `opt` to be able to recognize this pass when
+// requested in the pass pipeline.
+extern "C" LLVM_ATTRIBUTE_WEAK auto llvmGetPassPluginInfo()
+-> ::llvm::PassPluginLibraryInfo
+{
+  return jvs::JVS_PSEUDO_PASSES_PLUGIN_INFO();
+}
@@ -23,11 +23,13 @@
 #include "llvm/IR/Value.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/CodeExtractor.h"
 
+#include "support/extension-point.h"
 #include "support/value-util.h"
 
 namespace
@@ -37,8 +39,16 @@ static constexpr char PromoteBlocksPassName[] = "promote-blocks";
 static constexpr char PromoteInstsPassName[] = "promote-instructions";
 static constexpr char PluginName[] = "PromoteBlocks";
 
+static llvm::cl::opt<jvs::ExtensionPoint> PromoteBlocksExtensionPoint(
+  "promote-blocks-ep",
+  llvm::cl::desc("Where to add promote-blocks to the default pipelines"),
+  llvm::cl::init(jvs::ExtensionPoint::None),
+  jvs::module_extension_point_values());
+
+} // namespace 
+
 // Pass registration
-static llvm::PassPluginLibraryInfo getPromoteBlocksPluginInfo()
+llvm::PassPluginLibraryInfo jvs::getPromoteBlocksPluginInfo()
 {
   return 
   {
@@ -65,13 +75,13 @@ static llvm::PassPluginLibraryInfo getPromoteBlocksPluginInfo()
 
           return false;
         });
+
+      jvs::register_module_pass(passBuilder, PromoteBlocksExtensionPoint,
+        [] { return jvs::PromoteBlocksPass(); });
     }
   };
 }
 
-
-} // namespace 
-
 #define DEBUG_TYPE "promote-blocks"
 STATISTIC(NumPromotedBlocks, "Number of blocks promoted to functions");
 STATISTIC(NumCandidateBlocks, "Total number of candidate blocks for promotion");
@@ -244,11 +254,3 @@ llvm::PreservedAnalyses jvs::PromoteBlocksPass::run(llvm::Module& m,
 
   return llvm::PreservedAnalyses::none();
 }
-
-// This function is required for `opt` to be able to recognize this pass when
-// requested in the pass pipeline.
-extern "C" LLVM_ATTRIBUTE_WEAK auto llvmGetPassPluginInfo()
--> ::llvm::PassPluginLibraryInfo
-{
-  return getPromoteBlocksPluginInfo();
-}
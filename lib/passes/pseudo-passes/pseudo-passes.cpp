@@ -0,0 +1,60 @@
+#include "passes/pseudo-passes.h"
+
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
+#include "passes/breakpoint-net.h"
+#include "passes/demote-registers.h"
+#include "passes/function-name-trace.h"
+#include "passes/fuse-functions.h"
+#include "passes/pachinko-calls.h"
+#include "passes/promote-blocks.h"
+#include "passes/resize-malloc.h"
+#include "passes/stack-to-global.h"
+
+namespace
+{
+
+static constexpr char PluginName[] = "PseudoPasses";
+
+using GetPluginInfoFunction = llvm::PassPluginLibraryInfo (*)();
+
+// Every pass plugin which is part of the combined plugin.
+static constexpr GetPluginInfoFunction PassPlugins[] = {
+  &jvs::getBreakpointNetPluginInfo,
+  &jvs::getDemoteRegistersPluginInfo,
+  &jvs::getFunctionNameTracePluginInfo,
+  &jvs::getFuseFunctionsPluginInfo,
+  &jvs::getPachinkoCallsPluginInfo,
+  &jvs::getPromoteBlocksPluginInfo,
+  &jvs::getResizeMallocPluginInfo,
+  &jvs::getStackToGlobalPluginInfo,
+};
+
+} // namespace
+
+// Pass registration
+llvm::PassPluginLibraryInfo jvs::getPseudoPassesPluginInfo()
+{
+  return
+  {
+    LLVM_PLUGIN_API_VERSION,
+    PluginName,
+    LLVM_VERSION_STRING,
+    [](llvm::PassBuilder& passBuilder)
+    {
+      for (GetPluginInfoFunction getPluginInfo : PassPlugins)
+      {
+        getPluginInfo().RegisterPassBuilderCallbacks(passBuilder);
+      }
+    }
+  };
+}
+
+// This function is required for `opt` to be able to recognize this pass when
+// requested in the pass pipeline.
+extern "C" LLVM_ATTRIBUTE_WEAK auto llvmGetPassPluginInfo()
+-> ::llvm::PassPluginLibraryInfo
+{
+  return jvs::getPseudoPassesPluginInfo();
+}
@@ -0,0 +1,79 @@
+#include "allocation-uses.h"
+
+#include <utility>
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IntrinsicInst.h"
+
+bool jvs::find_allocation_uses(llvm::CallBase& allocCall,
+  llvm::function_ref<bool(llvm::CallBase&)> isDeallocation,
+  AllocationUses& uses)
+{
+  // Pointers to the start of the allocation (the call and bitcasts of it)
+  // can be deallocated and compared to null, but interior pointers can't.
+  llvm::SmallVector<std::pair<llvm::Value*, bool>, 8> worklist{
+    {&allocCall, true}};
+  while (!worklist.empty())
+  {
+    auto [ptr, isStart] = worklist.pop_back_val();
+    for (llvm::User* user : ptr->users())
+    {
+      if (llvm::isa<llvm::BitCastInst>(user))
+      {
+        worklist.push_back({user, isStart});
+      }
+      else if (auto* gep = llvm::dyn_cast<llvm::GetElementPtrInst>(user))
+      {
+        worklist.push_back({gep, isStart && gep->hasAllZeroIndices()});
+      }
+      else if (auto* load = llvm::dyn_cast<llvm::LoadInst>(user))
+      {
+        if (load->isVolatile())
+        {
+          return false;
+        }
+      }
+      else if (auto* store = llvm::dyn_cast<llvm::StoreInst>(user))
+      {
+        if (store->isVolatile() || store->getValueOperand() == ptr)
+        {
+          return false;
+        }
+      }
+      else if (auto* memIntrinsic = llvm::dyn_cast<llvm::MemIntrinsic>(user))
+      {
+        if (memIntrinsic->isVolatile())
+        {
+          return false;
+        }
+      }
+      else if (auto* icmp = llvm::dyn_cast<llvm::ICmpInst>(user))
+      {
+        if (!isStart || !icmp->isEquality() ||
+          !llvm::isa<llvm::ConstantPointerNull>(icmp->getOperand(1)))
+        {
+          return false;
+        }
+
+        uses.NullChecks.insert(icmp);
+      }
+      else if (auto* call = llvm::dyn_cast<llvm::CallBase>(user))
+      {
+        if (!isStart || !llvm::isa<llvm::CallInst>(call) ||
+          call->arg_size() == 0 || call->getArgOperand(0) != ptr ||
+          !isDeallocation(*call))
+        {
+          return false;
+        }
+
+        uses.Deallocations.push_back(call);
+      }
+      else
+      {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
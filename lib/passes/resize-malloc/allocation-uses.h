@@ -0,0 +1,44 @@
+#if !defined(JVS_PSEUDO_PASSES_RESIZE_MALLOC_ALLOCATION_USES_H_)
+#define JVS_PSEUDO_PASSES_RESIZE_MALLOC_ALLOCATION_USES_H_
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instructions.h"
+
+namespace jvs
+{
+
+//!
+//! The uses of a heap allocation which matter to moving it around.
+//!
+struct AllocationUses
+{
+  //! Calls deallocating the allocation.
+  llvm::SmallVector<llvm::CallBase*, 4> Deallocations;
+  //! Comparisons of the pointer with null.
+  llvm::SmallPtrSet<llvm::ICmpInst*, 4> NullChecks;
+};
+
+//!
+//! Finds the uses of a heap allocation, as long as its pointer never escapes
+//! the function: it (or a bitcast or GEP of it) may only be loaded from,
+//! stored to, passed to memory intrinsics, compared to null or passed to a
+//! deallocation, and only the start of the allocation may be compared or
+//! deallocated.
+//!
+//! @param isDeallocation
+//!   Whether a call passed the pointer as its first argument deallocates it.
+//!
+//! @returns
+//!   Whether the pointer doesn't escape.
+//!
+bool find_allocation_uses(llvm::CallBase& allocCall,
+  llvm::function_ref<bool(llvm::CallBase&)> isDeallocation,
+  AllocationUses& uses);
+
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_RESIZE_MALLOC_ALLOCATION_USES_H_
@@ -0,0 +1,232 @@
+#include "coalesce-allocations.h"
+
+#include "allocation-uses.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MathExtras.h"
+
+namespace
+{
+
+// Alignment of each allocation in a combined one, which is what malloc()
+// guarantees on 64 bit targets.
+static constexpr std::uint64_t PieceAlignment = 16;
+
+struct GroupMember
+{
+  jvs::CoalescingCandidate Candidate;
+  llvm::CallBase* Free;
+  bool HasNullChecks;
+  std::uint64_t Offset;
+};
+
+struct AllocationGroup
+{
+  llvm::SmallVector<GroupMember, 4> Members;
+  std::uint64_t Size{0};
+  bool ZeroFill{false};
+  //! The free which runs after all of the others.
+  llvm::CallBase* LastFree{nullptr};
+};
+
+//!
+//! Checks whether `first` always runs before `second` when either runs.
+//!
+static bool runs_together_before(llvm::Instruction& first,
+  llvm::Instruction& second, llvm::DominatorTree& dominatorTree,
+  llvm::PostDominatorTree& postDominatorTree)
+{
+  llvm::BasicBlock* firstBlock = first.getParent();
+  llvm::BasicBlock* secondBlock = second.getParent();
+  if (firstBlock == secondBlock)
+  {
+    return first.comesBefore(&second);
+  }
+
+  return dominatorTree.dominates(firstBlock, secondBlock) &&
+    postDominatorTree.dominates(secondBlock, firstBlock);
+}
+
+//!
+//! Tries to add an allocation to a group.
+//!
+//! @returns
+//!   Whether the allocation was added.
+//!
+static bool add_to_group(AllocationGroup& group, const GroupMember& member,
+  std::uint64_t sizeLimit, llvm::DominatorTree& dominatorTree,
+  llvm::PostDominatorTree& postDominatorTree)
+{
+  std::uint64_t offset = llvm::alignTo(group.Size, PieceAlignment);
+  if (offset > sizeLimit || member.Candidate.Size > sizeLimit - offset)
+  {
+    return false;
+  }
+
+  llvm::CallBase* lastFree = member.Free;
+  if (group.LastFree)
+  {
+    if (runs_together_before(*member.Free, *group.LastFree, dominatorTree,
+      postDominatorTree))
+    {
+      lastFree = group.LastFree;
+    }
+    else if (!runs_together_before(*group.LastFree, *member.Free,
+      dominatorTree, postDominatorTree))
+    {
+      return false;
+    }
+  }
+
+  group.Members.push_back(member);
+  group.Members.back().Offset = offset;
+  group.Size = offset + member.Candidate.Size;
+  group.ZeroFill |= member.Candidate.ZeroFill;
+  group.LastFree = lastFree;
+  return true;
+}
+
+//!
+//! Replaces the allocations of a group with pieces of one allocation.
+//!
+//! @returns
+//!   The combined allocation.
+//!
+static llvm::CallBase* combine_group(AllocationGroup& group)
+{
+  llvm::CallBase& firstCall = *group.Members.front().Candidate.AllocCall;
+  llvm::Module& m = *firstCall.getModule();
+  llvm::Type* ptrType = firstCall.getType();
+  llvm::Type* sizeType = firstCall.getArgOperand(0)->getType();
+
+  llvm::IRBuilder<> builder(&firstCall);
+  llvm::Value* size = llvm::ConstantInt::get(sizeType, group.Size);
+  llvm::CallInst* combined = nullptr;
+  if (group.ZeroFill)
+  {
+    combined = builder.CreateCall(m.getOrInsertFunction("calloc",
+        llvm::FunctionType::get(ptrType, {sizeType, sizeType}, false)),
+      {llvm::ConstantInt::get(sizeType, 1), size}, "coalesced");
+  }
+  else
+  {
+    combined = builder.CreateCall(m.getOrInsertFunction("malloc",
+        llvm::FunctionType::get(ptrType, {sizeType}, false)),
+      {size}, "coalesced");
+  }
+
+  // A piece of a failed allocation has to stay null for null checks.
+  llvm::Value* isNull = nullptr;
+  if (llvm::any_of(group.Members, [](const GroupMember& member)
+    {
+      return member.HasNullChecks && member.Offset != 0;
+    }))
+  {
+    isNull = builder.CreateICmpEQ(combined,
+      llvm::ConstantPointerNull::get(llvm::cast<llvm::PointerType>(ptrType)));
+  }
+
+  llvm::Value* bytePtr = builder.CreateBitCast(combined,
+    builder.getInt8PtrTy());
+  for (GroupMember& member : group.Members)
+  {
+    // Only the last free is kept, and it frees the combined allocation.
+    if (member.Free == group.LastFree)
+    {
+      member.Free->setArgOperand(0, builder.CreateBitCast(combined,
+        member.Free->getArgOperand(0)->getType()));
+    }
+    else
+    {
+      member.Free->eraseFromParent();
+    }
+  }
+
+  for (GroupMember& member : group.Members)
+  {
+    llvm::CallBase& allocCall = *member.Candidate.AllocCall;
+    llvm::Value* ptr = combined;
+    if (member.Offset != 0)
+    {
+      llvm::IRBuilder<> memberBuilder(&allocCall);
+      ptr = memberBuilder.CreateInBoundsGEP(memberBuilder.getInt8Ty(),
+        bytePtr, memberBuilder.getInt64(member.Offset));
+      if (member.HasNullChecks)
+      {
+        ptr = memberBuilder.CreateSelect(isNull,
+          llvm::ConstantPointerNull::get(memberBuilder.getInt8PtrTy()), ptr);
+      }
+
+      ptr = memberBuilder.CreateBitCast(ptr, allocCall.getType());
+    }
+
+    allocCall.replaceAllUsesWith(ptr);
+    allocCall.eraseFromParent();
+  }
+
+  return combined;
+}
+
+} // namespace
+
+
+std::vector<llvm::CallBase*> jvs::coalesce_allocations(
+  llvm::ArrayRef<CoalescingCandidate> candidates, std::uint64_t sizeLimit,
+  llvm::DominatorTree& dominatorTree,
+  llvm::PostDominatorTree& postDominatorTree,
+  llvm::function_ref<bool(llvm::CallBase&)> isDeallocation)
+{
+  // Groups are made of allocations in the same block, so they run together.
+  // Within a block, each allocation joins the first group it fits in.
+  llvm::MapVector<llvm::BasicBlock*, std::vector<AllocationGroup>> groups{};
+  for (const CoalescingCandidate& candidate : candidates)
+  {
+    AllocationUses uses{};
+    if (candidate.Size == 0 ||
+      !llvm::isa<llvm::CallInst>(candidate.AllocCall) ||
+      !find_allocation_uses(*candidate.AllocCall, isDeallocation, uses) ||
+      uses.Deallocations.size() != 1)
+    {
+      continue;
+    }
+
+    GroupMember member{candidate, uses.Deallocations.front(),
+      !uses.NullChecks.empty(), 0};
+    std::vector<AllocationGroup>& blockGroups =
+      groups[candidate.AllocCall->getParent()];
+    if (llvm::none_of(blockGroups,
+      [&](AllocationGroup& group)
+      {
+        return add_to_group(group, member, sizeLimit, dominatorTree,
+          postDominatorTree);
+      }))
+    {
+      AllocationGroup group{};
+      if (add_to_group(group, member, sizeLimit, dominatorTree,
+        postDominatorTree))
+      {
+        blockGroups.push_back(std::move(group));
+      }
+    }
+  }
+
+  std::vector<llvm::CallBase*> combinedCalls{};
+  for (auto& [block, blockGroups] : groups)
+  {
+    for (AllocationGroup& group : blockGroups)
+    {
+      if (group.Members.size() > 1)
+      {
+        combinedCalls.push_back(combine_group(group));
+      }
+    }
+  }
+
+  return combinedCalls;
+}
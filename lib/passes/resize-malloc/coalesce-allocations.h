@@ -0,0 +1,55 @@
+#if !defined(JVS_PSEUDO_PASSES_RESIZE_MALLOC_COALESCE_ALLOCATIONS_H_)
+#define JVS_PSEUDO_PASSES_RESIZE_MALLOC_COALESCE_ALLOCATIONS_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/InstrTypes.h"
+
+namespace jvs
+{
+
+//!
+//! A malloc() or calloc() call of a constant size which may be coalesced.
+//!
+struct CoalescingCandidate
+{
+  llvm::CallBase* AllocCall;
+  std::uint64_t Size;
+  bool ZeroFill;
+};
+
+//!
+//! Coalesces allocations made in the same block, whose pointers don't escape
+//! (see find_allocation_uses()) and which are each freed by a single free()
+//! call, into one allocation of at most `sizeLimit` bytes, provided that
+//! their frees run together: each one always runs before the last one, which
+//! always runs after it (by the dominator and post-dominator trees). Each
+//! allocation gets a 16 byte aligned piece of the combined one, which is
+//! freed in place of the last free, and the other frees are removed.
+//!
+//! The combined allocation is a calloc() call if any of the allocations was.
+//! If it fails, every allocation in it does.
+//!
+//! @param candidates
+//!   The allocations to consider, in program order within their blocks.
+//! @param isDeallocation
+//!   Whether a call passed a pointer as its first argument frees it.
+//!
+//! @returns
+//!   The combined allocations created.
+//!
+std::vector<llvm::CallBase*> coalesce_allocations(
+  llvm::ArrayRef<CoalescingCandidate> candidates, std::uint64_t sizeLimit,
+  llvm::DominatorTree& dominatorTree,
+  llvm::PostDominatorTree& postDominatorTree,
+  llvm::function_ref<bool(llvm::CallBase&)> isDeallocation);
+
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_RESIZE_MALLOC_COALESCE_ALLOCATIONS_H_
@@ -0,0 +1,155 @@
+#include "heap-to-stack.h"
+
+#include "allocation-uses.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+
+namespace
+{
+
+// Alignment of the stack allocations, which is what malloc() and operator new
+// guarantee on 64 bit targets.
+static constexpr std::uint64_t StackAlignment = 16;
+
+//!
+//! Checks whether a successor of a block is only reached when the allocation
+//! failed.
+//!
+static bool is_failure_edge(const jvs::AllocationUses& uses,
+  llvm::BasicBlock& block, unsigned int successor)
+{
+  auto* branch = llvm::dyn_cast<llvm::BranchInst>(block.getTerminator());
+  if (!branch || !branch->isConditional())
+  {
+    return false;
+  }
+
+  auto* icmp = llvm::dyn_cast<llvm::ICmpInst>(branch->getCondition());
+  if (!icmp || !uses.NullChecks.count(icmp))
+  {
+    return false;
+  }
+
+  // The first successor is taken when the comparison holds.
+  bool isNullSuccessor =
+    (icmp->getPredicate() == llvm::ICmpInst::ICMP_EQ) == (successor == 0);
+  return isNullSuccessor;
+}
+
+//!
+//! Checks that every path from the allocation to a return, or back to the
+//! allocation, passes a deallocation.
+//!
+static bool is_always_deallocated(llvm::CallBase& allocCall,
+  const jvs::AllocationUses& uses)
+{
+  llvm::SmallPtrSet<llvm::Instruction*, 4> deallocations(
+    uses.Deallocations.begin(), uses.Deallocations.end());
+  llvm::SmallPtrSet<llvm::BasicBlock*, 16> visited{};
+
+  // Paths start right after the allocation, and then at the start of blocks.
+  llvm::SmallVector<llvm::Instruction*, 16> worklist{
+    allocCall.getNextNode()};
+  while (!worklist.empty())
+  {
+    llvm::Instruction* inst = worklist.pop_back_val();
+    llvm::BasicBlock* block = inst->getParent();
+    for (; inst; inst = inst->getNextNode())
+    {
+      if (deallocations.count(inst))
+      {
+        break;
+      }
+
+      if (inst == &allocCall)
+      {
+        return false;
+      }
+
+      if (!inst->isTerminator())
+      {
+        continue;
+      }
+
+      // unreachable ends the program rather than returning.
+      if (llvm::isa<llvm::UnreachableInst>(inst))
+      {
+        break;
+      }
+
+      if (inst->getNumSuccessors() == 0)
+      {
+        return false;
+      }
+
+      for (unsigned int index = 0; index < inst->getNumSuccessors(); ++index)
+      {
+        llvm::BasicBlock* successor = inst->getSuccessor(index);
+        if (!is_failure_edge(uses, *block, index) &&
+          visited.insert(successor).second)
+        {
+          worklist.push_back(&successor->front());
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+} // namespace
+
+
+bool jvs::promote_to_stack(llvm::CallBase& allocCall, std::uint64_t size,
+  bool zeroFill, llvm::function_ref<bool(llvm::CallBase&)> isDeallocation)
+{
+  // Invokes would need their normal destination branched to.
+  if (size == 0 || !llvm::isa<llvm::CallInst>(allocCall))
+  {
+    return false;
+  }
+
+  AllocationUses uses{};
+  if (!find_allocation_uses(allocCall, isDeallocation, uses) ||
+    uses.Deallocations.empty() || !is_always_deallocated(allocCall, uses))
+  {
+    return false;
+  }
+
+  // The stack slot lives in the entry block, so it's allocated once however
+  // often the allocation runs, which is fine as the memory was freed before
+  // the allocation runs again.
+  llvm::Function& f = *allocCall.getFunction();
+  llvm::IRBuilder<> entryBuilder(&*f.getEntryBlock().getFirstInsertionPt());
+  llvm::AllocaInst* stackSlot = entryBuilder.CreateAlloca(
+    llvm::ArrayType::get(entryBuilder.getInt8Ty(), size), nullptr,
+    allocCall.getName() + ".stack");
+  stackSlot->setAlignment(llvm::Align(StackAlignment));
+
+  llvm::IRBuilder<> builder(&allocCall);
+  llvm::ConstantInt* sizeConst = builder.getInt64(size);
+  llvm::Value* ptr = builder.CreateBitCast(stackSlot, allocCall.getType());
+  builder.CreateLifetimeStart(ptr, sizeConst);
+  if (zeroFill)
+  {
+    builder.CreateMemSet(ptr, builder.getInt8(0), size,
+      llvm::MaybeAlign(StackAlignment));
+  }
+
+  for (llvm::CallBase* deallocation : uses.Deallocations)
+  {
+    llvm::IRBuilder<>(deallocation).CreateLifetimeEnd(ptr, sizeConst);
+    deallocation->eraseFromParent();
+  }
+
+  allocCall.replaceAllUsesWith(ptr);
+  allocCall.eraseFromParent();
+  return true;
+}
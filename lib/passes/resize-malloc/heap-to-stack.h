@@ -0,0 +1,43 @@
+#if !defined(JVS_PSEUDO_PASSES_RESIZE_MALLOC_HEAP_TO_STACK_H_)
+#define JVS_PSEUDO_PASSES_RESIZE_MALLOC_HEAP_TO_STACK_H_
+
+#include <cstdint>
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/IR/InstrTypes.h"
+
+namespace jvs
+{
+
+//!
+//! Replaces a heap allocation of a constant size with a stack allocation in
+//! the function's entry block, provided that:
+//!
+//! - The pointer never escapes: it (or a bitcast or GEP of it) is only
+//!   loaded from, stored to, passed to memory intrinsics, compared to null or
+//!   passed to a deallocation.
+//! - Every path from the allocation to a return, or back to the allocation,
+//!   passes a deallocation, leaving out the paths taken when the allocation
+//!   is checked for failure. Exceptions thrown by calls (as opposed to
+//!   invokes) aren't considered, since skipping a deallocation only leaks.
+//!
+//! The deallocations are removed, and the allocation's lifetime is marked, so
+//! stack slots can still be shared.
+//!
+//! @param allocCall
+//!   Call allocating the memory.
+//! @param zeroFill
+//!   Whether the allocation is zeroed, as by calloc().
+//! @param isDeallocation
+//!   Whether a call passed the pointer as its first argument deallocates it.
+//!
+//! @returns
+//!   Whether the allocation was replaced (and erased).
+//!
+bool promote_to_stack(llvm::CallBase& allocCall, std::uint64_t size,
+  bool zeroFill, llvm::function_ref<bool(llvm::CallBase&)> isDeallocation);
+
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_RESIZE_MALLOC_HEAP_TO_STACK_H_
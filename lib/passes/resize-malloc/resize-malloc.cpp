@@ -2,8 +2,12 @@
 
 #include <cstddef>
 #include <optional>
+#include <string>
 #include <tuple>
+#include <utility>
 
+#include "coalesce-allocations.h"
+#include "heap-to-stack.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/Analysis/PostDominators.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
@@ -12,6 +16,7 @@
 #include "llvm/IR/Dominators.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/IntrinsicInst.h"
@@ -19,19 +24,152 @@
 #include "llvm/IR/Module.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Scalar/ADCE.h"
 #include "llvm/Transforms/Scalar/SCCP.h"
+#include "runtime/resize-malloc.h"
+#include "size-classes.h"
+#include "support/extension-point.h"
+#include "support/pass-parameters.h"
 #include "support/type-util.h"
 #include "support/value-util.h"
 
 namespace
 {
 
+static constexpr char PassName[] = "resize-malloc";
 static constexpr char PluginName[] = "ResizeMalloc";
 
+// Sizes used by the `cache-line` and `page` rounding parameters.
+static constexpr std::uint64_t CacheLineSize = 64;
+static constexpr std::uint64_t PageSize = 4096;
+
+// Size limits set by the `stack` and `coalesce` parameters.
+static constexpr std::uint64_t DefaultStackLimit = 256;
+static constexpr std::uint64_t DefaultCoalesceLimit = 4096;
+
+// Functions whose uses `pool` redirects to the pool allocator (see
+// get_pool_deallocation_function()).
+static constexpr const char* DeallocationFunctionNames[] = {"free", "realloc",
+  "_ZdlPv", "_ZdlPvm", "??3@YAXPEAX@Z", "??3@YAXPEAX_K@Z"};
+
+// mmap() flags placing the mapping exactly at the given address: MAP_FIXED
+// (which has this value on every Unix-like system) and Linux's
+// MAP_FIXED_NOREPLACE.
+static constexpr std::uint64_t MapFixed = 0x10;
+static constexpr std::uint64_t MapFixedNoReplace = 0x100000;
+
+static llvm::cl::opt<jvs::ExtensionPoint> ResizeMallocExtensionPoint(
+  "resize-malloc-ep",
+  llvm::cl::desc("Where to add resize-malloc to the default pipelines"),
+  llvm::cl::init(jvs::ExtensionPoint::None),
+  jvs::function_extension_point_values());
+
+static llvm::cl::opt<std::string> ResizeMallocParameters(
+  "resize-malloc-options",
+  llvm::cl::desc("Parameters (as in resize-malloc<...>) used when adding "
+    "resize-malloc to the default pipelines"),
+  llvm::cl::init(""));
+
+//!
+//! Parses the parameters of `resize-malloc<...>`.
+//!
+//! @returns
+//!   The options, or no value (after printing the problem) if the parameters
+//!   aren't valid.
+//!
+static std::optional<jvs::ResizeMallocOptions> parse_options(
+  llvm::StringRef params)
+{
+  jvs::ResizeMallocOptions options{};
+  for (auto& [key, value] : jvs::split_pass_parameters(params))
+  {
+    if (key.equals("size-classes"))
+    {
+      options.Rounding = jvs::ResizeMallocRounding::SizeClasses;
+    }
+    else if (key.equals("pow2"))
+    {
+      options.Rounding = jvs::ResizeMallocRounding::PowerOfTwo;
+    }
+    else if (key.equals("cache-line"))
+    {
+      options.Rounding = jvs::ResizeMallocRounding::Multiple;
+      options.Multiple = CacheLineSize;
+    }
+    else if (key.equals("page"))
+    {
+      options.Rounding = jvs::ResizeMallocRounding::Multiple;
+      options.Multiple = PageSize;
+    }
+    else if (key.equals("stack"))
+    {
+      options.StackLimit = DefaultStackLimit;
+      if (!value.empty() &&
+        (value.getAsInteger(10, options.StackLimit) ||
+          options.StackLimit == 0))
+      {
+        llvm::errs() << PassName << ": invalid stack size limit '" << value <<
+          "'\n";
+        return {};
+      }
+    }
+    else if (key.equals("coalesce"))
+    {
+      options.CoalesceLimit = DefaultCoalesceLimit;
+      if (!value.empty() &&
+        (value.getAsInteger(10, options.CoalesceLimit) ||
+          options.CoalesceLimit == 0))
+      {
+        llvm::errs() << PassName << ": invalid coalescing size limit '" <<
+          value << "'\n";
+        return {};
+      }
+    }
+    else if (key.equals("pool"))
+    {
+      options.UsePool = true;
+    }
+    else if (key.equals("dynamic"))
+    {
+      options.RoundDynamicSizes = true;
+    }
+    else if (key.equals("multiple"))
+    {
+      options.Rounding = jvs::ResizeMallocRounding::Multiple;
+      if (value.getAsInteger(10, options.Multiple) || options.Multiple == 0)
+      {
+        llvm::errs() << PassName << ": invalid multiple '" << value << "'\n";
+        return {};
+      }
+    }
+    else
+    {
+      llvm::errs() << PassName << ": unknown parameter '" << key << "'\n";
+      return {};
+    }
+  }
+
+  return options;
+}
+
+// Adds resize-malloc along with the passes it relies on to fold allocation
+// sizes into constants.
+static void add_resize_malloc_passes(llvm::FunctionPassManager& fpm,
+  const jvs::ResizeMallocOptions& options)
+{
+  fpm.addPass(llvm::SCCPPass());
+  fpm.addPass(llvm::ADCEPass());
+  fpm.addPass(jvs::ResizeMallocPass(options));
+}
+
+} // namespace
+
 // Pass registration
-static llvm::PassPluginLibraryInfo getResizeMallocPluginInfo()
+llvm::PassPluginLibraryInfo jvs::getResizeMallocPluginInfo()
 {
   return
   {
@@ -54,30 +192,36 @@ static llvm::PassPluginLibraryInfo getResizeMallocPluginInfo()
         [&](llvm::StringRef name, llvm::FunctionPassManager& fpm,
           llvm::ArrayRef<llvm::PassBuilder::PipelineElement>)
         {
-          if (name.equals("resize-malloc"))
+          auto params = jvs::match_pass_name(name, PassName);
+          if (!params)
           {
-            fpm.addPass(llvm::SCCPPass());
-            fpm.addPass(llvm::ADCEPass());
-            fpm.addPass(jvs::ResizeMallocPass());
-            return true;
+            return false;
           }
 
-          return false;
+          auto options = parse_options(*params);
+          if (!options)
+          {
+            return false;
+          }
+
+          add_resize_malloc_passes(fpm, *options);
+          return true;
         });
+
+      if (auto options = parse_options(ResizeMallocParameters))
+      {
+        jvs::register_function_pass(passBuilder, ResizeMallocExtensionPoint,
+          [options = *options]
+          {
+            llvm::FunctionPassManager fpm{};
+            add_resize_malloc_passes(fpm, options);
+            return fpm;
+          });
+      }
     }
   };
 }
 
-} // namespace
-
-// This function is required for `opt` to be able to recognize this pass when
-// requested in the pass pipeline.
-extern "C" LLVM_ATTRIBUTE_WEAK auto llvmGetPassPluginInfo()
--> ::llvm::PassPluginLibraryInfo
-{
-  return getResizeMallocPluginInfo();
-}
-
 namespace
 {
 
@@ -238,22 +382,363 @@ static MemAllocInfo get_size_arg(llvm::CallBase& callInst) noexcept
   }
 }
 
+//!
+//! Checks whether the size of an allocation call can be rounded. The length
+//! of an mmap() call at a fixed address can't be, since the rounded mapping
+//! would replace (or collide with) whatever follows it, and neither can one
+//! whose flags aren't known.
+//!
+static bool can_round_size(MemAllocFunctionId memCall,
+  llvm::CallBase& callInst) noexcept
+{
+  if (memCall != MemAllocFunctionId::Mmap)
+  {
+    return true;
+  }
+
+  auto flags = jvs::get_int_constant(callInst.getArgOperand(3));
+  return flags && (*flags & (MapFixed | MapFixedNoReplace)) == 0;
+}
+
+// Whether a call's size is rounded at run time when it isn't a constant.
+static bool rounds_dynamic_size(MemAllocFunctionId memCall,
+  llvm::CallBase& callInst) noexcept
+{
+  switch (memCall)
+  {
+  case MemAllocFunctionId::Malloc:
+  case MemAllocFunctionId::Calloc:
+    return true;
+
+  case MemAllocFunctionId::Mmap:
+    return can_round_size(memCall, callInst);
+
+  // The sized operator delete freeing it would be passed the size before
+  // rounding, which wouldn't match, and can't be seen to be fixed up.
+  case MemAllocFunctionId::SystemVNew:
+  default:
+    return false;
+  }
+}
+
+//!
+//! Checks whether an allocation can be moved to the stack, which C++ only
+//! allows for new expressions (marked builtin), not for calls to operator new.
+//!
+static bool can_promote_to_stack(MemAllocFunctionId memCall,
+  llvm::CallBase& callInst) noexcept
+{
+  switch (memCall)
+  {
+  case MemAllocFunctionId::Malloc:
+  case MemAllocFunctionId::Calloc:
+    return !callInst.isNoBuiltin();
+
+  case MemAllocFunctionId::SystemVNew:
+  case MemAllocFunctionId::ItaniumNew:
+    return callInst.hasFnAttr(llvm::Attribute::Builtin);
+
+  default:
+    return false;
+  }
+}
+
+//!
+//! Checks whether a call is the deallocation matching an allocation.
+//!
+static bool is_matching_deallocation(MemAllocFunctionId memCall,
+  llvm::CallBase& callInst)
+{
+  llvm::Function* callee = callInst.getCalledFunction();
+  if (!callee || !callee->hasExternalLinkage())
+  {
+    return false;
+  }
+
+  // In pool mode the deallocations may already have been redirected to the
+  // pool (see redirect_deallocations()), which frees what it didn't allocate
+  // the same way.
+  llvm::StringRef name = callee->getName();
+  bool isPoolDelete = name.equals("__jvs_pool_delete") ||
+    name.equals("__jvs_pool_delete_sized");
+  switch (memCall)
+  {
+  case MemAllocFunctionId::Malloc:
+  case MemAllocFunctionId::Calloc:
+    return (name.equals("free") || name.equals("__jvs_pool_free")) &&
+      !callInst.isNoBuiltin();
+
+  case MemAllocFunctionId::SystemVNew:
+    return (name.equals("_ZdlPv") || name.equals("_ZdlPvm") ||
+      isPoolDelete) && callInst.hasFnAttr(llvm::Attribute::Builtin);
+
+  case MemAllocFunctionId::ItaniumNew:
+    return (name.equals("??3@YAXPEAX@Z") || name.equals("??3@YAXPEAX_K@Z") ||
+      isPoolDelete) && callInst.hasFnAttr(llvm::Attribute::Builtin);
+
+  default:
+    return false;
+  }
+}
+
+//!
+//! Gets the pool allocator function replacing an allocation function.
+//!
+//! @returns
+//!   The name of the function, or null if the pool has no replacement.
+//!
+static const char* get_pool_allocation_function(
+  MemAllocFunctionId memCall) noexcept
+{
+  switch (memCall)
+  {
+  case MemAllocFunctionId::Malloc:
+    return "__jvs_pool_malloc";
+
+  case MemAllocFunctionId::Calloc:
+    return "__jvs_pool_calloc";
+
+  case MemAllocFunctionId::SystemVNew:
+  case MemAllocFunctionId::ItaniumNew:
+    return "__jvs_pool_new";
+
+  default:
+    return nullptr;
+  }
+}
+
+//!
+//! Gets the pool allocator function replacing a deallocation function (or
+//! realloc()).
+//!
+//! @returns
+//!   The name of the function, or null if the function isn't a deallocation
+//!   function.
+//!
+static const char* get_pool_deallocation_function(llvm::Function& callee)
+{
+  if (!callee.hasExternalLinkage())
+  {
+    return nullptr;
+  }
+
+  llvm::FunctionType* calleeType = callee.getFunctionType();
+  llvm::StringRef name = callee.getName();
+  llvm::Module& m = *callee.getParent();
+  if (calleeType == jvs::create_type<void(void*)>(m))
+  {
+    if (name.equals("free"))
+    {
+      return "__jvs_pool_free";
+    }
+
+    if (name.equals("_ZdlPv") || name.equals("??3@YAXPEAX@Z"))
+    {
+      return "__jvs_pool_delete";
+    }
+  }
+
+  if (calleeType == jvs::create_type<void(void*, jvs::ir_types::Size)>(m) &&
+    (name.equals("_ZdlPvm") || name.equals("??3@YAXPEAX_K@Z")))
+  {
+    return "__jvs_pool_delete_sized";
+  }
+
+  if (calleeType == jvs::create_type<void*(void*, jvs::ir_types::Size)>(m) &&
+    name.equals("realloc"))
+  {
+    return "__jvs_pool_realloc";
+  }
+
+  return nullptr;
+}
+
+//!
+//! Replaces every use of the deallocation functions (and realloc()) in the
+//! module with the pool's. Besides the calls in every function, including the
+//! ones this pass skips, this covers the functions' addresses, such as a
+//! `free` passed as a callback or a unique_ptr deleter.
+//!
+//! @returns
+//!   Whether anything was replaced.
+//!
+static bool redirect_deallocations(llvm::Module& m)
+{
+  bool changed{false};
+  for (const char* name : DeallocationFunctionNames)
+  {
+    llvm::Function* callee = m.getFunction(name);
+    if (!callee || callee->use_empty())
+    {
+      continue;
+    }
+
+    if (const char* poolFunction = get_pool_deallocation_function(*callee))
+    {
+      callee->replaceAllUsesWith(m.getOrInsertFunction(poolFunction,
+        callee->getFunctionType()).getCallee());
+      changed = true;
+    }
+  }
+
+  return changed;
+}
+
+//!
+//! Makes a call call the function with the given name instead, which has the
+//! same type.
+//!
+static void redirect_call(llvm::CallBase& callInst, llvm::StringRef name)
+{
+  llvm::Module& m = *callInst.getModule();
+  callInst.setCalledFunction(
+    m.getOrInsertFunction(name, callInst.getFunctionType()));
+}
+
+//!
+//! Rounds the size of an allocation call which isn't a constant with code
+//! inserted before the call.
+//!
+static void round_dynamic_size(const jvs::ResizeMallocOptions& options,
+  MemAllocFunctionId memCall, unsigned int arg, llvm::CallBase& callInst)
+{
+  llvm::IRBuilder<> builder(&callInst);
+  if (memCall != MemAllocFunctionId::Calloc)
+  {
+    callInst.setArgOperand(arg, jvs::create_round_allocation_size(builder,
+      options, callInst.getArgOperand(arg)));
+    return;
+  }
+
+  // calloc(count, size) becomes calloc(1, rounded count * size), unless the
+  // product overflows, in which case the call is left to fail as it would
+  // have.
+  llvm::Value* count = callInst.getArgOperand(0);
+  llvm::Value* elemSize = callInst.getArgOperand(arg);
+  llvm::Value* product = builder.CreateIntrinsic(
+    llvm::Intrinsic::umul_with_overflow, {count->getType()},
+    {count, elemSize});
+  llvm::Value* overflowed = builder.CreateExtractValue(product, 1);
+  llvm::Value* roundedSize = jvs::create_round_allocation_size(builder,
+    options, builder.CreateExtractValue(product, 0));
+  callInst.setArgOperand(0, builder.CreateSelect(overflowed, count,
+    llvm::ConstantInt::get(count->getType(), 1)));
+  callInst.setArgOperand(arg,
+    builder.CreateSelect(overflowed, elemSize, roundedSize));
+}
+
+//!
+//! Gets the size of an allocation call, if it's a constant.
+//!
+//! @param[out] overflowed
+//!   Set if the size of a calloc() call overflows.
+//!
+static std::optional<std::uint64_t> get_constant_size(
+  MemAllocFunctionId memCall, unsigned int arg, llvm::CallBase& callInst,
+  bool& overflowed) noexcept
+{
+  overflowed = false;
+  if (memCall != MemAllocFunctionId::Calloc)
+  {
+    return jvs::get_int_constant(callInst.getArgOperand(arg));
+  }
+
+  // Special handling for calloc() since it uses two arguments.
+  auto elemCount = jvs::get_int_constant(callInst.getArgOperand(0));
+  auto elemSize = jvs::get_int_constant(callInst.getArgOperand(arg));
+  if (!elemCount || !elemSize)
+  {
+    return {};
+  }
+
+  return llvm::SaturatingMultiply(*elemSize, *elemCount, &overflowed);
+}
+
+//!
+//! Coalesces the constant-size malloc() and calloc() calls of a function
+//! which are freed together (see coalesce_allocations()). Allocations small
+//! enough to be moved to the stack are left for that.
+//!
+static void coalesce_constant_allocations(
+  const jvs::ResizeMallocOptions& options, llvm::Function& f,
+  llvm::FunctionAnalysisManager& manager)
+{
+  std::vector<jvs::CoalescingCandidate> candidates{};
+  for (llvm::Instruction& inst : llvm::instructions(f))
+  {
+    auto* callInst = llvm::dyn_cast<llvm::CallBase>(&inst);
+    if (!callInst)
+    {
+      continue;
+    }
+
+    auto [memCall, arg, allocCall] = get_size_arg(*callInst);
+    if ((memCall != MemAllocFunctionId::Malloc &&
+        memCall != MemAllocFunctionId::Calloc) ||
+      allocCall->isNoBuiltin())
+    {
+      continue;
+    }
+
+    bool overflowed = false;
+    auto memSize = get_constant_size(memCall, arg, *allocCall, overflowed);
+    if (memSize && !overflowed && *memSize > options.StackLimit)
+    {
+      candidates.push_back({allocCall, *memSize,
+        memCall == MemAllocFunctionId::Calloc});
+    }
+  }
+
+  if (candidates.size() < 2)
+  {
+    return;
+  }
+
+  jvs::coalesce_allocations(candidates, options.CoalesceLimit,
+    manager.getResult<llvm::DominatorTreeAnalysis>(f),
+    manager.getResult<llvm::PostDominatorTreeAnalysis>(f),
+    [](llvm::CallBase& deallocation)
+    {
+      return is_matching_deallocation(MemAllocFunctionId::Malloc,
+        deallocation);
+    });
+}
+
 } // namespace
 
 
+jvs::ResizeMallocPass::ResizeMallocPass(ResizeMallocOptions options /*= {}*/)
+  : Options(options)
+{
+}
+
 llvm::PreservedAnalyses jvs::ResizeMallocPass::run(llvm::Function& f, 
   llvm::FunctionAnalysisManager& manager)
 {
+  // Pointers allocated by the pool can be freed anywhere, so every
+  // deallocation in the module goes through the pool, which passes the ones
+  // it didn't allocate on. This is done before anything is skipped, and
+  // after the first function it only finds uses added by other passes since.
+  bool redirected = Options.UsePool && redirect_deallocations(*f.getParent());
+
   // Skip functions marked [[optnone]] and declarations.
   if (f.isDeclaration() || f.hasFnAttribute(llvm::Attribute::OptimizeNone))
   {
-    return llvm::PreservedAnalyses::all();
+    return redirected
+      ? llvm::PreservedAnalyses::none()
+      : llvm::PreservedAnalyses::all();
+  }
+
+  // The combined allocations are collected along with the others below.
+  if (Options.CoalesceLimit > 0)
+  {
+    coalesce_constant_allocations(Options, f, manager);
   }
 
   std::vector<MemAllocInfo> memAllocCalls{};
   for (llvm::Instruction& inst : llvm::instructions(f))
   {
-    if (auto* callInst = llvm::dyn_cast<llvm::CallInst>(&inst))
+    if (auto* callInst = llvm::dyn_cast<llvm::CallBase>(&inst))
     {
       auto memCallTup = get_size_arg(*callInst);
       if (std::get<0>(memCallTup) != MemAllocFunctionId::None)
@@ -265,35 +750,63 @@ llvm::PreservedAnalyses jvs::ResizeMallocPass::run(llvm::Function& f,
 
   for (auto& [memCall, arg, callInst] : memAllocCalls)
   {
-    std::uint64_t memSize{0};
-    if (memCall == MemAllocFunctionId::Calloc)
+    bool overflowed = false;
+    auto sizeConst = get_constant_size(memCall, arg, *callInst, overflowed);
+
+    // Leave calls which would fail anyway alone.
+    if (overflowed)
+    {
+      continue;
+    }
+
+    if (!sizeConst)
     {
-      // Special handling for calloc() since it uses two arguments.
-      auto elemSize = get_int_constant(callInst->getArgOperand(0));
-      if (elemSize)
+      if (Options.RoundDynamicSizes &&
+        rounds_dynamic_size(memCall, *callInst))
       {
-        auto elemCount = get_int_constant(callInst->getArgOperand(arg));
-        if (elemCount)
-        {
-          memSize = *elemSize * *elemCount;
-        }
+        round_dynamic_size(Options, memCall, arg, *callInst);
       }
+
+      continue;
     }
-    else
+
+    std::uint64_t memSize = *sizeConst;
+
+    // Allocations moved to the stack (which removes their deallocations) need
+    // neither pooling nor rounding.
+    if (memSize <= Options.StackLimit &&
+      can_promote_to_stack(memCall, *callInst) &&
+      promote_to_stack(*callInst, memSize,
+        memCall == MemAllocFunctionId::Calloc,
+        [memCall = memCall](llvm::CallBase& deallocation)
+        {
+          return is_matching_deallocation(memCall, deallocation);
+        }))
     {
-      auto sizeConst = get_int_constant(callInst->getArgOperand(arg));
-      if (sizeConst)
+      continue;
+    }
+
+    // The pool's size classes take the place of rounding.
+    if (Options.UsePool && memSize <= JVS_POOL_MAX_SIZE)
+    {
+      if (const char* poolFunction = get_pool_allocation_function(memCall))
       {
-        memSize = *sizeConst;
+        redirect_call(*callInst, poolFunction);
+        continue;
       }
     }
 
-    if (memSize > 0)
+    if (memSize > 0 && can_round_size(memCall, *callInst))
     {
-      // Adjust the memory size to be a multiple of 8KB.
-      memSize += (0x2000 - (memSize % 0x2000));
-      auto memSizeConst = llvm::ConstantInt::get(
-        callInst->getArgOperand(arg)->getType(), memSize);
+      llvm::Type* sizeType = callInst->getArgOperand(arg)->getType();
+      std::uint64_t roundedSize = round_allocation_size(Options, memSize,
+        sizeType->getIntegerBitWidth());
+      if (roundedSize == memSize)
+      {
+        continue;
+      }
+
+      auto memSizeConst = llvm::ConstantInt::get(sizeType, roundedSize);
       if (memCall == MemAllocFunctionId::Calloc)
       {
         auto oneConst = 
@@ -0,0 +1,222 @@
+#include "size-classes.h"
+
+#include <optional>
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/Support/MathExtras.h"
+
+namespace
+{
+
+// Sizes up to this are rounded to multiples of SmallSizeSpacing by the size
+// class policy, and larger ones get SizeClassesPerDoubling classes between
+// successive powers of two.
+static constexpr std::uint64_t SmallSizeLimit = 128;
+static constexpr std::uint64_t SmallSizeSpacing = 16;
+static constexpr std::uint64_t MinSizeClass = 8;
+static constexpr std::uint64_t SizeClassesPerDoubling = 4;
+
+static_assert(llvm::isPowerOf2_64(SmallSizeSpacing) &&
+  llvm::isPowerOf2_64(SizeClassesPerDoubling),
+  "The emitted rounding code relies on shifts and masks");
+
+//!
+//! Rounds `size` up to a multiple of `multiple`.
+//!
+//! @returns
+//!   The rounded size, or no value if it overflows.
+//!
+static std::optional<std::uint64_t> round_up(std::uint64_t size,
+  std::uint64_t multiple) noexcept
+{
+  std::uint64_t remainder = size % multiple;
+  if (remainder == 0)
+  {
+    return size;
+  }
+
+  std::uint64_t padding = multiple - remainder;
+  if (size > UINT64_MAX - padding)
+  {
+    return {};
+  }
+
+  return size + padding;
+}
+
+static std::optional<std::uint64_t> round_to_size_class(
+  std::uint64_t size) noexcept
+{
+  // Zero sizes are left alone, as the emitted code does.
+  if (size == 0)
+  {
+    return size;
+  }
+
+  if (size <= MinSizeClass)
+  {
+    return MinSizeClass;
+  }
+
+  if (size <= SmallSizeLimit)
+  {
+    return round_up(size, SmallSizeSpacing);
+  }
+
+  // A size in (2^k, 2^(k+1)] is rounded to a multiple of 2^k / 4.
+  return round_up(size,
+    llvm::PowerOf2Floor(size - 1) / SizeClassesPerDoubling);
+}
+
+//!
+//! Emits code rounding `size` up to a multiple of `multiple`, which has to be
+//! non-zero, and can only be a variable if it's a power of two.
+//!
+static llvm::Value* create_round_up(llvm::IRBuilderBase& builder,
+  llvm::Value* size, llvm::Value* multiple, bool isPowerOfTwo)
+{
+  llvm::Value* remainder = isPowerOfTwo
+    ? builder.CreateAnd(size, builder.CreateSub(multiple,
+      llvm::ConstantInt::get(size->getType(), 1)))
+    : builder.CreateURem(size, multiple);
+  llvm::Value* roundedSize =
+    builder.CreateAdd(size, builder.CreateSub(multiple, remainder));
+
+  // Keep sizes which are already rounded, or whose rounding overflows.
+  llvm::Value* isRounded = builder.CreateICmpEQ(remainder,
+    llvm::ConstantInt::get(size->getType(), 0));
+  llvm::Value* overflowed = builder.CreateICmpULT(roundedSize, size);
+  return builder.CreateSelect(builder.CreateOr(isRounded, overflowed), size,
+    roundedSize);
+}
+
+//!
+//! Emits code counting the leading zeros of `value`.
+//!
+static llvm::Value* create_ctlz(llvm::IRBuilderBase& builder,
+  llvm::Value* value)
+{
+  return builder.CreateIntrinsic(llvm::Intrinsic::ctlz, {value->getType()},
+    {value, /*IsZeroPoison*/ builder.getFalse()});
+}
+
+static llvm::Value* create_round_to_power_of_two(llvm::IRBuilderBase& builder,
+  llvm::Value* size)
+{
+  auto* sizeType = llvm::cast<llvm::IntegerType>(size->getType());
+  llvm::Value* one = llvm::ConstantInt::get(sizeType, 1);
+
+  // Sizes in [1, 2^(bits-1)] are rounded to 1 << (bits - ctlz(size - 1)),
+  // and the others (which are exactly the ones where size - 1 is negative)
+  // have no power of two to round to. The shift is clamped so it's never
+  // poison.
+  llvm::Value* sizeMinusOne = builder.CreateSub(size, one);
+  llvm::Value* inRange = builder.CreateICmpSGE(sizeMinusOne,
+    llvm::ConstantInt::get(sizeType, 0));
+  llvm::Value* shift = builder.CreateSub(
+    llvm::ConstantInt::get(sizeType, sizeType->getBitWidth()),
+    create_ctlz(builder, sizeMinusOne));
+  shift = builder.CreateSelect(inRange, shift,
+    llvm::ConstantInt::get(sizeType, 0));
+  return builder.CreateSelect(inRange, builder.CreateShl(one, shift), size);
+}
+
+static llvm::Value* create_round_to_size_class(llvm::IRBuilderBase& builder,
+  llvm::Value* size)
+{
+  auto* sizeType = llvm::cast<llvm::IntegerType>(size->getType());
+  auto getConstant = [sizeType](std::uint64_t value)
+    {
+      return llvm::ConstantInt::get(sizeType, value);
+    };
+
+  llvm::Value* smallSize = create_round_up(builder, size,
+    getConstant(SmallSizeSpacing), /*isPowerOfTwo*/ true);
+
+  // The spacing of the classes above SmallSizeLimit is the highest power of
+  // two below size divided by SizeClassesPerDoubling. Or-ing in a one keeps
+  // the shift from being poison for small sizes, whose result isn't used.
+  llvm::Value* sizeMinusOne = builder.CreateSub(size, getConstant(1));
+  llvm::Value* highestBit = builder.CreateLShr(
+    llvm::ConstantInt::get(sizeType,
+      llvm::APInt::getSignMask(sizeType->getBitWidth())),
+    create_ctlz(builder, builder.CreateOr(sizeMinusOne, getConstant(1))));
+  llvm::Value* spacing = builder.CreateLShr(highestBit,
+    llvm::Log2_64(SizeClassesPerDoubling));
+  llvm::Value* largeSize = create_round_up(builder, size, spacing,
+    /*isPowerOfTwo*/ true);
+
+  llvm::Value* roundedSize = builder.CreateSelect(
+    builder.CreateICmpULE(size, getConstant(SmallSizeLimit)), smallSize,
+    largeSize);
+  roundedSize = builder.CreateSelect(
+    builder.CreateICmpULE(size, getConstant(MinSizeClass)),
+    getConstant(MinSizeClass), roundedSize);
+  return builder.CreateSelect(builder.CreateICmpEQ(size, getConstant(0)),
+    size, roundedSize);
+}
+
+} // namespace
+
+
+std::uint64_t jvs::round_allocation_size(const ResizeMallocOptions& options,
+  std::uint64_t size, unsigned int bits) noexcept
+{
+  std::optional<std::uint64_t> roundedSize{};
+  switch (options.Rounding)
+  {
+  case ResizeMallocRounding::Multiple:
+    roundedSize = round_up(size, options.Multiple);
+    break;
+  case ResizeMallocRounding::PowerOfTwo:
+    // PowerOf2Ceil() wraps to zero once there's no larger power of two.
+    if (std::uint64_t powerOfTwo = llvm::PowerOf2Ceil(size))
+    {
+      roundedSize = powerOfTwo;
+    }
+
+    break;
+  case ResizeMallocRounding::SizeClasses:
+    roundedSize = round_to_size_class(size);
+    break;
+  }
+
+  if (!roundedSize || !llvm::isUIntN(bits, *roundedSize))
+  {
+    return size;
+  }
+
+  return *roundedSize;
+}
+
+llvm::Value* jvs::create_round_allocation_size(llvm::IRBuilderBase& builder,
+  const ResizeMallocOptions& options, llvm::Value* size)
+{
+  unsigned int bits = size->getType()->getIntegerBitWidth();
+  switch (options.Rounding)
+  {
+  case ResizeMallocRounding::Multiple:
+    // Every non-zero size would overflow if the multiple doesn't fit.
+    if (options.Multiple == 0 || !llvm::isUIntN(bits, options.Multiple))
+    {
+      return size;
+    }
+
+    return create_round_up(builder, size,
+      llvm::ConstantInt::get(size->getType(), options.Multiple),
+      llvm::isPowerOf2_64(options.Multiple));
+  case ResizeMallocRounding::PowerOfTwo:
+    return create_round_to_power_of_two(builder, size);
+  case ResizeMallocRounding::SizeClasses:
+    if (!llvm::isUIntN(bits, SmallSizeLimit))
+    {
+      return size;
+    }
+
+    return create_round_to_size_class(builder, size);
+  }
+
+  return size;
+}
@@ -0,0 +1,41 @@
+#if !defined(JVS_PSEUDO_PASSES_RESIZE_MALLOC_SIZE_CLASSES_H_)
+#define JVS_PSEUDO_PASSES_RESIZE_MALLOC_SIZE_CLASSES_H_
+
+#include <cstdint>
+
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Value.h"
+#include "passes/resize-malloc.h"
+
+namespace jvs
+{
+
+//!
+//! Rounds an allocation size up as `options` asks (see
+//! ResizeMallocRounding).
+//!
+//! @param bits
+//!   Width of the size operand being rounded.
+//!
+//! @returns
+//!   The rounded size, or `size` itself if it's zero or already rounded, or
+//!   if the rounded size wouldn't fit in `bits` bits.
+//!
+std::uint64_t round_allocation_size(const ResizeMallocOptions& options,
+  std::uint64_t size, unsigned int bits) noexcept;
+
+//!
+//! Emits code rounding a size only known at run time, as
+//! round_allocation_size() would. The code is branch free, so it doesn't
+//! change the CFG. Zero sizes are left alone.
+//!
+//! @returns
+//!   The rounded size, which has the type of `size`.
+//!
+llvm::Value* create_round_allocation_size(llvm::IRBuilderBase& builder,
+  const ResizeMallocOptions& options, llvm::Value* size);
+
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_RESIZE_MALLOC_SIZE_CLASSES_H_
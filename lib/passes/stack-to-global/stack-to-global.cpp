@@ -14,8 +14,10 @@
 #include "llvm/IR/Module.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FormatVariadic.h"
 #include "passes/demote-registers.h"
+#include "support/extension-point.h"
 #include "support/value-util.h"
 
 namespace
@@ -23,8 +25,16 @@ namespace
 
 static constexpr char PluginName[] = "StackToGlobal";
 
+static llvm::cl::opt<jvs::ExtensionPoint> StackToGlobalExtensionPoint(
+  "stack-to-global-ep",
+  llvm::cl::desc("Where to add stack-to-global to the default pipelines"),
+  llvm::cl::init(jvs::ExtensionPoint::None),
+  jvs::function_extension_point_values());
+
+} // namespace
+
 // Pass registration
-static llvm::PassPluginLibraryInfo getStackToGlobalPluginInfo()
+llvm::PassPluginLibraryInfo jvs::getStackToGlobalPluginInfo()
 {
   return
   {
@@ -46,20 +56,13 @@ static llvm::PassPluginLibraryInfo getStackToGlobalPluginInfo()
 
           return false;
         });
+
+      jvs::register_function_pass(passBuilder, StackToGlobalExtensionPoint,
+        [] { return jvs::StackToGlobalPass(); });
     }
   };
 }
 
-} // namespace
-
-// This function is required for `opt` to be able to recognize this pass when
-// requested in the pass pipeline.
-extern "C" LLVM_ATTRIBUTE_WEAK auto llvmGetPassPluginInfo()
--> ::llvm::PassPluginLibraryInfo
-{
-  return getStackToGlobalPluginInfo();
-}
-
 llvm::PreservedAnalyses jvs::StackToGlobalPass::run(llvm::Function& f, 
   llvm::FunctionAnalysisManager& manager)
 {
@@ -0,0 +1,99 @@
+#include "call-counts.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+
+namespace
+{
+
+// Instrumented code increments the counters with relaxed atomic adds, so
+// they're read with relaxed atomic loads.
+static std::uint64_t load_count(std::uint64_t& count)
+{
+  return reinterpret_cast<std::atomic<std::uint64_t>&>(count).load(
+    std::memory_order_relaxed);
+}
+
+struct FunctionCount
+{
+  std::string_view Name;
+  std::uint64_t Count;
+};
+
+} // namespace
+
+
+bool jvs::trace::write_call_counts(const std::string& path,
+  const std::vector<const jvs_trace_module*>& modules)
+{
+  std::unordered_map<std::string_view, std::uint64_t> counts{};
+  for (const jvs_trace_module* module : modules)
+  {
+    if (!module->call_counts)
+    {
+      continue;
+    }
+
+    for (std::uint32_t localId = 0; localId < module->function_count;
+      ++localId)
+    {
+      std::string_view name(module->name_table +
+        module->name_offsets[localId]);
+      counts[name] += load_count(module->call_counts[localId]);
+    }
+  }
+
+  std::vector<FunctionCount> functions{};
+  functions.reserve(counts.size());
+  for (const auto& [name, count] : counts)
+  {
+    functions.push_back({name, count});
+  }
+
+  std::sort(functions.begin(), functions.end(),
+    [](const FunctionCount& lhs, const FunctionCount& rhs)
+    {
+      if (lhs.Count != rhs.Count)
+      {
+        return lhs.Count > rhs.Count;
+      }
+
+      return lhs.Name < rhs.Name;
+    });
+
+  std::vector<jvs_count_record> records{};
+  std::string nameTable{};
+  records.reserve(functions.size());
+  for (const FunctionCount& function : functions)
+  {
+    jvs_count_record record{};
+    record.count = function.Count;
+    record.name_offset = static_cast<std::uint32_t>(nameTable.size());
+    records.push_back(record);
+    nameTable.append(function.Name);
+    nameTable.push_back('\0');
+  }
+
+  std::FILE* file = std::fopen(path.c_str(), "wb");
+  if (!file)
+  {
+    return false;
+  }
+
+  jvs_count_file_header header{};
+  std::memcpy(header.magic, JVS_COUNT_FILE_MAGIC, sizeof(header.magic));
+  header.version = JVS_COUNT_FILE_VERSION;
+  header.function_count = static_cast<std::uint32_t>(records.size());
+  header.name_table_size = nameTable.size();
+  bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+    std::fwrite(records.data(), sizeof(jvs_count_record), records.size(),
+      file) == records.size() &&
+    std::fwrite(nameTable.data(), 1, nameTable.size(), file) ==
+      nameTable.size();
+  return std::fclose(file) == 0 && written;
+}
@@ -0,0 +1,29 @@
+#if !defined(JVS_PSEUDO_PASSES_RUNTIME_CALL_COUNTS_H_)
+#define JVS_PSEUDO_PASSES_RUNTIME_CALL_COUNTS_H_
+
+#include <string>
+#include <vector>
+
+#include "runtime/function-name-trace.h"
+
+namespace jvs
+{
+namespace trace
+{
+
+//!
+//! Writes the call counts of the given modules (those instrumented with
+//! `function-name-trace<counts>`) to a call count file, summing the counts of
+//! functions with the same name.
+//!
+//! @returns
+//!   Whether the file was written.
+//!
+bool write_call_counts(const std::string& path,
+  const std::vector<const jvs_trace_module*>& modules);
+
+} // namespace trace
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_RUNTIME_CALL_COUNTS_H_
@@ -0,0 +1,180 @@
+#include "edge-profile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "runtime/function-name-trace.h"
+
+#include "output-path.h"
+#include "trace-runtime.h"
+
+namespace
+{
+
+static void dump_profile()
+{
+  jvs::trace::EdgeProfile::get().dump();
+}
+
+//!
+//! Mixes the bits of an edge key (the finalizer of SplitMix64), so edges of
+//! the same caller don't all land in neighboring slots.
+//!
+static std::uint64_t hash_key(std::uint64_t key) noexcept
+{
+  key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ull;
+  key = (key ^ (key >> 27)) * 0x94d049bb133111ebull;
+  return key ^ (key >> 31);
+}
+
+struct Edge
+{
+  std::uint32_t CallerId;
+  std::uint32_t CalleeId;
+  std::uint64_t Count;
+};
+
+static void print_function(std::FILE* file, jvs::trace::Runtime& runtime,
+  std::uint32_t functionId)
+{
+  if (functionId == JVS_TRACE_UNKNOWN_CALLER)
+  {
+    std::fputs("<unknown>", file);
+  }
+  else if (const char* name = runtime.function_name(functionId))
+  {
+    std::fputs(name, file);
+  }
+  else
+  {
+    std::fprintf(file, "<function %u>", functionId);
+  }
+}
+
+} // namespace
+
+
+jvs::trace::EdgeTable::EdgeTable()
+  // calloc() leaves the pages untouched until edges land in them, so the
+  // table only costs the memory it uses.
+  : slots_(static_cast<Slot*>(std::calloc(Capacity, sizeof(Slot))))
+{
+}
+
+jvs::trace::EdgeTable::~EdgeTable()
+{
+  std::free(slots_);
+}
+
+void jvs::trace::EdgeTable::record(std::uint32_t callerId,
+  std::uint32_t calleeId) noexcept
+{
+  if (!slots_)
+  {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  // Keys are offset by one so that a zeroed slot is empty. The key of
+  // (UINT32_MAX, UINT32_MAX) would wrap, but an unknown caller is never also
+  // the callee.
+  std::uint64_t key =
+    ((std::uint64_t{callerId} << 32) | std::uint64_t{calleeId}) + 1;
+  std::size_t index = static_cast<std::size_t>(hash_key(key));
+  for (std::size_t probe = 0; probe < MaxProbes; ++probe)
+  {
+    Slot& slot = slots_[(index + probe) & (Capacity - 1)];
+    std::uint64_t slotKey = slot.Key.load(std::memory_order_relaxed);
+    if (slotKey == EmptyKey &&
+      slot.Key.compare_exchange_strong(slotKey, key,
+        std::memory_order_relaxed))
+    {
+      slotKey = key;
+    }
+
+    if (slotKey == key)
+    {
+      slot.Count.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+
+  dropped_.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::uint64_t jvs::trace::EdgeTable::dropped() const noexcept
+{
+  return dropped_.load(std::memory_order_relaxed);
+}
+
+jvs::trace::EdgeProfile& jvs::trace::EdgeProfile::get()
+{
+  static EdgeProfile* profile = new EdgeProfile();
+  return *profile;
+}
+
+jvs::trace::EdgeProfile::EdgeProfile()
+{
+  std::atexit(&dump_profile);
+}
+
+void jvs::trace::EdgeProfile::dump()
+{
+  std::lock_guard<std::mutex> lock(dump_mutex_);
+  std::vector<Edge> edges{};
+  table_.for_each(
+    [&edges](std::uint32_t callerId, std::uint32_t calleeId,
+      std::uint64_t count)
+    {
+      edges.push_back({callerId, calleeId, count});
+    });
+  std::sort(edges.begin(), edges.end(),
+    [](const Edge& lhs, const Edge& rhs)
+    {
+      return lhs.Count > rhs.Count;
+    });
+
+  std::string path = get_output_path("JVS_TRACE_EDGES", "pseudo-edges",
+    "txt");
+  std::FILE* file = std::fopen(path.c_str(), "w");
+  if (!file)
+  {
+    std::fprintf(stderr, "function-name-trace: unable to create '%s'\n",
+      path.c_str());
+    return;
+  }
+
+  std::fprintf(file, "# function-name-trace call graph profile\n");
+  if (std::uint64_t dropped = table_.dropped())
+  {
+    std::fprintf(file, "# %llu calls dropped because the edge table was "
+      "full\n", static_cast<unsigned long long>(dropped));
+  }
+
+  std::fprintf(file, "#%19s  %s\n", "calls", "caller callee");
+  Runtime& runtime = Runtime::get();
+  for (const Edge& edge : edges)
+  {
+    std::fprintf(file, "%20llu  ", static_cast<unsigned long long>(edge.Count));
+    print_function(file, runtime, edge.CallerId);
+    std::fputc(' ', file);
+    print_function(file, runtime, edge.CalleeId);
+    std::fputc('\n', file);
+  }
+
+  std::fclose(file);
+}
+
+
+void __jvs_trace_edge(uint32_t caller_id, uint32_t callee_id)
+{
+  jvs::trace::EdgeProfile::get().record(caller_id, callee_id);
+}
+
+void __jvs_trace_dump_edges(void)
+{
+  jvs::trace::EdgeProfile::get().dump();
+}
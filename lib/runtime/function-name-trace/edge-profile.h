@@ -0,0 +1,112 @@
+#if !defined(JVS_PSEUDO_PASSES_RUNTIME_EDGE_PROFILE_H_)
+#define JVS_PSEUDO_PASSES_RUNTIME_EDGE_PROFILE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace jvs
+{
+namespace trace
+{
+
+//!
+//! Lock-free open addressing hash table counting the calls along each
+//! caller/callee edge.
+//!
+//! Any number of threads can record edges at once: a new edge claims an empty
+//! slot with a compare and swap, and counts are bumped with relaxed atomic
+//! adds. The table doesn't grow, so once an edge's probe sequence is full its
+//! calls are counted as dropped instead.
+//!
+class EdgeTable
+{
+public:
+  static constexpr std::size_t Capacity = std::size_t{1} << 20;
+  static constexpr std::size_t MaxProbes = 64;
+
+  EdgeTable();
+  EdgeTable(const EdgeTable&) = delete;
+  EdgeTable& operator=(const EdgeTable&) = delete;
+  ~EdgeTable();
+
+  void record(std::uint32_t callerId, std::uint32_t calleeId) noexcept;
+
+  //!
+  //! Calls `visit(callerId, calleeId, count)` for every edge recorded.
+  //!
+  template <typename VisitFunction>
+  void for_each(VisitFunction&& visit) const
+  {
+    if (!slots_)
+    {
+      return;
+    }
+
+    for (std::size_t index = 0; index < Capacity; ++index)
+    {
+      std::uint64_t key = slots_[index].Key.load(std::memory_order_relaxed);
+      std::uint64_t count =
+        slots_[index].Count.load(std::memory_order_relaxed);
+      if (key != EmptyKey && count != 0)
+      {
+        // See record() for the key encoding.
+        --key;
+        visit(static_cast<std::uint32_t>(key >> 32),
+          static_cast<std::uint32_t>(key), count);
+      }
+    }
+  }
+
+  std::uint64_t dropped() const noexcept;
+
+private:
+  static constexpr std::uint64_t EmptyKey = 0;
+
+  struct Slot
+  {
+    std::atomic<std::uint64_t> Key;
+    std::atomic<std::uint64_t> Count;
+  };
+
+  Slot* slots_;
+  std::atomic<std::uint64_t> dropped_{0};
+};
+
+//!
+//! Process-wide call graph profile gathered by code instrumented with
+//! `function-name-trace<edges>`.
+//!
+//! The profile is written as a text report to `$JVS_TRACE_EDGES`
+//! (`pseudo-edges.<pid>.txt` by default) at exit and when
+//! __jvs_trace_dump_edges() is called, with one line per edge giving the
+//! number of calls and the (mangled) caller and callee names.
+//!
+class EdgeProfile
+{
+public:
+  static EdgeProfile& get();
+
+  EdgeProfile(const EdgeProfile&) = delete;
+  EdgeProfile& operator=(const EdgeProfile&) = delete;
+
+  void record(std::uint32_t callerId, std::uint32_t calleeId) noexcept
+  {
+    table_.record(callerId, calleeId);
+  }
+
+  void dump();
+
+private:
+  EdgeProfile();
+
+  std::mutex dump_mutex_{};
+  EdgeTable table_{};
+};
+
+} // namespace trace
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_RUNTIME_EDGE_PROFILE_H_
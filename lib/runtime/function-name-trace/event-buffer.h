@@ -0,0 +1,110 @@
+#if !defined(JVS_PSEUDO_PASSES_RUNTIME_EVENT_BUFFER_H_)
+#define JVS_PSEUDO_PASSES_RUNTIME_EVENT_BUFFER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "runtime/function-name-trace.h"
+
+namespace jvs
+{
+namespace trace
+{
+
+//!
+//! Fixed-size, single producer/single consumer ring buffer of trace events.
+//!
+//! The owning thread is the only producer and the flusher thread is the only
+//! consumer, so neither side ever takes a lock or waits on the other. Events
+//! recorded while the buffer is full are counted and dropped.
+//!
+class EventBuffer
+{
+public:
+  static constexpr std::size_t Capacity = std::size_t{1} << 16;
+
+  explicit EventBuffer(std::uint64_t threadId)
+    : thread_id_(threadId),
+    events_(new jvs_trace_event[Capacity])
+  {
+  }
+
+  EventBuffer(const EventBuffer&) = delete;
+  EventBuffer& operator=(const EventBuffer&) = delete;
+
+  std::uint64_t thread_id() const noexcept
+  {
+    return thread_id_;
+  }
+
+  //!
+  //! Appends an event to the buffer. Must only be called by the owning thread.
+  //!
+  //! @returns
+  //!   True every time another half of the buffer has been filled, which is
+  //!   when the consumer should be woken up.
+  //!
+  bool push(const jvs_trace_event& event) noexcept
+  {
+    std::uint64_t head = head_.load(std::memory_order_relaxed);
+    if (head - cached_tail_ >= Capacity)
+    {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head - cached_tail_ >= Capacity)
+      {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+    }
+
+    events_[head & (Capacity - 1)] = event;
+    head_.store(head + 1, std::memory_order_release);
+    return ((head + 1) & (Capacity / 2 - 1)) == 0;
+  }
+
+  //!
+  //! Hands every event recorded so far to `consume` as (at most two)
+  //! contiguous spans, then releases their slots to the producer. Must only be
+  //! called by the consumer.
+  //!
+  //! @returns
+  //!   The number of events consumed.
+  //!
+  template <typename ConsumeFunction>
+  std::size_t drain(ConsumeFunction&& consume)
+  {
+    std::uint64_t head = head_.load(std::memory_order_acquire);
+    std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+    std::uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+    if (head == tail && dropped == 0)
+    {
+      return 0;
+    }
+
+    std::size_t first = static_cast<std::size_t>(tail & (Capacity - 1));
+    std::size_t count = static_cast<std::size_t>(head - tail);
+    std::size_t firstCount = count < Capacity - first ? count : Capacity - first;
+    consume(thread_id_, dropped, &events_[first], firstCount,
+      events_.get(), count - firstCount);
+    tail_.store(head, std::memory_order_release);
+    return count;
+  }
+
+private:
+  const std::uint64_t thread_id_;
+  std::unique_ptr<jvs_trace_event[]> events_;
+  // Producer-side state.
+  alignas(64) std::atomic<std::uint64_t> head_{0};
+  std::uint64_t cached_tail_{0};
+  std::atomic<std::uint64_t> dropped_{0};
+  // Consumer-side state.
+  alignas(64) std::atomic<std::uint64_t> tail_{0};
+};
+
+} // namespace trace
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_RUNTIME_EVENT_BUFFER_H_
@@ -0,0 +1,399 @@
+#include "latency-profile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#if !defined(_WIN32)
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#include "output-path.h"
+#include "trace-runtime.h"
+
+namespace
+{
+
+static void dump_profile()
+{
+  jvs::trace::LatencyProfile::get().dump();
+}
+
+static std::size_t get_bucket(std::uint64_t ticks) noexcept
+{
+  std::size_t bucket = 0;
+  while (ticks != 0 && bucket < jvs::trace::LatencyBuckets - 1)
+  {
+    ticks >>= 1;
+    ++bucket;
+  }
+
+  return bucket;
+}
+
+static void add_relaxed(std::atomic<std::uint64_t>& counter,
+  std::uint64_t value) noexcept
+{
+  counter.store(counter.load(std::memory_order_relaxed) + value,
+    std::memory_order_relaxed);
+}
+
+//!
+//! Statistics of one function summed over every thread.
+//!
+struct FunctionTotals
+{
+  std::uint32_t FunctionId{0};
+  std::uint64_t Calls{0};
+  std::uint64_t Ticks{0};
+  std::uint64_t Buckets[jvs::trace::LatencyBuckets]{};
+};
+
+//!
+//! Estimates a latency percentile (in ticks) as the upper bound of the
+//! histogram bucket it falls in.
+//!
+static std::uint64_t get_percentile(const FunctionTotals& totals,
+  double fraction)
+{
+  std::uint64_t target = static_cast<std::uint64_t>(
+    static_cast<double>(totals.Calls) * fraction);
+  std::uint64_t count = 0;
+  for (std::size_t bucket = 0; bucket < jvs::trace::LatencyBuckets; ++bucket)
+  {
+    count += totals.Buckets[bucket];
+    if (count > target)
+    {
+      return std::uint64_t{1} << bucket;
+    }
+  }
+
+  return std::uint64_t{1} << (jvs::trace::LatencyBuckets - 1);
+}
+
+// The calling thread's latency table. Kept separate from ThreadTableOwner so
+// the hot path only reads a trivially-initialized thread local.
+thread_local jvs::trace::LatencyTable* ThreadLatencyTable{nullptr};
+thread_local bool ThreadExited{false};
+
+#if !defined(_WIN32)
+// Written to by the dump signal handler to wake the dumping thread, since
+// the handler itself can't safely do anything else.
+int DumpPipe[2]{-1, -1};
+
+static void handle_dump_signal(int)
+{
+  int savedErrno = errno;
+  char wakeup = 0;
+  (void)!write(DumpPipe[1], &wakeup, 1);
+  errno = savedErrno;
+}
+#endif
+
+} // namespace
+
+namespace jvs
+{
+namespace trace
+{
+
+//!
+//! Merges the thread's latency table into the profile when the thread exits.
+//!
+struct ThreadTableOwner
+{
+  ~ThreadTableOwner()
+  {
+    if (ThreadLatencyTable)
+    {
+      LatencyProfile::get().retire_thread_table(ThreadLatencyTable);
+    }
+
+    ThreadLatencyTable = nullptr;
+    ThreadExited = true;
+  }
+};
+
+} // namespace trace
+} // namespace jvs
+
+
+jvs::trace::LatencyTable::LatencyTable()
+  : pages_(new std::atomic<Page*>[MaxPages])
+{
+  for (std::size_t pageIndex = 0; pageIndex < MaxPages; ++pageIndex)
+  {
+    pages_[pageIndex].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+jvs::trace::LatencyTable::~LatencyTable()
+{
+  for (std::size_t pageIndex = 0; pageIndex < MaxPages; ++pageIndex)
+  {
+    delete pages_[pageIndex].load(std::memory_order_relaxed);
+  }
+}
+
+void jvs::trace::LatencyTable::record(std::uint32_t functionId,
+  std::uint64_t ticks) noexcept
+{
+  if (LatencyStats* stats = get_stats(functionId))
+  {
+    add_relaxed(stats->Calls, 1);
+    add_relaxed(stats->Ticks, ticks);
+    add_relaxed(stats->Buckets[get_bucket(ticks)], 1);
+  }
+}
+
+void jvs::trace::LatencyTable::merge(std::uint32_t functionId,
+  const LatencyStats& stats) noexcept
+{
+  if (LatencyStats* ownStats = get_stats(functionId))
+  {
+    add_relaxed(ownStats->Calls, stats.Calls.load(std::memory_order_relaxed));
+    add_relaxed(ownStats->Ticks, stats.Ticks.load(std::memory_order_relaxed));
+    for (std::size_t bucket = 0; bucket < LatencyBuckets; ++bucket)
+    {
+      add_relaxed(ownStats->Buckets[bucket],
+        stats.Buckets[bucket].load(std::memory_order_relaxed));
+    }
+  }
+}
+
+jvs::trace::LatencyStats* jvs::trace::LatencyTable::get_stats(
+  std::uint32_t functionId) noexcept
+{
+  std::size_t pageIndex = functionId / PageSize;
+  if (pageIndex >= MaxPages)
+  {
+    return nullptr;
+  }
+
+  Page* page = pages_[pageIndex].load(std::memory_order_relaxed);
+  if (!page)
+  {
+    page = new (std::nothrow) Page();
+    if (!page)
+    {
+      return nullptr;
+    }
+
+    pages_[pageIndex].store(page, std::memory_order_release);
+  }
+
+  return &(*page)[functionId % PageSize];
+}
+
+jvs::trace::LatencyProfile& jvs::trace::LatencyProfile::get()
+{
+  static LatencyProfile* profile = new LatencyProfile();
+  return *profile;
+}
+
+jvs::trace::LatencyProfile::LatencyProfile()
+{
+  std::atexit(&dump_profile);
+  install_dump_signal();
+}
+
+jvs::trace::LatencyTable* jvs::trace::LatencyProfile::thread_table()
+{
+  if (ThreadLatencyTable)
+  {
+    return ThreadLatencyTable;
+  }
+
+  if (ThreadExited)
+  {
+    return nullptr;
+  }
+
+  thread_local ThreadTableOwner owner{};
+  ThreadLatencyTable = create_thread_table();
+  return ThreadLatencyTable;
+}
+
+void jvs::trace::LatencyProfile::dump()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<FunctionTotals> functions{};
+  auto addStats = [&functions](std::uint32_t functionId,
+    const LatencyStats& stats)
+  {
+    if (functionId >= functions.size())
+    {
+      functions.resize(functionId + 1);
+    }
+
+    FunctionTotals& totals = functions[functionId];
+    totals.FunctionId = functionId;
+    totals.Calls += stats.Calls.load(std::memory_order_relaxed);
+    totals.Ticks += stats.Ticks.load(std::memory_order_relaxed);
+    for (std::size_t bucket = 0; bucket < LatencyBuckets; ++bucket)
+    {
+      totals.Buckets[bucket] +=
+        stats.Buckets[bucket].load(std::memory_order_relaxed);
+    }
+  };
+
+  retired_.for_each(addStats);
+  for (const auto& table : tables_)
+  {
+    table->for_each(addStats);
+  }
+
+  functions.erase(std::remove_if(functions.begin(), functions.end(),
+    [](const FunctionTotals& totals) { return totals.Calls == 0; }),
+    functions.end());
+  std::sort(functions.begin(), functions.end(),
+    [](const FunctionTotals& lhs, const FunctionTotals& rhs)
+    {
+      return lhs.Ticks > rhs.Ticks;
+    });
+
+  std::string path = get_output_path("JVS_TRACE_PROFILE", "pseudo-profile",
+    "txt");
+  std::FILE* file = std::fopen(path.c_str(), "w");
+  if (!file)
+  {
+    std::fprintf(stderr, "function-name-trace: unable to create '%s'\n",
+      path.c_str());
+    return;
+  }
+
+  std::uint64_t ticksPerSecond = clock_calibration_.ticks_per_second();
+  double ticksPerMicrosecond = ticksPerSecond
+    ? static_cast<double>(ticksPerSecond) / 1e6
+    : 1.0;
+  auto toMicroseconds = [ticksPerMicrosecond](double ticks)
+  {
+    return ticks / ticksPerMicrosecond;
+  };
+
+  std::fprintf(file,
+    "# function-name-trace latency profile\n"
+    "# %llu clock ticks per second; percentiles are the upper bounds of\n"
+    "# their histogram buckets, and histogram bucket b:n means n calls took\n"
+    "# fewer than 2^b ticks\n"
+    "#%13s %14s %12s %12s %12s %12s  %s\n",
+    static_cast<unsigned long long>(ticksPerSecond),
+    "calls", "total_us", "mean_us", "p50_us", "p90_us", "p99_us",
+    "function histogram");
+  Runtime& runtime = Runtime::get();
+  for (const FunctionTotals& totals : functions)
+  {
+    const char* name = runtime.function_name(totals.FunctionId);
+    std::fprintf(file, "%14llu %14.3f %12.3f %12.3f %12.3f %12.3f  ",
+      static_cast<unsigned long long>(totals.Calls),
+      toMicroseconds(static_cast<double>(totals.Ticks)),
+      toMicroseconds(static_cast<double>(totals.Ticks) /
+        static_cast<double>(totals.Calls)),
+      toMicroseconds(static_cast<double>(get_percentile(totals, 0.5))),
+      toMicroseconds(static_cast<double>(get_percentile(totals, 0.9))),
+      toMicroseconds(static_cast<double>(get_percentile(totals, 0.99))));
+    if (name)
+    {
+      std::fputs(name, file);
+    }
+    else
+    {
+      std::fprintf(file, "<function %u>", totals.FunctionId);
+    }
+
+    for (std::size_t bucket = 0; bucket < LatencyBuckets; ++bucket)
+    {
+      if (totals.Buckets[bucket] != 0)
+      {
+        std::fprintf(file, " %zu:%llu", bucket,
+          static_cast<unsigned long long>(totals.Buckets[bucket]));
+      }
+    }
+
+    std::fputc('\n', file);
+  }
+
+  std::fclose(file);
+}
+
+jvs::trace::LatencyTable* jvs::trace::LatencyProfile::create_thread_table()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  tables_.push_back(std::make_unique<LatencyTable>());
+  return tables_.back().get();
+}
+
+void jvs::trace::LatencyProfile::retire_thread_table(LatencyTable* table)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  table->for_each([this](std::uint32_t functionId, const LatencyStats& stats)
+    {
+      retired_.merge(functionId, stats);
+    });
+  tables_.erase(std::find_if(tables_.begin(), tables_.end(),
+    [table](const std::unique_ptr<LatencyTable>& ownedTable)
+    {
+      return ownedTable.get() == table;
+    }));
+}
+
+void jvs::trace::LatencyProfile::install_dump_signal()
+{
+#if !defined(_WIN32)
+  // Leave the signal alone if the program already uses it.
+  struct sigaction oldAction{};
+  if (sigaction(SIGUSR1, nullptr, &oldAction) != 0 ||
+    oldAction.sa_handler != SIG_DFL || pipe(DumpPipe) != 0)
+  {
+    return;
+  }
+
+  std::thread([]
+    {
+      char wakeup = 0;
+      for (;;)
+      {
+        ssize_t readCount = read(DumpPipe[0], &wakeup, 1);
+        if (readCount > 0)
+        {
+          get().dump();
+        }
+        else if (readCount == 0 || errno != EINTR)
+        {
+          break;
+        }
+      }
+    }).detach();
+
+  struct sigaction action{};
+  action.sa_handler = &handle_dump_signal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR1, &action, nullptr);
+#endif
+}
+
+
+uint64_t __jvs_trace_clock(void)
+{
+  return jvs::trace::read_clock();
+}
+
+void __jvs_trace_latency(uint32_t function_id, uint64_t start_time)
+{
+  std::uint64_t endTime = jvs::trace::read_clock();
+  jvs::trace::LatencyProfile& profile = jvs::trace::LatencyProfile::get();
+  if (jvs::trace::LatencyTable* table = profile.thread_table())
+  {
+    table->record(function_id, endTime - start_time);
+  }
+}
+
+void __jvs_trace_dump_latency(void)
+{
+  jvs::trace::LatencyProfile::get().dump();
+}
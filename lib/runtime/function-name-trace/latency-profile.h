@@ -0,0 +1,148 @@
+#if !defined(JVS_PSEUDO_PASSES_RUNTIME_LATENCY_PROFILE_H_)
+#define JVS_PSEUDO_PASSES_RUNTIME_LATENCY_PROFILE_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "trace-clock.h"
+
+namespace jvs
+{
+namespace trace
+{
+
+//!
+//! Number of latency histogram buckets. Bucket `i` counts the calls which
+//! took fewer than 2^i clock ticks (and at least 2^(i-1)), with the last
+//! bucket also taking everything longer.
+//!
+static constexpr std::size_t LatencyBuckets = 48;
+
+//!
+//! Latency statistics of one function in one thread.
+//!
+//! Only the owning thread writes them, but the profile can be dumped from any
+//! thread at any time, so the counters are atomics accessed with relaxed
+//! loads and stores (never read-modify-writes, which the owner doesn't need).
+//!
+struct LatencyStats
+{
+  std::atomic<std::uint64_t> Calls{0};
+  std::atomic<std::uint64_t> Ticks{0};
+  std::array<std::atomic<std::uint64_t>, LatencyBuckets> Buckets{};
+};
+
+//!
+//! Maps function IDs to their LatencyStats, allocating the statistics in
+//! pages as functions are first called.
+//!
+class LatencyTable
+{
+public:
+  static constexpr std::size_t PageSize = 256;
+  static constexpr std::size_t MaxPages = 4096;
+
+  LatencyTable();
+  LatencyTable(const LatencyTable&) = delete;
+  LatencyTable& operator=(const LatencyTable&) = delete;
+  ~LatencyTable();
+
+  //!
+  //! Adds a call of the given function. Must only be called by the owner.
+  //!
+  void record(std::uint32_t functionId, std::uint64_t ticks) noexcept;
+
+  //!
+  //! Adds the statistics of `stats` to those of the given function. Must only
+  //! be called by the owner.
+  //!
+  void merge(std::uint32_t functionId, const LatencyStats& stats) noexcept;
+
+  //!
+  //! Calls `visit(functionId, stats)` for every function called at least
+  //! once. Can be called from any thread.
+  //!
+  template <typename VisitFunction>
+  void for_each(VisitFunction&& visit) const
+  {
+    for (std::size_t pageIndex = 0; pageIndex < MaxPages; ++pageIndex)
+    {
+      const Page* page = pages_[pageIndex].load(std::memory_order_acquire);
+      if (!page)
+      {
+        continue;
+      }
+
+      for (std::size_t index = 0; index < PageSize; ++index)
+      {
+        if ((*page)[index].Calls.load(std::memory_order_relaxed) != 0)
+        {
+          visit(static_cast<std::uint32_t>(pageIndex * PageSize + index),
+            (*page)[index]);
+        }
+      }
+    }
+  }
+
+private:
+  using Page = std::array<LatencyStats, PageSize>;
+
+  LatencyStats* get_stats(std::uint32_t functionId) noexcept;
+
+  std::unique_ptr<std::atomic<Page*>[]> pages_;
+};
+
+//!
+//! Process-wide latency profile: the LatencyTable of every thread plus the
+//! merged statistics of the threads which have exited.
+//!
+//! The profile is written as a text report to `$JVS_TRACE_PROFILE`
+//! (`pseudo-profile.<pid>.txt` by default) at exit, when
+//! __jvs_trace_dump_latency() is called, and (on POSIX systems) whenever the
+//! process receives SIGUSR1, unless the program handles that itself. Each
+//! dump overwrites the previous one with the totals so far.
+//!
+class LatencyProfile
+{
+public:
+  static LatencyProfile& get();
+
+  LatencyProfile(const LatencyProfile&) = delete;
+  LatencyProfile& operator=(const LatencyProfile&) = delete;
+
+  //!
+  //! Gets the latency table of the calling thread, creating it if needed.
+  //!
+  //! @returns
+  //!   The table, or null if the thread is exiting and has already released
+  //!   it.
+  //!
+  LatencyTable* thread_table();
+
+  void dump();
+
+private:
+  LatencyProfile();
+
+  LatencyTable* create_thread_table();
+  void retire_thread_table(LatencyTable* table);
+  void install_dump_signal();
+
+  std::mutex mutex_{};
+  std::vector<std::unique_ptr<LatencyTable>> tables_{};
+  LatencyTable retired_{};
+  ClockCalibration clock_calibration_{};
+
+  friend struct ThreadTableOwner;
+};
+
+} // namespace trace
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_RUNTIME_LATENCY_PROFILE_H_
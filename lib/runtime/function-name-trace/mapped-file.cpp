@@ -0,0 +1,245 @@
+#include "mapped-file.h"
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+jvs::trace::MappedFile::~MappedFile()
+{
+  close();
+}
+
+bool jvs::trace::MappedFile::open(const std::string& path)
+{
+  close();
+#if defined(_WIN32)
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+    FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+
+  file_ = file;
+#else
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0)
+  {
+    return false;
+  }
+#endif
+
+  size_ = 0;
+  prefaulted_ = 0;
+  if (!map(InitialCapacity))
+  {
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+void jvs::trace::MappedFile::close()
+{
+  if (!is_open())
+  {
+    return;
+  }
+
+  // Drop the space allocated ahead of the data.
+  unmap();
+#if defined(_WIN32)
+  LARGE_INTEGER size{};
+  size.QuadPart = static_cast<LONGLONG>(size_);
+  SetFilePointerEx(file_, size, nullptr, FILE_BEGIN);
+  SetEndOfFile(file_);
+  CloseHandle(file_);
+  file_ = nullptr;
+#else
+  (void)!ftruncate(fd_, static_cast<off_t>(size_));
+  ::close(fd_);
+  fd_ = -1;
+#endif
+  capacity_ = 0;
+  size_ = 0;
+}
+
+void jvs::trace::MappedFile::flush()
+{
+  if (!data_ || size_ == 0)
+  {
+    return;
+  }
+
+#if defined(_WIN32)
+  FlushViewOfFile(data_, size_);
+#else
+  msync(data_, size_, MS_ASYNC);
+#endif
+}
+
+bool jvs::trace::MappedFile::is_open() const noexcept
+{
+#if defined(_WIN32)
+  return file_ != nullptr;
+#else
+  return fd_ >= 0;
+#endif
+}
+
+void* jvs::trace::MappedFile::append(std::size_t size)
+{
+  if (!data_)
+  {
+    return nullptr;
+  }
+
+  if (capacity_ - size_ < size)
+  {
+    std::size_t capacity = capacity_;
+    while (capacity - size_ < size)
+    {
+      capacity += std::min(capacity, MaxGrowth);
+    }
+
+    if (!remap(capacity))
+    {
+      close();
+      return nullptr;
+    }
+  }
+
+  void* result = data_ + size_;
+  size_ += size;
+  return result;
+}
+
+void jvs::trace::MappedFile::prefault(std::size_t size)
+{
+  std::size_t end = std::min(size_ + size, capacity_);
+  if (!data_ || !can_prefault_ || end <= prefaulted_)
+  {
+    return;
+  }
+
+  std::size_t start = std::max(prefaulted_, size_);
+#if defined(MADV_POPULATE_WRITE)
+  // Faulting in a range at once is several times cheaper than taking the
+  // faults one page at a time.
+  static const std::size_t pageSize =
+    static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+  std::size_t pageStart = start & ~(pageSize - 1);
+  if (madvise(data_ + pageStart, end - pageStart, MADV_POPULATE_WRITE) != 0)
+  {
+    // Not supported by the running kernel.
+    can_prefault_ = false;
+    return;
+  }
+
+  prefaulted_ = end;
+#else
+  (void)start;
+  can_prefault_ = false;
+#endif
+}
+
+bool jvs::trace::MappedFile::map(std::size_t capacity)
+{
+#if defined(_WIN32)
+  // Creating the mapping extends the file to its size.
+  auto size = static_cast<std::uint64_t>(capacity);
+  mapping_handle_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE,
+    static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+  if (!mapping_handle_)
+  {
+    return false;
+  }
+
+  data_ = static_cast<char*>(MapViewOfFile(mapping_handle_, FILE_MAP_WRITE,
+    0, 0, capacity));
+  if (!data_)
+  {
+    CloseHandle(mapping_handle_);
+    mapping_handle_ = nullptr;
+    return false;
+  }
+#else
+  // Allocate the blocks up front where possible; writing to a hole in a
+  // sparse file when the disk is full raises SIGBUS.
+#if defined(__linux__)
+  if (posix_fallocate(fd_, 0, static_cast<off_t>(capacity)) != 0 &&
+    ftruncate(fd_, static_cast<off_t>(capacity)) != 0)
+#else
+  if (ftruncate(fd_, static_cast<off_t>(capacity)) != 0)
+#endif
+  {
+    return false;
+  }
+
+  void* data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+    fd_, 0);
+  if (data == MAP_FAILED)
+  {
+    return false;
+  }
+
+  data_ = static_cast<char*>(data);
+#endif
+  capacity_ = capacity;
+  return true;
+}
+
+bool jvs::trace::MappedFile::remap(std::size_t capacity)
+{
+#if defined(__linux__)
+  // Grow the mapping in place (or move it) without losing the pages already
+  // faulted in.
+  if (posix_fallocate(fd_, static_cast<off_t>(capacity_),
+    static_cast<off_t>(capacity - capacity_)) != 0 &&
+    ftruncate(fd_, static_cast<off_t>(capacity)) != 0)
+  {
+    return false;
+  }
+
+  void* data = mremap(data_, capacity_, capacity, MREMAP_MAYMOVE);
+  if (data == MAP_FAILED)
+  {
+    return false;
+  }
+
+  data_ = static_cast<char*>(data);
+  capacity_ = capacity;
+  return true;
+#else
+  unmap();
+  prefaulted_ = size_;
+  return map(capacity);
+#endif
+}
+
+void jvs::trace::MappedFile::unmap()
+{
+  if (!data_)
+  {
+    return;
+  }
+
+#if defined(_WIN32)
+  UnmapViewOfFile(data_);
+  CloseHandle(mapping_handle_);
+  mapping_handle_ = nullptr;
+#else
+  munmap(data_, capacity_);
+#endif
+  data_ = nullptr;
+}
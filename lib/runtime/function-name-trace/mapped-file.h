@@ -0,0 +1,81 @@
+#if !defined(JVS_PSEUDO_PASSES_RUNTIME_MAPPED_FILE_H_)
+#define JVS_PSEUDO_PASSES_RUNTIME_MAPPED_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace jvs
+{
+namespace trace
+{
+
+//!
+//! Output file written through a memory mapping, so appending is a copy
+//! straight into the page cache with no stdio buffering or system call.
+//!
+//! Space is allocated ahead of the data, starting at InitialCapacity bytes and
+//! doubling whenever it runs out, and the file is truncated to the data
+//! written when it's closed. Not thread safe.
+//!
+class MappedFile
+{
+public:
+  static constexpr std::size_t InitialCapacity = std::size_t{16} << 20;
+  static constexpr std::size_t MaxGrowth = std::size_t{1} << 30;
+
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile();
+
+  bool open(const std::string& path);
+  void close();
+
+  //!
+  //! Starts writing back the data appended so far, without waiting for it.
+  //!
+  void flush();
+
+  bool is_open() const noexcept;
+
+  //!
+  //! Reserves the next `size` bytes of the file.
+  //!
+  //! @returns
+  //!   Where to write them, or null if the file couldn't be grown (in which
+  //!   case it's closed).
+  //!
+  void* append(std::size_t size);
+
+  //!
+  //! Faults in the pages of the next `size` bytes (as far as the current
+  //! capacity goes), so the appends writing them don't stop on a page fault
+  //! for every page. Pages already faulted in are skipped.
+  //!
+  void prefault(std::size_t size);
+
+private:
+  bool map(std::size_t capacity);
+  bool remap(std::size_t capacity);
+  void unmap();
+
+#if defined(_WIN32)
+  void* file_{nullptr};
+  void* mapping_handle_{nullptr};
+#else
+  int fd_{-1};
+#endif
+  char* data_{nullptr};
+  std::size_t capacity_{0};
+  std::size_t size_{0};
+  // End of the pages faulted in by prefault().
+  std::size_t prefaulted_{0};
+  bool can_prefault_{true};
+};
+
+} // namespace trace
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_RUNTIME_MAPPED_FILE_H_
@@ -0,0 +1,25 @@
+#include "output-path.h"
+
+#include <cstdlib>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+std::string jvs::trace::get_output_path(const char* envVar,
+  const char* prefix, const char* extension)
+{
+  if (const char* path = std::getenv(envVar))
+  {
+    return path;
+  }
+
+#if defined(_WIN32)
+  int pid = _getpid();
+#else
+  int pid = static_cast<int>(getpid());
+#endif
+  return std::string(prefix) + "." + std::to_string(pid) + "." + extension;
+}
@@ -0,0 +1,22 @@
+#if !defined(JVS_PSEUDO_PASSES_RUNTIME_OUTPUT_PATH_H_)
+#define JVS_PSEUDO_PASSES_RUNTIME_OUTPUT_PATH_H_
+
+#include <string>
+
+namespace jvs
+{
+namespace trace
+{
+
+//!
+//! Gets the path of a file the runtime writes: the value of the environment
+//! variable `envVar` if it's set, and `<prefix>.<pid>.<extension>` otherwise.
+//!
+std::string get_output_path(const char* envVar, const char* prefix,
+  const char* extension);
+
+} // namespace trace
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_RUNTIME_OUTPUT_PATH_H_
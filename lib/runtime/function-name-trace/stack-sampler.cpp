@@ -0,0 +1,341 @@
+#include "stack-sampler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+#include "runtime/function-name-trace.h"
+
+#include "output-path.h"
+#include "trace-runtime.h"
+
+extern "C"
+{
+
+// Maintained by the instrumented code. The handler reads the interrupted
+// thread's, which is async-signal-safe as long as the runtime is linked into
+// the executable (so the stack is in static TLS).
+thread_local jvs_trace_shadow_stack __jvs_trace_shadow_stack{};
+
+} // extern "C"
+
+namespace
+{
+
+// Prime, so sampling doesn't run in lockstep with periodic work.
+static constexpr unsigned long DefaultSampleRate = 997;
+static constexpr unsigned long MaxSampleRate = 100000;
+
+static void dump_profile()
+{
+  jvs::trace::StackSampler& sampler = jvs::trace::StackSampler::get();
+  sampler.stop();
+  sampler.dump();
+}
+
+//!
+//! Hashes the frames of a stack (FNV-1a, followed by the finalizer of
+//! SplitMix64 so similar stacks don't land in neighboring slots).
+//!
+static std::uint64_t hash_frames(const std::uint32_t* frames,
+  std::uint32_t depth) noexcept
+{
+  std::uint64_t hash = 0xcbf29ce484222325ull;
+  for (std::uint32_t index = 0; index < depth; ++index)
+  {
+    hash = (hash ^ frames[index]) * 0x100000001b3ull;
+  }
+
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+  return hash ^ (hash >> 31);
+}
+
+struct Stack
+{
+  const std::uint32_t* Frames;
+  std::uint32_t Depth;
+  std::uint64_t Count;
+};
+
+static void print_function(std::FILE* file, jvs::trace::Runtime& runtime,
+  std::uint32_t functionId)
+{
+  if (const char* name = runtime.function_name(functionId))
+  {
+    std::fputs(name, file);
+  }
+  else
+  {
+    std::fprintf(file, "<function %u>", functionId);
+  }
+}
+
+#if !defined(_WIN32)
+// Whether the sampling timer is armed, so stop() doesn't disarm a timer the
+// program set itself.
+std::atomic<bool> TimerArmed{false};
+
+static void handle_sample_signal(int)
+{
+  int savedErrno = errno;
+  jvs::trace::StackSampler::get().sample();
+  errno = savedErrno;
+}
+
+static unsigned long get_sample_rate()
+{
+  const char* rateText = std::getenv("JVS_TRACE_STACKS_HZ");
+  if (!rateText)
+  {
+    return DefaultSampleRate;
+  }
+
+  char* end = nullptr;
+  unsigned long rate = std::strtoul(rateText, &end, 10);
+  if (end == rateText || *end != '\0' || rate == 0 || rate > MaxSampleRate)
+  {
+    std::fprintf(stderr, "function-name-trace: invalid JVS_TRACE_STACKS_HZ "
+      "'%s'\n", rateText);
+    return DefaultSampleRate;
+  }
+
+  return rate;
+}
+#endif
+
+} // namespace
+
+
+jvs::trace::StackTable::StackTable()
+  // calloc() leaves the pages untouched until stacks land in them, so the
+  // table only costs the memory it uses.
+  : slots_(static_cast<Slot*>(std::calloc(Capacity, sizeof(Slot)))),
+  frame_pool_(static_cast<std::uint32_t*>(
+    std::calloc(FramePoolSize, sizeof(std::uint32_t))))
+{
+}
+
+jvs::trace::StackTable::~StackTable()
+{
+  std::free(frame_pool_);
+  std::free(slots_);
+}
+
+void jvs::trace::StackTable::record(const std::uint32_t* frames,
+  std::uint32_t depth) noexcept
+{
+  if (!slots_ || !frame_pool_)
+  {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  std::uint64_t hash = hash_frames(frames, depth);
+  if (hash == EmptyHash)
+  {
+    hash = 1;
+  }
+
+  for (std::size_t probe = 0; probe < MaxProbes; ++probe)
+  {
+    Slot& slot = slots_[(hash + probe) & (Capacity - 1)];
+    std::uint64_t slotHash = slot.Hash.load(std::memory_order_relaxed);
+    if (slotHash == EmptyHash &&
+      slot.Hash.compare_exchange_strong(slotHash, hash,
+        std::memory_order_relaxed))
+    {
+      // Copy the frames to the pool and publish their offset (plus one, so
+      // zero means not published). If the pool is full, the slot's samples
+      // are never visible and so count as dropped.
+      std::size_t frameOffset = frame_pool_size_.fetch_add(depth,
+        std::memory_order_relaxed);
+      if (frameOffset + depth <= FramePoolSize)
+      {
+        std::copy(frames, frames + depth, frame_pool_ + frameOffset);
+        slot.Depth.store(depth, std::memory_order_relaxed);
+        slot.FrameOffset.store(static_cast<std::uint32_t>(frameOffset + 1),
+          std::memory_order_release);
+      }
+
+      slotHash = hash;
+    }
+
+    if (slotHash == hash)
+    {
+      slot.Count.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+
+  dropped_.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::uint64_t jvs::trace::StackTable::dropped() const noexcept
+{
+  std::uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+  if (!slots_)
+  {
+    return dropped;
+  }
+
+  for (std::size_t index = 0; index < Capacity; ++index)
+  {
+    if (slots_[index].FrameOffset.load(std::memory_order_relaxed) == 0)
+    {
+      dropped += slots_[index].Count.load(std::memory_order_relaxed);
+    }
+  }
+
+  return dropped;
+}
+
+jvs::trace::StackSampler& jvs::trace::StackSampler::get()
+{
+  static StackSampler* sampler = new StackSampler();
+  return *sampler;
+}
+
+jvs::trace::StackSampler::StackSampler()
+{
+  std::atexit(&dump_profile);
+}
+
+void jvs::trace::StackSampler::start()
+{
+  std::call_once(started_, []
+    {
+#if !defined(_WIN32)
+      // Leave the signal alone if the program already uses it.
+      struct sigaction oldAction{};
+      if (sigaction(SIGPROF, nullptr, &oldAction) != 0 ||
+        oldAction.sa_handler != SIG_DFL)
+      {
+        std::fprintf(stderr, "function-name-trace: SIGPROF is already "
+          "handled, so stacks won't be sampled\n");
+        return;
+      }
+
+      struct sigaction action{};
+      action.sa_handler = &handle_sample_signal;
+      action.sa_flags = SA_RESTART;
+      sigemptyset(&action.sa_mask);
+      sigaction(SIGPROF, &action, nullptr);
+
+      unsigned long period = 1000000 / get_sample_rate();
+      struct itimerval timer{};
+      timer.it_interval.tv_sec = static_cast<time_t>(period / 1000000);
+      timer.it_interval.tv_usec = static_cast<suseconds_t>(period % 1000000);
+      timer.it_value = timer.it_interval;
+      if (setitimer(ITIMER_PROF, &timer, nullptr) == 0)
+      {
+        TimerArmed.store(true, std::memory_order_relaxed);
+      }
+#endif
+    });
+}
+
+void jvs::trace::StackSampler::stop()
+{
+#if !defined(_WIN32)
+  if (TimerArmed.exchange(false, std::memory_order_relaxed))
+  {
+    struct itimerval timer{};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+  }
+#endif
+}
+
+void jvs::trace::StackSampler::sample() noexcept
+{
+  // The instrumented code stores the frames before the depth covering them,
+  // and the handler runs on the same thread, so a signal fence is enough.
+  std::uint32_t depth =
+    reinterpret_cast<std::atomic<std::uint32_t>&>(
+      __jvs_trace_shadow_stack.depth).load(std::memory_order_relaxed);
+  std::atomic_signal_fence(std::memory_order_acquire);
+  if (depth == 0)
+  {
+    unknown_samples_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  // Frames deeper than the stack went to the scratch frame, and are lost.
+  table_.record(__jvs_trace_shadow_stack.frames,
+    std::min<std::uint32_t>(depth, JVS_TRACE_SHADOW_STACK_SIZE - 1));
+}
+
+void jvs::trace::StackSampler::dump()
+{
+  std::lock_guard<std::mutex> lock(dump_mutex_);
+  std::vector<Stack> stacks{};
+  table_.for_each(
+    [&stacks](const std::uint32_t* frames, std::uint32_t depth,
+      std::uint64_t count)
+    {
+      stacks.push_back({frames, depth, count});
+    });
+  std::sort(stacks.begin(), stacks.end(),
+    [](const Stack& lhs, const Stack& rhs)
+    {
+      return lhs.Count > rhs.Count;
+    });
+
+  std::string path = get_output_path("JVS_TRACE_STACKS", "pseudo-stacks",
+    "txt");
+  std::FILE* file = std::fopen(path.c_str(), "w");
+  if (!file)
+  {
+    std::fprintf(stderr, "function-name-trace: unable to create '%s'\n",
+      path.c_str());
+    return;
+  }
+
+  // The folded format has no room for comments, so the dropped samples are
+  // reported on stderr instead.
+  if (std::uint64_t dropped = table_.dropped())
+  {
+    std::fprintf(stderr, "function-name-trace: %llu stack samples dropped "
+      "because the stack table was full\n",
+      static_cast<unsigned long long>(dropped));
+  }
+
+  Runtime& runtime = Runtime::get();
+  for (const Stack& stack : stacks)
+  {
+    for (std::uint32_t index = 0; index < stack.Depth; ++index)
+    {
+      if (index != 0)
+      {
+        std::fputc(';', file);
+      }
+
+      print_function(file, runtime, stack.Frames[index]);
+    }
+
+    std::fprintf(file, " %llu\n", static_cast<unsigned long long>(stack.Count));
+  }
+
+  if (std::uint64_t unknownSamples =
+    unknown_samples_.load(std::memory_order_relaxed))
+  {
+    std::fprintf(file, "<unknown> %llu\n",
+      static_cast<unsigned long long>(unknownSamples));
+  }
+
+  std::fclose(file);
+}
+
+
+void __jvs_trace_dump_stacks(void)
+{
+  jvs::trace::StackSampler::get().dump();
+}
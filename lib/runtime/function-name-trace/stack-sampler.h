@@ -0,0 +1,147 @@
+#if !defined(JVS_PSEUDO_PASSES_RUNTIME_STACK_SAMPLER_H_)
+#define JVS_PSEUDO_PASSES_RUNTIME_STACK_SAMPLER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace jvs
+{
+namespace trace
+{
+
+//!
+//! Lock-free table counting the samples of each distinct stack.
+//!
+//! It's filled from a signal handler, so it never allocates or locks: a new
+//! stack claims a slot (found by the hash of its frames) with a compare and
+//! swap, and then a run of a preallocated frame pool, into which it copies
+//! its frames before publishing them. Stacks are identified by their 64 bit
+//! hash alone. Neither the table nor the pool grows, so once either is full,
+//! the samples of new stacks are counted as dropped instead.
+//!
+class StackTable
+{
+public:
+  static constexpr std::size_t Capacity = std::size_t{1} << 16;
+  static constexpr std::size_t MaxProbes = 64;
+  static constexpr std::size_t FramePoolSize = std::size_t{1} << 22;
+
+  StackTable();
+  StackTable(const StackTable&) = delete;
+  StackTable& operator=(const StackTable&) = delete;
+  ~StackTable();
+
+  //!
+  //! Adds a sample of the stack made of the given frames, outermost first.
+  //! Async-signal-safe.
+  //!
+  void record(const std::uint32_t* frames, std::uint32_t depth) noexcept;
+
+  //!
+  //! Calls `visit(frames, depth, count)` for every stack sampled.
+  //!
+  template <typename VisitFunction>
+  void for_each(VisitFunction&& visit) const
+  {
+    if (!slots_ || !frame_pool_)
+    {
+      return;
+    }
+
+    for (std::size_t index = 0; index < Capacity; ++index)
+    {
+      const Slot& slot = slots_[index];
+      std::uint64_t count = slot.Count.load(std::memory_order_relaxed);
+      // See record() for the encoding of the frames' offset.
+      std::uint32_t frameOffset =
+        slot.FrameOffset.load(std::memory_order_acquire);
+      if (count != 0 && frameOffset != 0)
+      {
+        visit(frame_pool_ + frameOffset - 1,
+          slot.Depth.load(std::memory_order_relaxed), count);
+      }
+    }
+  }
+
+  //!
+  //! Gets the number of samples which weren't recorded, including those of
+  //! stacks whose frames are still being published.
+  //!
+  std::uint64_t dropped() const noexcept;
+
+private:
+  static constexpr std::uint64_t EmptyHash = 0;
+
+  struct Slot
+  {
+    std::atomic<std::uint64_t> Hash;
+    std::atomic<std::uint64_t> Count;
+    std::atomic<std::uint32_t> FrameOffset;
+    std::atomic<std::uint32_t> Depth;
+  };
+
+  Slot* slots_;
+  std::uint32_t* frame_pool_;
+  std::atomic<std::size_t> frame_pool_size_{0};
+  std::atomic<std::uint64_t> dropped_{0};
+};
+
+//!
+//! Process-wide stack profile of code instrumented with
+//! `function-name-trace<stacks>`.
+//!
+//! Once the first such module registers, a SIGPROF timer (setitimer()'s
+//! ITIMER_PROF, so it ticks with the CPU time the process uses) interrupts
+//! whichever thread is running `$JVS_TRACE_STACKS_HZ` (997 by default) times
+//! a second, and the handler adds the thread's shadow stack to a StackTable.
+//! The sampler isn't started if the program handles SIGPROF itself, and isn't
+//! available on Windows.
+//!
+//! The samples are written to `$JVS_TRACE_STACKS` (`pseudo-stacks.<pid>.txt`
+//! by default) at exit and when __jvs_trace_dump_stacks() is called, in the
+//! "folded" format read by flamegraph.pl, speedscope and the like: one line
+//! per stack, with the (mangled) names of its functions, outermost first,
+//! separated by semicolons and followed by the number of samples. Samples
+//! taken outside any instrumented function have the stack `<unknown>`.
+//!
+class StackSampler
+{
+public:
+  static StackSampler& get();
+
+  StackSampler(const StackSampler&) = delete;
+  StackSampler& operator=(const StackSampler&) = delete;
+
+  //!
+  //! Starts sampling, unless it already has been.
+  //!
+  void start();
+
+  //!
+  //! Stops sampling, so the profile stops changing.
+  //!
+  void stop();
+
+  //!
+  //! Samples the calling thread's shadow stack. Async-signal-safe.
+  //!
+  void sample() noexcept;
+
+  void dump();
+
+private:
+  StackSampler();
+
+  std::once_flag started_{};
+  std::mutex dump_mutex_{};
+  StackTable table_{};
+  std::atomic<std::uint64_t> unknown_samples_{0};
+};
+
+} // namespace trace
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_RUNTIME_STACK_SAMPLER_H_
@@ -0,0 +1,78 @@
+#if !defined(JVS_PSEUDO_PASSES_RUNTIME_TRACE_CLOCK_H_)
+#define JVS_PSEUDO_PASSES_RUNTIME_TRACE_CLOCK_H_
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || \
+  defined(__i386__)
+#define JVS_TRACE_CLOCK_USES_TSC 1
+#endif
+
+namespace jvs
+{
+namespace trace
+{
+
+//!
+//! Reads the clock used for event timestamps: the time stamp counter where
+//! there is one, and a monotonic nanosecond clock everywhere else.
+//!
+inline std::uint64_t read_clock() noexcept
+{
+#if defined(JVS_TRACE_CLOCK_USES_TSC)
+  return __rdtsc();
+#else
+  return static_cast<std::uint64_t>(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+//!
+//! Measures the rate of read_clock() against std::chrono::steady_clock over
+//! the lifetime of the object, so calibrating never has to stall the process.
+//!
+class ClockCalibration
+{
+public:
+  ClockCalibration() noexcept
+    : start_ticks_(read_clock()),
+    start_time_(std::chrono::steady_clock::now())
+  {
+  }
+
+  std::uint64_t ticks_per_second() const noexcept
+  {
+#if defined(JVS_TRACE_CLOCK_USES_TSC)
+    std::uint64_t ticks = read_clock() - start_ticks_;
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start_time_).count();
+    if (elapsed <= 0)
+    {
+      return 0;
+    }
+
+    return static_cast<std::uint64_t>(
+      static_cast<double>(ticks) * 1e9 / static_cast<double>(elapsed));
+#else
+    return 1000000000;
+#endif
+  }
+
+private:
+  std::uint64_t start_ticks_;
+  std::chrono::steady_clock::time_point start_time_;
+};
+
+} // namespace trace
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_RUNTIME_TRACE_CLOCK_H_
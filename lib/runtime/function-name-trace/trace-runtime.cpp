@@ -0,0 +1,485 @@
+#include "trace-runtime.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "call-counts.h"
+#include "output-path.h"
+#include "stack-sampler.h"
+
+namespace
+{
+
+// Instrumented code reads the enable word, the flags and lazily registered
+// base IDs with relaxed atomic loads, so they're written with relaxed atomic
+// stores.
+static void store_flag(std::uint32_t& flag, std::uint32_t value)
+{
+  reinterpret_cast<std::atomic<std::uint32_t>&>(flag).store(value,
+    std::memory_order_relaxed);
+}
+
+static void store_flag(std::uint8_t& flag, std::uint8_t value)
+{
+  reinterpret_cast<std::atomic<std::uint8_t>&>(flag).store(value,
+    std::memory_order_relaxed);
+}
+
+static std::uint32_t load_flag(std::uint32_t& flag)
+{
+  return reinterpret_cast<std::atomic<std::uint32_t>&>(flag).load(
+    std::memory_order_relaxed);
+}
+
+// How often the flusher thread drains the event buffers.
+static constexpr std::chrono::milliseconds FlushInterval{10};
+
+// How much of the trace file the flusher keeps ready for writing ahead of the
+// data, so draining a full buffer doesn't stop on page faults.
+static constexpr std::size_t PrefaultSize = std::size_t{4} << 20;
+
+static void shutdown_runtime()
+{
+  jvs::trace::Runtime::get().shutdown();
+}
+
+// The calling thread's event buffer. Kept separate from ThreadBufferOwner so
+// the hot path only reads a trivially-initialized thread local.
+thread_local jvs::trace::EventBuffer* ThreadEventBuffer{nullptr};
+thread_local bool ThreadExited{false};
+
+} // namespace
+
+namespace jvs
+{
+namespace trace
+{
+
+//!
+//! Hands the thread's event buffer back to the runtime when the thread exits.
+//!
+struct ThreadBufferOwner
+{
+  ~ThreadBufferOwner()
+  {
+    if (ThreadEventBuffer)
+    {
+      Runtime::get().retire_thread_buffer(ThreadEventBuffer);
+    }
+
+    // Anything traced from here on (e.g. by other thread local destructors)
+    // is dropped.
+    ThreadEventBuffer = nullptr;
+    ThreadExited = true;
+  }
+};
+
+} // namespace trace
+} // namespace jvs
+
+namespace
+{
+
+static void record_event(std::uint32_t functionId,
+  jvs_trace_event_kind kind) noexcept
+{
+  jvs::trace::Runtime& runtime = jvs::trace::Runtime::get();
+  if (jvs::trace::EventBuffer* buffer = runtime.thread_buffer())
+  {
+    if (buffer->push({jvs::trace::read_clock(), functionId,
+      static_cast<std::uint32_t>(kind)}))
+    {
+      runtime.wake_flusher();
+    }
+  }
+}
+
+static void print_function(const char* format, std::uint32_t functionId)
+{
+  if (const char* name = jvs::trace::Runtime::get().function_name(functionId))
+  {
+    std::printf(format, name);
+  }
+  else
+  {
+    std::string unknownName = "<function " + std::to_string(functionId) + ">";
+    std::printf(format, unknownName.c_str());
+  }
+}
+
+} // namespace
+
+
+jvs::trace::Runtime& jvs::trace::Runtime::get()
+{
+  static Runtime* runtime = new Runtime();
+  return *runtime;
+}
+
+jvs::trace::Runtime::Runtime()
+{
+  const char* enabled = std::getenv("JVS_TRACE_ENABLED");
+  if (enabled && std::strcmp(enabled, "0") != 0)
+  {
+    store_flag(__jvs_trace_enabled, 1);
+  }
+
+  std::atexit(&shutdown_runtime);
+}
+
+void jvs::trace::Runtime::register_module(jvs_trace_module& module)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  add_module(module);
+}
+
+std::uint32_t jvs::trace::Runtime::register_lazily(jvs_trace_module& module)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (load_flag(module.base_id) == JVS_TRACE_UNREGISTERED)
+  {
+    add_module(module);
+  }
+
+  return load_flag(module.base_id);
+}
+
+const char* jvs::trace::Runtime::function_name(std::uint32_t functionId)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  const jvs_trace_module* module = find_module(functionId);
+  if (!module)
+  {
+    return nullptr;
+  }
+
+  std::uint32_t localId = functionId - module->base_id;
+  return module->name_table + module->name_offsets[localId];
+}
+
+std::uint32_t jvs::trace::Runtime::set_function_enabled(const char* name,
+  bool enabled)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::uint32_t count = 0;
+  for (const jvs_trace_module* module : modules_)
+  {
+    if (!module->function_enabled)
+    {
+      continue;
+    }
+
+    for (std::uint32_t localId = 0; localId < module->function_count;
+      ++localId)
+    {
+      if (std::strcmp(module->name_table + module->name_offsets[localId],
+        name) == 0)
+      {
+        store_flag(module->function_enabled[localId], enabled ? 1 : 0);
+        ++count;
+      }
+    }
+  }
+
+  return count;
+}
+
+bool jvs::trace::Runtime::set_function_enabled(std::uint32_t functionId,
+  bool enabled)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  const jvs_trace_module* module = find_module(functionId);
+  if (!module || !module->function_enabled)
+  {
+    return false;
+  }
+
+  store_flag(module->function_enabled[functionId - module->base_id],
+    enabled ? 1 : 0);
+  return true;
+}
+
+jvs::trace::EventBuffer* jvs::trace::Runtime::thread_buffer()
+{
+  if (ThreadEventBuffer)
+  {
+    return ThreadEventBuffer;
+  }
+
+  if (ThreadExited)
+  {
+    return nullptr;
+  }
+
+  thread_local ThreadBufferOwner owner{};
+  ThreadEventBuffer = create_thread_buffer();
+  return ThreadEventBuffer;
+}
+
+void jvs::trace::Runtime::flush()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  drain_buffers(lock);
+  writer_.flush();
+}
+
+void jvs::trace::Runtime::wake_flusher() noexcept
+{
+  flusher_wakeup_.notify_one();
+}
+
+void jvs::trace::Runtime::dump_call_counts()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (std::none_of(modules_.begin(), modules_.end(),
+    [](const jvs_trace_module* module) { return module->call_counts; }))
+  {
+    return;
+  }
+
+  std::string path = get_output_path("JVS_TRACE_COUNTS", "pseudo-counts",
+    "bin");
+  if (!write_call_counts(path, modules_))
+  {
+    std::fprintf(stderr, "function-name-trace: unable to write '%s'\n",
+      path.c_str());
+  }
+}
+
+void jvs::trace::Runtime::shutdown()
+{
+  dump_call_counts();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (shut_down_ || !recording_)
+    {
+      shut_down_ = true;
+      return;
+    }
+
+    stopping_ = true;
+  }
+
+  flusher_wakeup_.notify_one();
+  if (flusher_.joinable())
+  {
+    flusher_.join();
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  drain_buffers(lock);
+  writer_.write_clock(clock_calibration_.ticks_per_second());
+  writer_.close();
+  shut_down_ = true;
+}
+
+void jvs::trace::Runtime::add_module(jvs_trace_module& module)
+{
+  if (module.version != JVS_TRACE_ABI_VERSION)
+  {
+    std::fprintf(stderr, "function-name-trace: ignoring module built for "
+      "runtime version %u\n", module.version);
+    // Keep lazily registered modules from trying again on every call.
+    store_flag(module.base_id, 0);
+    return;
+  }
+
+  store_flag(module.base_id, next_function_id_);
+  next_function_id_ += module.function_count;
+  modules_.push_back(&module);
+  if (recording_)
+  {
+    writer_.write_module(module);
+  }
+
+  if (module.flags & JVS_TRACE_MODULE_SHADOW_STACK)
+  {
+    StackSampler::get().start();
+  }
+}
+
+const jvs_trace_module* jvs::trace::Runtime::find_module(
+  std::uint32_t functionId) const
+{
+  auto moduleIter = std::upper_bound(modules_.begin(), modules_.end(),
+    functionId,
+    [](std::uint32_t id, const jvs_trace_module* module)
+    {
+      return id < module->base_id;
+    });
+  if (moduleIter == modules_.begin())
+  {
+    return nullptr;
+  }
+
+  const jvs_trace_module* module = *(moduleIter - 1);
+  if (functionId - module->base_id >= module->function_count)
+  {
+    return nullptr;
+  }
+
+  return module;
+}
+
+void jvs::trace::Runtime::start_recording()
+{
+  std::string path = get_output_path("JVS_TRACE_FILE", "pseudo-trace", "bin");
+  if (!writer_.open(path))
+  {
+    std::fprintf(stderr, "function-name-trace: unable to create '%s'\n",
+      path.c_str());
+  }
+
+  for (const jvs_trace_module* module : modules_)
+  {
+    writer_.write_module(*module);
+  }
+
+  recording_ = true;
+  flusher_ = std::thread([this] { run_flusher(); });
+}
+
+jvs::trace::EventBuffer* jvs::trace::Runtime::create_thread_buffer()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (shut_down_)
+  {
+    return nullptr;
+  }
+
+  if (!recording_)
+  {
+    start_recording();
+  }
+
+  auto buffer = std::make_unique<EventBuffer>(next_thread_id_++);
+  EventBuffer* result = buffer.get();
+  buffers_.push_back(ThreadBuffer{std::move(buffer), false});
+  return result;
+}
+
+void jvs::trace::Runtime::retire_thread_buffer(EventBuffer* buffer)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (ThreadBuffer& threadBuffer : buffers_)
+  {
+    if (threadBuffer.Buffer.get() == buffer)
+    {
+      threadBuffer.Retired = true;
+      break;
+    }
+  }
+}
+
+void jvs::trace::Runtime::run_flusher()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_)
+  {
+    flusher_wakeup_.wait_for(lock, FlushInterval);
+    drain_buffers(lock);
+  }
+}
+
+void jvs::trace::Runtime::drain_buffers(
+  const std::unique_lock<std::mutex>&)
+{
+  for (ThreadBuffer& threadBuffer : buffers_)
+  {
+    threadBuffer.Buffer->drain(
+      [this](std::uint64_t threadId, std::uint64_t dropped,
+        const jvs_trace_event* first, std::size_t firstCount,
+        const jvs_trace_event* second, std::size_t secondCount)
+      {
+        writer_.write_events(threadId, dropped, first, firstCount, second,
+          secondCount);
+      });
+  }
+
+  // A retired buffer's thread has exited, so once it's been drained nothing
+  // will ever write to it again.
+  for (auto it = buffers_.begin(); it != buffers_.end(); )
+  {
+    it = it->Retired ? buffers_.erase(it) : it + 1;
+  }
+
+  writer_.prefault(PrefaultSize);
+}
+
+
+uint32_t __jvs_trace_enabled = 0;
+
+namespace
+{
+
+// Creating the runtime applies JVS_TRACE_ENABLED. Guarded functions in lazily
+// registered modules check the enable word before they register, so nothing
+// would create it until tracing was enabled some other way.
+[[maybe_unused]] jvs::trace::Runtime& EarlyRuntime =
+  jvs::trace::Runtime::get();
+
+} // namespace
+
+void __jvs_trace_register_module(jvs_trace_module* module)
+{
+  jvs::trace::Runtime::get().register_module(*module);
+}
+
+uint32_t __jvs_trace_register_lazily(jvs_trace_module* module)
+{
+  return jvs::trace::Runtime::get().register_lazily(*module);
+}
+
+void __jvs_trace_enter(uint32_t function_id)
+{
+  record_event(function_id, JVS_TRACE_EVENT_ENTER);
+}
+
+void __jvs_trace_exit(uint32_t function_id)
+{
+  record_event(function_id, JVS_TRACE_EVENT_EXIT);
+}
+
+void __jvs_trace_print_enter(uint32_t function_id)
+{
+  print_function("\n[>] Entering %s\n\n", function_id);
+}
+
+void __jvs_trace_print_exit(uint32_t function_id)
+{
+  print_function("\n[<] Leaving %s\n\n", function_id);
+}
+
+void __jvs_trace_flush(void)
+{
+  jvs::trace::Runtime::get().flush();
+}
+
+void __jvs_trace_dump_counts(void)
+{
+  jvs::trace::Runtime::get().dump_call_counts();
+}
+
+void __jvs_trace_set_enabled(int enabled)
+{
+  // Make sure the runtime has read JVS_TRACE_ENABLED, so it can't override
+  // this later.
+  jvs::trace::Runtime::get();
+  store_flag(__jvs_trace_enabled, enabled ? 1 : 0);
+}
+
+uint32_t __jvs_trace_set_function_enabled(const char* name, int enabled)
+{
+  return jvs::trace::Runtime::get().set_function_enabled(name, enabled != 0);
+}
+
+int __jvs_trace_set_function_id_enabled(uint32_t function_id, int enabled)
+{
+  return jvs::trace::Runtime::get().set_function_enabled(function_id,
+    enabled != 0) ? 1 : 0;
+}
@@ -0,0 +1,149 @@
+#if !defined(JVS_PSEUDO_PASSES_RUNTIME_TRACE_RUNTIME_H_)
+#define JVS_PSEUDO_PASSES_RUNTIME_TRACE_RUNTIME_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "runtime/function-name-trace.h"
+
+#include "event-buffer.h"
+#include "trace-clock.h"
+#include "trace-writer.h"
+
+namespace jvs
+{
+namespace trace
+{
+
+//!
+//! Process-wide state of the trace runtime: the registered modules, the event
+//! buffer of every thread and the background thread flushing them to the
+//! trace file.
+//!
+//! The trace file and the flusher thread are only created once the first
+//! event is recorded, so programs instrumented to print their trace (see
+//! FunctionNameTraceMode::TextIds) don't leave an empty trace file behind.
+//!
+//! The runtime is created when the first module registers and is never
+//! destroyed, so instrumented code running during static destruction can't
+//! touch freed state. The trace file is finalized from an atexit() handler
+//! instead.
+//!
+class Runtime
+{
+public:
+  static Runtime& get();
+
+  Runtime(const Runtime&) = delete;
+  Runtime& operator=(const Runtime&) = delete;
+
+  void register_module(jvs_trace_module& module);
+
+  //!
+  //! Registers the given module unless it already has been.
+  //!
+  //! @returns
+  //!   The module's base ID.
+  //!
+  std::uint32_t register_lazily(jvs_trace_module& module);
+
+  //!
+  //! Looks up the name of the function with the given ID.
+  //!
+  //! @returns
+  //!   The name, or null if no registered module has a function with the ID.
+  //!
+  const char* function_name(std::uint32_t functionId);
+
+  //!
+  //! Sets the enable flag of every guarded function with the given name.
+  //!
+  //! @returns
+  //!   The number of functions found.
+  //!
+  std::uint32_t set_function_enabled(const char* name, bool enabled);
+
+  //!
+  //! Sets the enable flag of the guarded function with the given ID.
+  //!
+  //! @returns
+  //!   Whether the function was found.
+  //!
+  bool set_function_enabled(std::uint32_t functionId, bool enabled);
+
+  //!
+  //! Gets the event buffer of the calling thread, creating it if needed.
+  //!
+  //! @returns
+  //!   The buffer, or null if the thread is exiting and has already released
+  //!   it.
+  //!
+  EventBuffer* thread_buffer();
+
+  //!
+  //! Writes every event recorded so far to the trace file.
+  //!
+  void flush();
+
+  //!
+  //! Asks the flusher thread to drain the event buffers now rather than at
+  //! its next interval.
+  //!
+  void wake_flusher() noexcept;
+
+  //!
+  //! Writes the call counts of the modules instrumented with
+  //! `function-name-trace<counts>` to `$JVS_TRACE_COUNTS`
+  //! (`pseudo-counts.<pid>.bin` by default), if there are any.
+  //!
+  void dump_call_counts();
+
+  //!
+  //! Stops the flusher thread, finalizes the trace file and writes the call
+  //! counts.
+  //!
+  void shutdown();
+
+private:
+  struct ThreadBuffer
+  {
+    std::unique_ptr<EventBuffer> Buffer;
+    bool Retired;
+  };
+
+  Runtime();
+
+  void add_module(jvs_trace_module& module);
+  const jvs_trace_module* find_module(std::uint32_t functionId) const;
+  void start_recording();
+  EventBuffer* create_thread_buffer();
+  void retire_thread_buffer(EventBuffer* buffer);
+  void run_flusher();
+  void drain_buffers(const std::unique_lock<std::mutex>& lock);
+
+  std::mutex mutex_{};
+  std::condition_variable flusher_wakeup_{};
+  bool stopping_{false};
+  bool shut_down_{false};
+  bool recording_{false};
+  std::uint32_t next_function_id_{0};
+  std::uint64_t next_thread_id_{0};
+  // Sorted by base ID, since IDs are assigned in registration order.
+  std::vector<const jvs_trace_module*> modules_{};
+  std::vector<ThreadBuffer> buffers_{};
+  ClockCalibration clock_calibration_{};
+  TraceWriter writer_{};
+  std::thread flusher_{};
+
+  friend struct ThreadBufferOwner;
+};
+
+} // namespace trace
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_RUNTIME_TRACE_RUNTIME_H_
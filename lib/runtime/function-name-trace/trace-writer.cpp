@@ -0,0 +1,94 @@
+#include "trace-writer.h"
+
+#include <cstring>
+
+jvs::trace::TraceWriter::~TraceWriter()
+{
+  close();
+}
+
+bool jvs::trace::TraceWriter::open(const std::string& path)
+{
+  close();
+  if (!file_.open(path))
+  {
+    return false;
+  }
+
+  jvs_trace_file_header header{};
+  std::memcpy(header.magic, JVS_TRACE_FILE_MAGIC, sizeof(header.magic));
+  header.version = JVS_TRACE_FILE_VERSION;
+  write(&header, sizeof(header));
+  return true;
+}
+
+void jvs::trace::TraceWriter::close()
+{
+  file_.close();
+}
+
+void jvs::trace::TraceWriter::flush()
+{
+  file_.flush();
+}
+
+void jvs::trace::TraceWriter::prefault(std::size_t size)
+{
+  file_.prefault(size);
+}
+
+bool jvs::trace::TraceWriter::is_open() const noexcept
+{
+  return file_.is_open();
+}
+
+void jvs::trace::TraceWriter::write_module(const jvs_trace_module& module)
+{
+  std::size_t offsetsSize = module.function_count * sizeof(std::uint32_t);
+  write_chunk_header(JVS_TRACE_CHUNK_MODULE, sizeof(jvs_trace_module_chunk) +
+    offsetsSize + module.name_table_size);
+  jvs_trace_module_chunk chunk{module.base_id, module.function_count,
+    module.name_table_size, 0};
+  write(&chunk, sizeof(chunk));
+  write(module.name_offsets, offsetsSize);
+  write(module.name_table, module.name_table_size);
+}
+
+void jvs::trace::TraceWriter::write_events(std::uint64_t threadId,
+  std::uint64_t dropped, const jvs_trace_event* first, std::size_t firstCount,
+  const jvs_trace_event* second, std::size_t secondCount)
+{
+  write_chunk_header(JVS_TRACE_CHUNK_EVENTS, sizeof(jvs_trace_events_chunk) +
+    (firstCount + secondCount) * sizeof(jvs_trace_event));
+  jvs_trace_events_chunk chunk{threadId, dropped};
+  write(&chunk, sizeof(chunk));
+  write(first, firstCount * sizeof(jvs_trace_event));
+  write(second, secondCount * sizeof(jvs_trace_event));
+}
+
+void jvs::trace::TraceWriter::write_clock(std::uint64_t ticksPerSecond)
+{
+  write_chunk_header(JVS_TRACE_CHUNK_CLOCK, sizeof(jvs_trace_clock_chunk));
+  jvs_trace_clock_chunk chunk{ticksPerSecond};
+  write(&chunk, sizeof(chunk));
+}
+
+void jvs::trace::TraceWriter::write_chunk_header(jvs_trace_chunk_type type,
+  std::uint64_t size)
+{
+  jvs_trace_chunk_header header{static_cast<std::uint32_t>(type), 0, size};
+  write(&header, sizeof(header));
+}
+
+void jvs::trace::TraceWriter::write(const void* data, std::size_t size)
+{
+  if (size == 0)
+  {
+    return;
+  }
+
+  if (void* destination = file_.append(size))
+  {
+    std::memcpy(destination, data, size);
+  }
+}
@@ -0,0 +1,62 @@
+#if !defined(JVS_PSEUDO_PASSES_RUNTIME_TRACE_WRITER_H_)
+#define JVS_PSEUDO_PASSES_RUNTIME_TRACE_WRITER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "runtime/function-name-trace.h"
+
+#include "mapped-file.h"
+
+namespace jvs
+{
+namespace trace
+{
+
+//!
+//! Writes the chunks making up a binary trace file (see
+//! runtime/function-name-trace.h). Not thread safe; the runtime serializes
+//! all access to it.
+//!
+class TraceWriter
+{
+public:
+  TraceWriter() = default;
+  TraceWriter(const TraceWriter&) = delete;
+  TraceWriter& operator=(const TraceWriter&) = delete;
+  ~TraceWriter();
+
+  //!
+  //! Creates the trace file and writes its header.
+  //!
+  bool open(const std::string& path);
+  void close();
+  void flush();
+
+  //!
+  //! Prepares the next `size` bytes of the file for writing (see
+  //! MappedFile::prefault()).
+  //!
+  void prefault(std::size_t size);
+
+  bool is_open() const noexcept;
+
+  void write_module(const jvs_trace_module& module);
+  void write_events(std::uint64_t threadId, std::uint64_t dropped,
+    const jvs_trace_event* first, std::size_t firstCount,
+    const jvs_trace_event* second, std::size_t secondCount);
+  void write_clock(std::uint64_t ticksPerSecond);
+
+private:
+  void write_chunk_header(jvs_trace_chunk_type type, std::uint64_t size);
+  void write(const void* data, std::size_t size);
+
+  MappedFile file_{};
+};
+
+} // namespace trace
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_RUNTIME_TRACE_WRITER_H_
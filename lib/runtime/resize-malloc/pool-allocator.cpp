@@ -0,0 +1,384 @@
+#include "pool-allocator.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+
+// Blocks a thread keeps on its free list of each size class before handing
+// them to the shared list, and the most it takes back from there at once.
+static constexpr std::uint32_t MaxCachedBlocks = 1024;
+static constexpr std::uint32_t RefillBatchSize = 256;
+
+// Maps (size + 7) / 8 to the index of the smallest size class fitting size.
+struct SizeClassTable
+{
+  std::uint8_t Indices[JVS_POOL_MAX_SIZE / 8 + 1];
+};
+
+static constexpr SizeClassTable make_size_class_table() noexcept
+{
+  SizeClassTable table{};
+  std::size_t sizeClass = 0;
+  for (std::size_t index = 0; index <= JVS_POOL_MAX_SIZE / 8; ++index)
+  {
+    while (jvs::pool::ClassSizes[sizeClass] < index * 8)
+    {
+      ++sizeClass;
+    }
+
+    table.Indices[index] = static_cast<std::uint8_t>(sizeClass);
+  }
+
+  return table;
+}
+
+static constexpr SizeClassTable SizeClasses = make_size_class_table();
+
+// The calling thread's cache. Kept separate from ThreadCacheOwner so the hot
+// paths only touch trivially-initialized thread locals.
+thread_local jvs::pool::ThreadCache Cache{};
+
+enum class CacheState : std::uint8_t
+{
+  Unowned,
+  Owned,
+  Released
+};
+
+thread_local CacheState ThreadCacheState{CacheState::Unowned};
+
+//!
+//! Hands the thread's cached blocks to the shared free lists when the thread
+//! exits.
+//!
+struct ThreadCacheOwner
+{
+  ~ThreadCacheOwner()
+  {
+    jvs::pool::PoolAllocator::get().release_all(Cache);
+    ThreadCacheState = CacheState::Released;
+  }
+};
+
+//!
+//! Makes sure the thread's cache is handed back when the thread exits.
+//!
+//! @returns
+//!   Whether the thread's cache can be used, which it can't any more once
+//!   the thread's thread local destructors have run.
+//!
+static bool own_thread_cache() noexcept
+{
+  if (ThreadCacheState == CacheState::Unowned)
+  {
+    thread_local ThreadCacheOwner owner{};
+    ThreadCacheState = CacheState::Owned;
+  }
+
+  return ThreadCacheState == CacheState::Owned;
+}
+
+static void* pool_allocate(std::size_t size) noexcept
+{
+  std::size_t sizeClass = jvs::pool::get_size_class(size);
+  if (jvs::pool::FreeBlock* block = Cache.FreeLists[sizeClass])
+  {
+    Cache.FreeLists[sizeClass] = block->Next;
+    --Cache.FreeCounts[sizeClass];
+    return block;
+  }
+
+  std::size_t blockSize = jvs::pool::ClassSizes[sizeClass];
+  char* next = Cache.ChunkNext[sizeClass];
+  if (static_cast<std::size_t>(Cache.ChunkEnd[sizeClass] - next) >= blockSize)
+  {
+    Cache.ChunkNext[sizeClass] = next + blockSize;
+    return next;
+  }
+
+  if (!own_thread_cache())
+  {
+    return nullptr;
+  }
+
+  return jvs::pool::PoolAllocator::get().refill(Cache, sizeClass);
+}
+
+static void pool_deallocate(void* ptr) noexcept
+{
+  if (ThreadCacheState != CacheState::Owned && !own_thread_cache())
+  {
+    jvs::pool::PoolAllocator::get().deallocate_shared(ptr);
+    return;
+  }
+
+  std::size_t sizeClass = jvs::pool::PoolAllocator::get_block_class(ptr);
+  auto* block = static_cast<jvs::pool::FreeBlock*>(ptr);
+  block->Next = Cache.FreeLists[sizeClass];
+  Cache.FreeLists[sizeClass] = block;
+  if (++Cache.FreeCounts[sizeClass] > MaxCachedBlocks)
+  {
+    jvs::pool::PoolAllocator::get().release(Cache, sizeClass);
+  }
+}
+
+} // namespace
+
+
+std::atomic<std::uintptr_t> jvs::pool::PoolAllocator::region_base_{
+  UINTPTR_MAX};
+
+std::size_t jvs::pool::get_size_class(std::size_t size) noexcept
+{
+  return SizeClasses.Indices[(size + 7) / 8];
+}
+
+jvs::pool::PoolAllocator& jvs::pool::PoolAllocator::get()
+{
+  static PoolAllocator* pool = new PoolAllocator();
+  return *pool;
+}
+
+jvs::pool::PoolAllocator::PoolAllocator()
+{
+  // Only address space is reserved here. The pages are committed as chunks
+  // are handed out (by the first touch, outside of Windows).
+#if defined(_WIN32)
+  region_ = static_cast<char*>(
+    VirtualAlloc(nullptr, RegionSize, MEM_RESERVE, PAGE_READWRITE));
+#else
+  void* region = mmap(nullptr, RegionSize, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  region_ = region != MAP_FAILED ? static_cast<char*>(region) : nullptr;
+#endif
+  if (region_)
+  {
+    region_base_.store(reinterpret_cast<std::uintptr_t>(region_),
+      std::memory_order_relaxed);
+  }
+}
+
+void* jvs::pool::PoolAllocator::refill(ThreadCache& cache,
+  std::size_t sizeClass) noexcept
+{
+  if (!region_)
+  {
+    return nullptr;
+  }
+
+  // Take a batch of blocks other threads released, if there are any.
+  SharedFreeList& shared = shared_[sizeClass];
+  {
+    std::lock_guard<std::mutex> lock(shared.Mutex);
+    if (FreeBlock* head = shared.Head)
+    {
+      FreeBlock* tail = head;
+      std::uint32_t count = 1;
+      while (count < RefillBatchSize && tail->Next)
+      {
+        tail = tail->Next;
+        ++count;
+      }
+
+      shared.Head = tail->Next;
+      shared.Count -= count;
+      tail->Next = nullptr;
+      cache.FreeLists[sizeClass] = head->Next;
+      cache.FreeCounts[sizeClass] = count - 1;
+      return head;
+    }
+  }
+
+  // Otherwise carve blocks out of a new chunk. A full span stays full, so the
+  // size class falls back to malloc() from then on.
+  std::size_t offset = span_used_[sizeClass].fetch_add(ChunkSize,
+    std::memory_order_relaxed);
+  if (offset > SpanSize - ChunkSize)
+  {
+    return nullptr;
+  }
+
+  char* chunk = region_ + sizeClass * SpanSize + offset;
+#if defined(_WIN32)
+  if (!VirtualAlloc(chunk, ChunkSize, MEM_COMMIT, PAGE_READWRITE))
+  {
+    return nullptr;
+  }
+#endif
+
+  std::size_t blockSize = ClassSizes[sizeClass];
+  cache.ChunkNext[sizeClass] = chunk + blockSize;
+  cache.ChunkEnd[sizeClass] = chunk + ChunkSize;
+  return chunk;
+}
+
+void jvs::pool::PoolAllocator::release(ThreadCache& cache,
+  std::size_t sizeClass) noexcept
+{
+  FreeBlock* head = cache.FreeLists[sizeClass];
+  if (!head)
+  {
+    return;
+  }
+
+  FreeBlock* tail = head;
+  while (tail->Next)
+  {
+    tail = tail->Next;
+  }
+
+  push_shared(sizeClass, head, tail, cache.FreeCounts[sizeClass]);
+  cache.FreeLists[sizeClass] = nullptr;
+  cache.FreeCounts[sizeClass] = 0;
+}
+
+void jvs::pool::PoolAllocator::release_all(ThreadCache& cache) noexcept
+{
+  for (std::size_t sizeClass = 0; sizeClass < SizeClassCount; ++sizeClass)
+  {
+    // Blocks never carved from the chunk are freed too, so they're not lost.
+    std::size_t blockSize = ClassSizes[sizeClass];
+    char* next = cache.ChunkNext[sizeClass];
+    while (static_cast<std::size_t>(cache.ChunkEnd[sizeClass] - next) >=
+      blockSize)
+    {
+      auto* block = reinterpret_cast<FreeBlock*>(next);
+      block->Next = cache.FreeLists[sizeClass];
+      cache.FreeLists[sizeClass] = block;
+      ++cache.FreeCounts[sizeClass];
+      next += blockSize;
+    }
+
+    cache.ChunkNext[sizeClass] = nullptr;
+    cache.ChunkEnd[sizeClass] = nullptr;
+    release(cache, sizeClass);
+  }
+}
+
+void jvs::pool::PoolAllocator::deallocate_shared(void* ptr) noexcept
+{
+  auto* block = static_cast<FreeBlock*>(ptr);
+  block->Next = nullptr;
+  push_shared(get_block_class(ptr), block, block, 1);
+}
+
+void jvs::pool::PoolAllocator::push_shared(std::size_t sizeClass,
+  FreeBlock* head, FreeBlock* tail, std::size_t count) noexcept
+{
+  SharedFreeList& shared = shared_[sizeClass];
+  std::lock_guard<std::mutex> lock(shared.Mutex);
+  tail->Next = shared.Head;
+  shared.Head = head;
+  shared.Count += count;
+}
+
+
+void* __jvs_pool_malloc(size_t size)
+{
+  if (size <= JVS_POOL_MAX_SIZE)
+  {
+    if (void* ptr = pool_allocate(size))
+    {
+      return ptr;
+    }
+  }
+
+  return std::malloc(size);
+}
+
+void* __jvs_pool_calloc(size_t count, size_t size)
+{
+  // Products which overflow are left for calloc() to fail.
+  if (size != 0 && count <= JVS_POOL_MAX_SIZE / size)
+  {
+    if (void* ptr = pool_allocate(count * size))
+    {
+      std::memset(ptr, 0, count * size);
+      return ptr;
+    }
+  }
+
+  return std::calloc(count, size);
+}
+
+void* __jvs_pool_new(size_t size)
+{
+  if (size <= JVS_POOL_MAX_SIZE)
+  {
+    if (void* ptr = pool_allocate(size))
+    {
+      return ptr;
+    }
+  }
+
+  return ::operator new(size);
+}
+
+void __jvs_pool_free(void* ptr)
+{
+  if (jvs::pool::PoolAllocator::owns(ptr))
+  {
+    pool_deallocate(ptr);
+    return;
+  }
+
+  std::free(ptr);
+}
+
+void* __jvs_pool_realloc(void* ptr, size_t size)
+{
+  if (!jvs::pool::PoolAllocator::owns(ptr))
+  {
+    return std::realloc(ptr, size);
+  }
+
+  // Blocks are only ever moved to grow them.
+  std::size_t blockSize = jvs::pool::ClassSizes[
+    jvs::pool::PoolAllocator::get_block_class(ptr)];
+  if (size <= blockSize)
+  {
+    return ptr;
+  }
+
+  void* newPtr = __jvs_pool_malloc(size);
+  if (newPtr)
+  {
+    std::memcpy(newPtr, ptr, blockSize);
+    pool_deallocate(ptr);
+  }
+
+  return newPtr;
+}
+
+void __jvs_pool_delete(void* ptr)
+{
+  if (jvs::pool::PoolAllocator::owns(ptr))
+  {
+    pool_deallocate(ptr);
+    return;
+  }
+
+  ::operator delete(ptr);
+}
+
+void __jvs_pool_delete_sized(void* ptr, size_t size)
+{
+  if (jvs::pool::PoolAllocator::owns(ptr))
+  {
+    pool_deallocate(ptr);
+    return;
+  }
+
+  ::operator delete(ptr, size);
+}
@@ -0,0 +1,156 @@
+#if !defined(JVS_PSEUDO_PASSES_RUNTIME_POOL_ALLOCATOR_H_)
+#define JVS_PSEUDO_PASSES_RUNTIME_POOL_ALLOCATOR_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+
+#include "runtime/resize-malloc.h"
+
+namespace jvs
+{
+namespace pool
+{
+
+//!
+//! Block sizes of the pool's size classes. They follow the `size-classes`
+//! rounding of resize-malloc: 8 bytes, multiples of 16 bytes up to 128, and
+//! then four classes per doubling up to JVS_POOL_MAX_SIZE. Every class but
+//! the first is a multiple of 16, so blocks are as aligned as malloc()'s.
+//!
+inline constexpr std::size_t ClassSizes[] = {8, 16, 32, 48, 64, 80, 96, 112,
+  128, 160, 192, 224, 256, 320, 384, 448, 512, 640, 768, 896, 1024};
+inline constexpr std::size_t SizeClassCount = std::size(ClassSizes);
+
+static_assert(ClassSizes[SizeClassCount - 1] == JVS_POOL_MAX_SIZE,
+  "The largest size class has to match JVS_POOL_MAX_SIZE");
+
+//!
+//! Gets the index of the smallest size class fitting `size` bytes, which has
+//! to be at most JVS_POOL_MAX_SIZE.
+//!
+std::size_t get_size_class(std::size_t size) noexcept;
+
+//!
+//! A free block, linked through its first word.
+//!
+struct FreeBlock
+{
+  FreeBlock* Next;
+};
+
+//!
+//! A thread's blocks of each size class: a list of the blocks it freed, and
+//! the unused rest of the last chunk it carved blocks from.
+//!
+struct ThreadCache
+{
+  FreeBlock* FreeLists[SizeClassCount];
+  std::uint32_t FreeCounts[SizeClassCount];
+  char* ChunkNext[SizeClassCount];
+  char* ChunkEnd[SizeClassCount];
+};
+
+//!
+//! Process-wide state of the pool allocator.
+//!
+//! The pool reserves one large region of address space up front, split into
+//! a span per size class, so whether a pointer came from the pool (and its
+//! size class) follows from its address alone. Threads take 64 KiB chunks of
+//! a span at a time and carve them into blocks, which they then recycle
+//! through their own free lists without any locking. Blocks a thread frees
+//! beyond a limit, and all of a thread's blocks once it exits, go to a shared
+//! free list per size class, which threads refill from before taking new
+//! chunks. Memory is never returned to the system.
+//!
+//! If the region can't be reserved, or a span fills up, allocations fall
+//! back to malloc() and friends.
+//!
+class PoolAllocator
+{
+public:
+  static PoolAllocator& get();
+
+  PoolAllocator(const PoolAllocator&) = delete;
+  PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+  //!
+  //! Whether the pool allocated the block `ptr` points to.
+  //!
+  static bool owns(const void* ptr) noexcept
+  {
+    auto address = reinterpret_cast<std::uintptr_t>(ptr);
+    std::uintptr_t base = region_base_.load(std::memory_order_relaxed);
+    return address >= base && address - base < RegionSize;
+  }
+
+  //!
+  //! Gets the size class of a block the pool allocated.
+  //!
+  static std::size_t get_block_class(const void* ptr) noexcept
+  {
+    return (reinterpret_cast<std::uintptr_t>(ptr) -
+      region_base_.load(std::memory_order_relaxed)) >> SpanShift;
+  }
+
+  //!
+  //! Refills an empty cache with blocks of the given size class.
+  //!
+  //! @returns
+  //!   A block, or null if the pool is out of space.
+  //!
+  void* refill(ThreadCache& cache, std::size_t sizeClass) noexcept;
+
+  //!
+  //! Moves the blocks a thread freed of the given size class to the shared
+  //! free list.
+  //!
+  void release(ThreadCache& cache, std::size_t sizeClass) noexcept;
+
+  //!
+  //! Moves every block of an exiting thread to the shared free lists.
+  //!
+  void release_all(ThreadCache& cache) noexcept;
+
+  //!
+  //! Frees a block straight to the shared free list, for threads whose cache
+  //! has already been released.
+  //!
+  void deallocate_shared(void* ptr) noexcept;
+
+private:
+  // Spans of 1 GiB (a lot less on 32 bit targets, where the region competes
+  // for address space).
+  static constexpr unsigned int SpanShift = sizeof(void*) == 8 ? 30 : 22;
+  static constexpr std::size_t SpanSize = std::size_t{1} << SpanShift;
+  static constexpr std::size_t RegionSize = SpanSize * SizeClassCount;
+  static constexpr std::size_t ChunkSize = std::size_t{64} << 10;
+
+  struct SharedFreeList
+  {
+    std::mutex Mutex;
+    FreeBlock* Head{nullptr};
+    std::size_t Count{0};
+  };
+
+  PoolAllocator();
+
+  void push_shared(std::size_t sizeClass, FreeBlock* head, FreeBlock* tail,
+    std::size_t count) noexcept;
+
+  // Start of the region, or UINTPTR_MAX until it's reserved so no pointer
+  // passes owns().
+  static std::atomic<std::uintptr_t> region_base_;
+
+  char* region_{nullptr};
+  SharedFreeList shared_[SizeClassCount]{};
+  std::atomic<std::size_t> span_used_[SizeClassCount]{};
+};
+
+} // namespace pool
+} // namespace jvs
+
+
+#endif // !JVS_PSEUDO_PASSES_RUNTIME_POOL_ALLOCATOR_H_
@@ -0,0 +1,113 @@
+#include "support/call-counts.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "runtime/function-name-trace.h"
+
+namespace
+{
+
+static llvm::Error make_format_error(const char* message)
+{
+  return llvm::createStringError(llvm::inconvertibleErrorCode(),
+    "invalid call count profile: %s", message);
+}
+
+} // namespace
+
+
+llvm::Expected<jvs::CallCounts> jvs::CallCounts::load(llvm::StringRef path)
+{
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+  if (!buffer)
+  {
+    return llvm::createStringError(buffer.getError(),
+      "unable to read call count profile '%s': %s", path.str().c_str(),
+      buffer.getError().message().c_str());
+  }
+
+  return parse((*buffer)->getBuffer());
+}
+
+llvm::Expected<jvs::CallCounts> jvs::CallCounts::parse(llvm::StringRef data)
+{
+  jvs_count_file_header header{};
+  if (data.size() < sizeof(header))
+  {
+    return make_format_error("the header is truncated");
+  }
+
+  std::memcpy(&header, data.data(), sizeof(header));
+  data = data.drop_front(sizeof(header));
+  if (std::memcmp(header.magic, JVS_COUNT_FILE_MAGIC,
+    sizeof(header.magic)) != 0)
+  {
+    return make_format_error("bad magic");
+  }
+
+  if (header.version != JVS_COUNT_FILE_VERSION)
+  {
+    return make_format_error("unsupported version");
+  }
+
+  std::uint64_t recordsSize =
+    std::uint64_t{header.function_count} * sizeof(jvs_count_record);
+  if (data.size() < recordsSize ||
+    data.size() - recordsSize < header.name_table_size)
+  {
+    return make_format_error("the profile is truncated");
+  }
+
+  llvm::StringRef nameTable = data.substr(recordsSize,
+    header.name_table_size);
+  CallCounts callCounts{};
+  callCounts.functions_.reserve(header.function_count);
+  for (std::uint32_t index = 0; index < header.function_count; ++index)
+  {
+    jvs_count_record record{};
+    std::memcpy(&record, data.data() + index * sizeof(record),
+      sizeof(record));
+    if (record.name_offset >= nameTable.size())
+    {
+      return make_format_error("name offset out of range");
+    }
+
+    llvm::StringRef name = nameTable.drop_front(record.name_offset);
+    std::size_t nameEnd = name.find('\0');
+    if (nameEnd == llvm::StringRef::npos)
+    {
+      return make_format_error("unterminated name");
+    }
+
+    name = name.take_front(nameEnd);
+    callCounts.functions_.push_back({name.str(), record.count});
+    callCounts.counts_[name] += record.count;
+  }
+
+  return callCounts;
+}
+
+std::uint64_t jvs::CallCounts::get(llvm::StringRef name) const
+{
+  auto countIter = counts_.find(name);
+  return countIter != counts_.end() ? countIter->second : 0;
+}
+
+std::uint64_t jvs::CallCounts::max_count() const
+{
+  std::uint64_t maxCount = 0;
+  for (const Function& function : functions_)
+  {
+    maxCount = std::max(maxCount, function.Count);
+  }
+
+  return maxCount;
+}
+
+llvm::ArrayRef<jvs::CallCounts::Function> jvs::CallCounts::functions() const
+{
+  return functions_;
+}
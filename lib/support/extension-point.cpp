@@ -0,0 +1,25 @@
+#include "support/extension-point.h"
+
+llvm::cl::ValuesClass jvs::function_extension_point_values()
+{
+  return llvm::cl::values(
+    clEnumValN(ExtensionPoint::None, "none",
+      "Only run when named in a pass pipeline"),
+    clEnumValN(ExtensionPoint::PipelineStart, "pipeline-start",
+      "Run at the start of the default pipelines"),
+    clEnumValN(ExtensionPoint::ScalarOptimizerLate, "scalar-optimizer-late",
+      "Run at the end of the function simplification pipeline"),
+    clEnumValN(ExtensionPoint::OptimizerLast, "optimizer-last",
+      "Run at the end of the default pipelines"));
+}
+
+llvm::cl::ValuesClass jvs::module_extension_point_values()
+{
+  return llvm::cl::values(
+    clEnumValN(ExtensionPoint::None, "none",
+      "Only run when named in a pass pipeline"),
+    clEnumValN(ExtensionPoint::PipelineStart, "pipeline-start",
+      "Run at the start of the default pipelines"),
+    clEnumValN(ExtensionPoint::OptimizerLast, "optimizer-last",
+      "Run at the end of the default pipelines"));
+}
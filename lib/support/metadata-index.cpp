@@ -0,0 +1,215 @@
+#include "support/metadata-index.h"
+
+#include <utility>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Metadata.h"
+
+namespace
+{
+
+// Number of metadata kinds every LLVMContext registers up front. Any kind ID at
+// or above this value was created by name (like the ones used by this project).
+static constexpr unsigned int FixedMetadataKindCount = 0
+#define LLVM_FIXED_MD_KIND(EnumID, Name, Value) + 1
+#include "llvm/IR/FixedMetadataKinds.def"
+  ;
+
+static bool is_metadata_marker(const llvm::Instruction& inst)
+{
+  if (auto* callInst = llvm::dyn_cast<llvm::CallInst>(&inst))
+  {
+    return (callInst->getCalledFunction() &&
+      callInst->getIntrinsicID() == llvm::Intrinsic::donothing);
+  }
+
+  return false;
+}
+
+static llvm::StringRef get_string_operand(const llvm::MDNode& node)
+{
+  if (auto* mdString = llvm::dyn_cast<llvm::MDString>(node.getOperand(0)))
+  {
+    return mdString->getString();
+  }
+
+  return {};
+}
+
+//!
+//! Sorts instructions of the given function into program order.
+//!
+static void sort_in_program_order(std::vector<llvm::Instruction*>& insts,
+  llvm::Function& f)
+{
+  llvm::DenseMap<const llvm::BasicBlock*, unsigned int> blockOrder{};
+  for (llvm::BasicBlock& block : f)
+  {
+    blockOrder.try_emplace(&block, blockOrder.size());
+  }
+
+  llvm::sort(insts, [&](llvm::Instruction* lhs, llvm::Instruction* rhs)
+    {
+      if (lhs->getParent() != rhs->getParent())
+      {
+        return blockOrder.lookup(lhs->getParent()) <
+          blockOrder.lookup(rhs->getParent());
+      }
+
+      return lhs->comesBefore(rhs);
+    });
+}
+
+} // namespace
+
+
+llvm::AnalysisKey jvs::MetadataIndexAnalysis::Key;
+
+jvs::MetadataIndex::MetadataIndex(llvm::Function& f)
+  : function_(&f)
+{
+  llvm::SmallVector<std::pair<unsigned int, llvm::MDNode*>, 4> attachments{};
+  for (llvm::Instruction& inst : llvm::instructions(f))
+  {
+    if (!inst.hasMetadataOtherThanDebugLoc())
+    {
+      continue;
+    }
+
+    attachments.clear();
+    inst.getAllMetadataOtherThanDebugLoc(attachments);
+    for (auto& [kindId, node] : attachments)
+    {
+      if (kindId >= FixedMetadataKindCount)
+      {
+        insert(inst, kindId);
+      }
+    }
+  }
+}
+
+llvm::Function& jvs::MetadataIndex::function() const noexcept
+{
+  return *function_;
+}
+
+void jvs::MetadataIndex::insert(llvm::Instruction& inst, llvm::StringRef name)
+{
+  insert(inst, function_->getContext().getMDKindID(name));
+}
+
+void jvs::MetadataIndex::insert(llvm::Instruction& inst, unsigned int kindId)
+{
+  instructions_[kindId].emplace_back(&inst);
+}
+
+std::vector<llvm::Instruction*> jvs::MetadataIndex::find_metadata(
+  llvm::StringRef name) const
+{
+  std::vector<llvm::Instruction*> results{};
+  unsigned int kindId = function_->getContext().getMDKindID(name);
+  auto foundIt = instructions_.find(kindId);
+  if (foundIt == instructions_.end())
+  {
+    return results;
+  }
+
+  // An instruction which had this kind of metadata dropped and attached
+  // again is in the list twice.
+  llvm::SmallPtrSet<llvm::Instruction*, 16> seen{};
+  std::vector<llvm::WeakVH>& handles = foundIt->second;
+  results.reserve(handles.size());
+  for (const llvm::WeakVH& handle : handles)
+  {
+    // Skip instructions that have been erased, moved out of the function, or
+    // have since had this kind of metadata dropped.
+    auto* inst = llvm::dyn_cast_or_null<llvm::Instruction>(handle);
+    if (inst && inst->getFunction() == function_ &&
+      inst->getMetadata(kindId) && seen.insert(inst).second)
+    {
+      results.push_back(inst);
+    }
+  }
+
+  // Instructions are inserted in whatever order they gain their metadata, but
+  // callers expect them in program order (as they would be found by walking
+  // the function).
+  if (results.size() > 1)
+  {
+    sort_in_program_order(results, *function_);
+  }
+
+  // Keep only what was found, so the skipped entries aren't visited again
+  // and the next search starts from a sorted list.
+  handles.assign(results.begin(), results.end());
+
+  return results;
+}
+
+std::vector<llvm::Instruction*> jvs::MetadataIndex::find_metadata(
+  llvm::StringRef name, llvm::StringRef value) const
+{
+  std::vector<llvm::Instruction*> results = find_metadata(name);
+  llvm::erase_if(results,
+    [&](llvm::Instruction* inst)
+    {
+      return !get_string_operand(*inst->getMetadata(name)).equals(value);
+    });
+  return results;
+}
+
+std::vector<llvm::Instruction*> jvs::MetadataIndex::find_metadata_markers(
+  llvm::StringRef name) const
+{
+  std::vector<llvm::Instruction*> results = find_metadata(name);
+  llvm::erase_if(results,
+    [](llvm::Instruction* inst)
+    {
+      return !is_metadata_marker(*inst);
+    });
+  return results;
+}
+
+llvm::Instruction* jvs::MetadataIndex::find_metadata_marker(
+  llvm::StringRef name) const
+{
+  for (llvm::Instruction* inst : find_metadata(name))
+  {
+    if (is_metadata_marker(*inst))
+    {
+      return inst;
+    }
+  }
+
+  return nullptr;
+}
+
+llvm::Instruction* jvs::MetadataIndex::find_metadata_marker(
+  llvm::StringRef name, llvm::StringRef value) const
+{
+  for (llvm::Instruction* inst : find_metadata(name, value))
+  {
+    if (is_metadata_marker(*inst))
+    {
+      return inst;
+    }
+  }
+
+  return nullptr;
+}
+
+auto jvs::MetadataIndexAnalysis::run(llvm::Function& f,
+  llvm::FunctionAnalysisManager&) -> Result
+{
+  return MetadataIndex(f);
+}
@@ -15,6 +15,7 @@
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
 
+#include "support/metadata-index.h"
 #include "support/unqualified.h"
 
 namespace
@@ -33,12 +34,24 @@ static llvm::Instruction* create_metadata_marker(InsertPointT& insertPt)
   return noOpBuilder.CreateIntrinsic(llvm::Intrinsic::donothing, {}, {});
 }
 
+static void set_metadata(llvm::Instruction& inst, llvm::StringRef name,
+  llvm::MDNode* node, jvs::MetadataIndex* index)
+{
+  // Instructions that already carry this kind are already in the index.
+  bool isNewKind = !inst.getMetadata(name);
+  inst.setMetadata(name, node);
+  if (index && isNewKind)
+  {
+    index->insert(inst, name);
+  }
+}
+
 template <typename InsertPointT>
 static llvm::Instruction* create_metadata(InsertPointT& insertPt,
-  llvm::StringRef name, llvm::StringRef value)
+  llvm::StringRef name, llvm::StringRef value, jvs::MetadataIndex* index)
 {
   llvm::Instruction* markerInst = ::create_metadata_marker(insertPt);
-  jvs::attach_metadata(*markerInst, name, value);
+  jvs::attach_metadata(*markerInst, name, value, index);
   return markerInst;
 }
 
@@ -47,21 +60,21 @@ static llvm::Instruction* create_metadata(InsertPointT& insertPt,
 
 
 llvm::MDNode* jvs::attach_metadata(llvm::Instruction& inst, 
-  llvm::StringRef name, llvm::StringRef value)
+  llvm::StringRef name, llvm::StringRef value, MetadataIndex* index)
 {
   auto& ctx = inst.getContext();
   llvm::MDNode* node = llvm::MDNode::get(ctx, llvm::MDString::get(ctx, value));
-  inst.setMetadata(name, node);
+  ::set_metadata(inst, name, node, index);
   return node;
 }
 
 llvm::MDNode* jvs::attach_metadata(llvm::Instruction& inst, 
-  llvm::StringRef name, std::uint64_t value)
+  llvm::StringRef name, std::uint64_t value, MetadataIndex* index)
 {
   auto& ctx = inst.getContext();
   llvm::MDNode* node = llvm::MDNode::get(ctx, llvm::ConstantAsMetadata::get(
     llvm::ConstantInt::get(ctx, llvm::APInt(64, value))));
-  inst.setMetadata(name, node);
+  ::set_metadata(inst, name, node, index);
   return node;
 }
 
@@ -76,15 +89,15 @@ llvm::Instruction* jvs::create_metadata_marker(llvm::BasicBlock& insertAtEnd)
 }
 
 llvm::Instruction* jvs::create_metadata(llvm::Instruction& insertBefore,
-  llvm::StringRef name, llvm::StringRef value)
+  llvm::StringRef name, llvm::StringRef value, MetadataIndex* index)
 {
-  return ::create_metadata(insertBefore, name, value);
+  return ::create_metadata(insertBefore, name, value, index);
 }
 
 llvm::Instruction* jvs::create_metadata(llvm::BasicBlock& insertAtEnd,
-  llvm::StringRef name, llvm::StringRef value)
+  llvm::StringRef name, llvm::StringRef value, MetadataIndex* index)
 {
-  return ::create_metadata(insertAtEnd, name, value);
+  return ::create_metadata(insertAtEnd, name, value, index);
 }
 
 
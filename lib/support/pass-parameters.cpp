@@ -0,0 +1,44 @@
+#include "support/pass-parameters.h"
+
+#include <tuple>
+
+std::optional<llvm::StringRef> jvs::match_pass_name(llvm::StringRef name,
+  llvm::StringRef passName)
+{
+  if (!name.consume_front(passName))
+  {
+    return {};
+  }
+
+  if (name.empty())
+  {
+    return llvm::StringRef();
+  }
+
+  if (!name.consume_front("<") || !name.consume_back(">"))
+  {
+    return {};
+  }
+
+  return name;
+}
+
+llvm::SmallVector<jvs::PassParameter, 4> jvs::split_pass_parameters(
+  llvm::StringRef params)
+{
+  llvm::SmallVector<PassParameter, 4> result{};
+  while (!params.empty())
+  {
+    llvm::StringRef param{};
+    std::tie(param, params) = params.split(';');
+    if (param.empty())
+    {
+      continue;
+    }
+
+    auto [key, value] = param.split('=');
+    result.emplace_back(key.trim(), value.trim());
+  }
+
+  return result;
+}
@@ -1,14 +1,64 @@
 #include "support/pass-pipeline.h"
 
+#include <map>
+#include <string>
 #include <utility>
 
 #include "llvm/Analysis/LoopAnalysisManager.h"
 #include "llvm/Analysis/CGSCCPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/Error.h"
 
+namespace
+{
+
+//!
+//! The passes of a cached pipeline. It's only ever run with borrowed analysis
+//! managers, so unlike PassPipeline it has none of its own.
+//!
+struct ParsedPipeline
+{
+  llvm::ModulePassManager ModulePasses{llvm::DebugFlag};
+  llvm::FunctionPassManager FunctionPasses{llvm::DebugFlag};
+  std::string ParseError{};
+};
+
+//!
+//! Gets (parsing on first use) the passes for the given pipeline text from the
+//! calling thread's cache.
+//!
+static ParsedPipeline& get_parsed_pipeline(std::string_view passes,
+  bool functionPipeline)
+{
+  // Pass managers aren't safe to run from several threads at once, so each
+  // thread parses its own.
+  static thread_local std::map<std::pair<bool, std::string>, ParsedPipeline>
+    cache{};
+  auto [foundIt, inserted] =
+    cache.try_emplace(std::make_pair(functionPipeline, std::string(passes)));
+  ParsedPipeline& pipeline = foundIt->second;
+  if (inserted)
+  {
+    llvm::PassBuilder passBuilder{};
+    llvm::Error err = functionPipeline
+      ? passBuilder.parsePassPipeline(pipeline.FunctionPasses, passes, true,
+        llvm::DebugFlag)
+      : passBuilder.parsePassPipeline(pipeline.ModulePasses, passes, true,
+        llvm::DebugFlag);
+    if (err)
+    {
+      pipeline.ParseError = llvm::toString(std::move(err));
+    }
+  }
+
+  return pipeline;
+}
+
+} // namespace
+
 
 jvs::PassPipeline::PassPipeline(std::string_view passes, bool functionPipeline)
   : pass_builder_(),
@@ -136,6 +186,18 @@ llvm::PreservedAnalyses jvs::PassPipeline::run(llvm::Function& f)
   return function_pass_manager_.run(f, function_analysis_manager_);
 }
 
+llvm::PreservedAnalyses jvs::PassPipeline::run(llvm::Module& m,
+  llvm::ModuleAnalysisManager& manager)
+{
+  return module_pass_manager_.run(m, manager);
+}
+
+llvm::PreservedAnalyses jvs::PassPipeline::run(llvm::Function& f,
+  llvm::FunctionAnalysisManager& manager)
+{
+  return function_pass_manager_.run(f, manager);
+}
+
 jvs::PassPipeline jvs::PassPipeline::create_function_pipeline(
   std::string_view passes)
 {
@@ -165,3 +227,21 @@ std::tuple<llvm::PreservedAnalyses, std::string> jvs::run_pass_pipeline(
   llvm::PreservedAnalyses result = passPipeline.run(f);
   return std::make_tuple(result, passPipeline.parse_error());
 }
+
+std::tuple<llvm::PreservedAnalyses, std::string> jvs::run_pass_pipeline(
+  llvm::Module& m, std::string_view passes,
+  llvm::ModuleAnalysisManager& manager)
+{
+  ParsedPipeline& pipeline = get_parsed_pipeline(passes, false);
+  llvm::PreservedAnalyses result = pipeline.ModulePasses.run(m, manager);
+  return std::make_tuple(result, pipeline.ParseError);
+}
+
+std::tuple<llvm::PreservedAnalyses, std::string> jvs::run_pass_pipeline(
+  llvm::Function& f, std::string_view passes,
+  llvm::FunctionAnalysisManager& manager)
+{
+  ParsedPipeline& pipeline = get_parsed_pipeline(passes, true);
+  llvm::PreservedAnalyses result = pipeline.FunctionPasses.run(f, manager);
+  return std::make_tuple(result, pipeline.ParseError);
+}
@@ -0,0 +1,149 @@
+//!
+//! @file tests/resize-malloc/size-classes-test.cpp
+//!
+//! Checks that the three implementations of resize-malloc's rounding agree:
+//! round_allocation_size() for constant sizes, the code emitted by
+//! create_round_allocation_size() for sizes known at run time, and the size
+//! classes of the pool allocator.
+//!
+#include <cstdint>
+#include <vector>
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/NoFolder.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "passes/resize-malloc.h"
+#include "pool-allocator.h"
+#include "runtime/resize-malloc.h"
+#include "size-classes.h"
+
+namespace
+{
+
+//!
+//! Evaluates the code create_round_allocation_size() emits for a constant
+//! size, by folding it one instruction at a time.
+//!
+static std::uint64_t evaluate_round_allocation_size(llvm::Module& m,
+  const jvs::ResizeMallocOptions& options, std::uint64_t size,
+  unsigned int bits)
+{
+  llvm::LLVMContext& context = m.getContext();
+  llvm::IntegerType* sizeType = llvm::IntegerType::get(context, bits);
+  llvm::Function* f = llvm::Function::Create(
+    llvm::FunctionType::get(sizeType, false),
+    llvm::GlobalValue::ExternalLinkage, "round", m);
+  llvm::BasicBlock* block = llvm::BasicBlock::Create(context, "", f);
+
+  // The code is emitted as it would be for a variable, and only folded
+  // afterwards.
+  llvm::IRBuilder<llvm::NoFolder> builder(block);
+  auto* ret = builder.CreateRet(jvs::create_round_allocation_size(builder,
+    options, llvm::ConstantInt::get(sizeType, size)));
+  for (llvm::Instruction& inst : llvm::make_early_inc_range(*block))
+  {
+    if (llvm::Constant* folded =
+      llvm::ConstantFoldInstruction(&inst, m.getDataLayout()))
+    {
+      inst.replaceAllUsesWith(folded);
+      inst.eraseFromParent();
+    }
+  }
+
+  std::uint64_t result =
+    llvm::cast<llvm::ConstantInt>(ret->getReturnValue())->getZExtValue();
+  f->eraseFromParent();
+  return result;
+}
+
+static std::vector<std::uint64_t> get_test_sizes(unsigned int bits)
+{
+  std::vector<std::uint64_t> sizes{0, 8, 9, 128, 129, 1024, 1025};
+  for (std::uint64_t size = 1; size <= 4096; ++size)
+  {
+    sizes.push_back(size);
+  }
+
+  std::uint64_t maxSize = llvm::maxUIntN(bits);
+  for (std::uint64_t offset = 0; offset <= 16; ++offset)
+  {
+    sizes.push_back(maxSize - offset);
+    sizes.push_back((maxSize >> 1) - offset);
+    sizes.push_back((maxSize >> 1) + 1 + offset);
+  }
+
+  return sizes;
+}
+
+} // namespace
+
+
+int main()
+{
+  llvm::LLVMContext context{};
+  llvm::Module m("size-classes-test", context);
+  int failures = 0;
+
+  std::vector<jvs::ResizeMallocOptions> optionSets(5);
+  optionSets[1].Multiple = 64;
+  optionSets[2].Multiple = 48;
+  optionSets[3].Rounding = jvs::ResizeMallocRounding::PowerOfTwo;
+  optionSets[4].Rounding = jvs::ResizeMallocRounding::SizeClasses;
+  for (const jvs::ResizeMallocOptions& options : optionSets)
+  {
+    for (unsigned int bits : {32u, 64u})
+    {
+      for (std::uint64_t size : get_test_sizes(bits))
+      {
+        std::uint64_t expected =
+          jvs::round_allocation_size(options, size, bits);
+        std::uint64_t emitted =
+          evaluate_round_allocation_size(m, options, size, bits);
+        if (emitted != expected)
+        {
+          llvm::errs() << "rounding " << static_cast<int>(options.Rounding)
+            << " (multiple " << options.Multiple << ") of i" << bits << ' '
+            << size << ": constant " << expected << ", emitted " << emitted <<
+            '\n';
+          ++failures;
+        }
+      }
+    }
+  }
+
+  // Sizes of 1 to JVS_POOL_MAX_SIZE bytes go to the pool instead of being
+  // rounded, and have to land in the same classes.
+  jvs::ResizeMallocOptions sizeClasses{};
+  sizeClasses.Rounding = jvs::ResizeMallocRounding::SizeClasses;
+  for (std::uint64_t size = 1; size <= JVS_POOL_MAX_SIZE; ++size)
+  {
+    std::uint64_t expected = jvs::round_allocation_size(sizeClasses, size, 64);
+    std::uint64_t pooled =
+      jvs::pool::ClassSizes[jvs::pool::get_size_class(size)];
+    if (pooled != expected)
+    {
+      llvm::errs() << "pool class of " << size << ": constant " << expected <<
+        ", pool " << pooled << '\n';
+      ++failures;
+    }
+  }
+
+  if (failures)
+  {
+    llvm::errs() << failures << " mismatches\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,502 @@
+//!
+//! @file tools/pseudo-trace-decode/pseudo-trace-decode.cpp.
+//!
+//! Decodes the traces written by code instrumented with function-name-trace.
+//!
+//! Binary traces (see runtime/function-name-trace.h) are printed as one line
+//! per event, or converted to the Chrome Trace Event JSON format read by
+//! chrome://tracing and Perfetto. Call count profiles are printed as one line
+//! per function, most called first. Anything else is treated as text (a text
+//! mode trace, a latency or call graph profile, or folded stack samples) and
+//! copied with its mangled names demangled.
+//!
+//! Each distinct name is only demangled once.
+//!
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "runtime/function-name-trace.h"
+#include "support/call-counts.h"
+
+namespace
+{
+
+static llvm::cl::opt<std::string> InputPath(llvm::cl::Positional,
+  llvm::cl::desc("<trace file>"), llvm::cl::Required);
+
+static llvm::cl::opt<std::string> OutputPath("o",
+  llvm::cl::desc("Output file (defaults to stdout)"),
+  llvm::cl::value_desc("path"), llvm::cl::init("-"));
+
+enum class OutputFormat
+{
+  Text,
+  Chrome,
+};
+
+static llvm::cl::opt<OutputFormat> Format("format",
+  llvm::cl::desc("Output format for binary traces"),
+  llvm::cl::init(OutputFormat::Text),
+  llvm::cl::values(
+    clEnumValN(OutputFormat::Text, "text", "One line per event"),
+    clEnumValN(OutputFormat::Chrome, "chrome",
+      "Chrome Trace Event JSON (for chrome://tracing and Perfetto)")));
+
+static llvm::cl::opt<bool> NoDemangle("no-demangle",
+  llvm::cl::desc("Print names as they appear in the trace"),
+  llvm::cl::init(false));
+
+//!
+//! Demangles names, remembering the result for each distinct name.
+//!
+class Demangler
+{
+public:
+  llvm::StringRef demangle(llvm::StringRef name)
+  {
+    if (NoDemangle)
+    {
+      return name;
+    }
+
+    auto [nameIter, inserted] = names_.try_emplace(name);
+    if (inserted)
+    {
+      nameIter->second = llvm::demangle(name.str());
+    }
+
+    return nameIter->second;
+  }
+
+private:
+  llvm::StringMap<std::string> names_{};
+};
+
+//!
+//! Checks whether a word of a text trace looks like an Itanium mangled name
+//! (with any number of leading underscores added by the platform).
+//!
+static bool is_mangled_name(llvm::StringRef word)
+{
+  std::size_t underscores = word.find_first_not_of('_');
+  return underscores != llvm::StringRef::npos && underscores >= 1 &&
+    underscores <= 4 && word[underscores] == 'Z';
+}
+
+//!
+//! Copies a text trace, demangling every mangled name in it. Words are
+//! separated by whitespace, and by the semicolons between the frames of
+//! folded stacks.
+//!
+static void decode_text_trace(llvm::StringRef text, llvm::raw_ostream& out)
+{
+  Demangler demangler{};
+  while (!text.empty())
+  {
+    std::size_t wordStart = text.find_first_not_of(" \t\r\n;");
+    out << text.take_front(wordStart);
+    if (wordStart == llvm::StringRef::npos)
+    {
+      break;
+    }
+
+    text = text.drop_front(wordStart);
+    llvm::StringRef word = text.take_until(
+      [](char c)
+      {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ';';
+      });
+    out << (is_mangled_name(word) ? demangler.demangle(word) : word);
+    text = text.drop_front(word.size());
+  }
+}
+
+//!
+//! The contents of a binary trace.
+//!
+struct BinaryTrace
+{
+  struct ThreadEvents
+  {
+    std::uint64_t ThreadId;
+    std::uint64_t Dropped;
+    std::vector<jvs_trace_event> Events;
+  };
+
+  //! Function names, indexed by function ID.
+  std::vector<llvm::StringRef> FunctionNames{};
+  //! Events in file order, grouped by the chunks they were written in.
+  std::vector<ThreadEvents> Chunks{};
+  std::uint64_t TicksPerSecond{0};
+};
+
+//!
+//! Reads the chunks of a binary trace. The names in the result refer to
+//! `data`.
+//!
+static llvm::Expected<BinaryTrace> read_binary_trace(llvm::StringRef data)
+{
+  auto truncated = []
+  {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+      "the trace is truncated");
+  };
+
+  // Copies the next `size` bytes to `value` and drops them from `data`.
+  auto read = [](llvm::StringRef& data, void* value, std::size_t size)
+  {
+    if (data.size() < size)
+    {
+      return false;
+    }
+
+    std::memcpy(value, data.data(), size);
+    data = data.drop_front(size);
+    return true;
+  };
+
+  jvs_trace_file_header header{};
+  if (!read(data, &header, sizeof(header)))
+  {
+    return truncated();
+  }
+
+  if (header.version != JVS_TRACE_FILE_VERSION)
+  {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+      "unsupported trace file version %u", header.version);
+  }
+
+  BinaryTrace trace{};
+  while (!data.empty())
+  {
+    jvs_trace_chunk_header chunkHeader{};
+    if (!read(data, &chunkHeader, sizeof(chunkHeader)) ||
+      data.size() < chunkHeader.size)
+    {
+      return truncated();
+    }
+
+    // A runtime that didn't exit cleanly leaves the space it allocated ahead
+    // of its data zeroed.
+    if (chunkHeader.type == 0)
+    {
+      break;
+    }
+
+    llvm::StringRef chunk = data.take_front(chunkHeader.size);
+    data = data.drop_front(chunkHeader.size);
+    switch (chunkHeader.type)
+    {
+    case JVS_TRACE_CHUNK_MODULE:
+    {
+      jvs_trace_module_chunk module{};
+      std::vector<std::uint32_t> offsets{};
+      if (!read(chunk, &module, sizeof(module)))
+      {
+        return truncated();
+      }
+
+      // Check the counts against the chunk before allocating anything for
+      // them.
+      if (chunk.size() / sizeof(offsets[0]) < module.function_count)
+      {
+        return truncated();
+      }
+
+      // The runtime hands out function IDs contiguously, in the order it
+      // writes the modules.
+      if (module.base_id > trace.FunctionNames.size())
+      {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+          "invalid module base ID %u", module.base_id);
+      }
+
+      offsets.resize(module.function_count);
+      if (!read(chunk, offsets.data(), offsets.size() * sizeof(offsets[0])) ||
+        chunk.size() < module.name_table_size)
+      {
+        return truncated();
+      }
+
+      llvm::StringRef nameTable = chunk.take_front(module.name_table_size);
+      std::size_t end = std::size_t{module.base_id} + module.function_count;
+      if (trace.FunctionNames.size() < end)
+      {
+        trace.FunctionNames.resize(end);
+      }
+
+      for (std::uint32_t localId = 0; localId < module.function_count;
+        ++localId)
+      {
+        if (offsets[localId] >= nameTable.size())
+        {
+          return llvm::createStringError(llvm::inconvertibleErrorCode(),
+            "invalid name offset %u", offsets[localId]);
+        }
+
+        llvm::StringRef name = nameTable.drop_front(offsets[localId]);
+        trace.FunctionNames[module.base_id + localId] =
+          name.take_until([](char c) { return c == '\0'; });
+      }
+
+      break;
+    }
+    case JVS_TRACE_CHUNK_EVENTS:
+    {
+      jvs_trace_events_chunk events{};
+      if (!read(chunk, &events, sizeof(events)))
+      {
+        return truncated();
+      }
+
+      BinaryTrace::ThreadEvents threadEvents{events.thread_id,
+        events.dropped, {}};
+      threadEvents.Events.resize(chunk.size() / sizeof(jvs_trace_event));
+      read(chunk, threadEvents.Events.data(),
+        threadEvents.Events.size() * sizeof(jvs_trace_event));
+      trace.Chunks.push_back(std::move(threadEvents));
+      break;
+    }
+    case JVS_TRACE_CHUNK_CLOCK:
+    {
+      jvs_trace_clock_chunk clock{};
+      if (!read(chunk, &clock, sizeof(clock)))
+      {
+        return truncated();
+      }
+
+      trace.TicksPerSecond = clock.ticks_per_second;
+      break;
+    }
+    default:
+      // Skip chunks added by later versions of the runtime.
+      break;
+    }
+  }
+
+  return trace;
+}
+
+//!
+//! Converts event timestamps to microseconds since the first event (or to
+//! clock ticks, if the trace wasn't finalized and so has no clock chunk).
+//!
+class TraceTimeline
+{
+public:
+  explicit TraceTimeline(const BinaryTrace& trace)
+    : ticks_per_microsecond_(trace.TicksPerSecond
+      ? static_cast<double>(trace.TicksPerSecond) / 1e6
+      : 1.0)
+  {
+    for (const BinaryTrace::ThreadEvents& chunk : trace.Chunks)
+    {
+      for (const jvs_trace_event& event : chunk.Events)
+      {
+        start_time_ = std::min(start_time_, event.timestamp);
+      }
+    }
+  }
+
+  double get_time(const jvs_trace_event& event) const
+  {
+    return static_cast<double>(event.timestamp - start_time_) /
+      ticks_per_microsecond_;
+  }
+
+private:
+  double ticks_per_microsecond_;
+  std::uint64_t start_time_{UINT64_MAX};
+};
+
+static llvm::StringRef get_function_name(const BinaryTrace& trace,
+  std::uint32_t functionId, Demangler& demangler, std::string& unknownName)
+{
+  if (functionId < trace.FunctionNames.size())
+  {
+    return demangler.demangle(trace.FunctionNames[functionId]);
+  }
+
+  unknownName = "<function " + std::to_string(functionId) + ">";
+  return unknownName;
+}
+
+//!
+//! Prints a binary trace as one line per event: the time since the first
+//! event, the thread ID and the function entered or left.
+//!
+static void print_binary_trace(const BinaryTrace& trace,
+  llvm::raw_ostream& out)
+{
+  TraceTimeline timeline(trace);
+  Demangler demangler{};
+  std::string unknownName{};
+  for (const BinaryTrace::ThreadEvents& chunk : trace.Chunks)
+  {
+    if (chunk.Dropped != 0)
+    {
+      out << "# thread " << chunk.ThreadId << " dropped " << chunk.Dropped
+        << " events\n";
+    }
+
+    for (const jvs_trace_event& event : chunk.Events)
+    {
+      out << llvm::format("%14.3f", timeline.get_time(event))
+        << "  thread " << chunk.ThreadId
+        << (event.kind == JVS_TRACE_EVENT_ENTER
+          ? "  [>] Entering "
+          : "  [<] Leaving ")
+        << get_function_name(trace, event.function_id, demangler,
+          unknownName)
+        << '\n';
+    }
+  }
+
+  if (!trace.TicksPerSecond)
+  {
+    out << "# the trace has no clock chunk, so times are in clock ticks\n";
+  }
+}
+
+//!
+//! Writes a binary trace in the Chrome Trace Event format, as a pair of
+//! duration events ("B" and "E") per call. The JSON is streamed, so converting
+//! a trace takes no more memory than reading it.
+//!
+static void write_chrome_trace(const BinaryTrace& trace,
+  llvm::raw_ostream& out)
+{
+  TraceTimeline timeline(trace);
+  Demangler demangler{};
+  std::string unknownName{};
+  llvm::json::OStream json(out);
+  json.object([&]
+    {
+      json.attribute("displayTimeUnit", "ns");
+      json.attributeArray("traceEvents", [&]
+        {
+          for (const BinaryTrace::ThreadEvents& chunk : trace.Chunks)
+          {
+            for (const jvs_trace_event& event : chunk.Events)
+            {
+              json.object([&]
+                {
+                  json.attribute("name", get_function_name(trace,
+                    event.function_id, demangler, unknownName));
+                  json.attribute("ph",
+                    event.kind == JVS_TRACE_EVENT_ENTER ? "B" : "E");
+                  json.attribute("ts", timeline.get_time(event));
+                  json.attribute("pid", 0);
+                  json.attribute("tid",
+                    static_cast<std::int64_t>(chunk.ThreadId));
+                });
+            }
+          }
+        });
+    });
+  out << '\n';
+}
+
+//!
+//! Prints a call count profile as one line per function: the number of calls
+//! and the name.
+//!
+static void print_call_counts(const jvs::CallCounts& callCounts,
+  llvm::raw_ostream& out)
+{
+  Demangler demangler{};
+  for (const jvs::CallCounts::Function& function : callCounts.functions())
+  {
+    out << llvm::format("%20llu  ",
+      static_cast<unsigned long long>(function.Count))
+      << demangler.demangle(function.Name) << '\n';
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  llvm::InitLLVM initLLVM(argc, argv);
+  llvm::cl::ParseCommandLineOptions(argc, argv,
+    "Decodes function-name-trace traces and call count profiles\n");
+
+  auto input = llvm::MemoryBuffer::getFileOrSTDIN(InputPath);
+  if (!input)
+  {
+    llvm::WithColor::error() << "unable to read '" << InputPath << "': "
+      << input.getError().message() << '\n';
+    return 1;
+  }
+
+  std::error_code error{};
+  llvm::raw_fd_ostream out(OutputPath, error, llvm::sys::fs::OF_Text);
+  if (error)
+  {
+    llvm::WithColor::error() << "unable to create '" << OutputPath << "': "
+      << error.message() << '\n';
+    return 1;
+  }
+
+  llvm::StringRef data = (*input)->getBuffer();
+  if (data.startswith(llvm::StringRef(JVS_COUNT_FILE_MAGIC,
+    sizeof(JVS_COUNT_FILE_MAGIC) - 1)))
+  {
+    auto callCounts = jvs::CallCounts::parse(data);
+    if (!callCounts)
+    {
+      llvm::WithColor::error() << InputPath << ": "
+        << llvm::toString(callCounts.takeError()) << '\n';
+      return 1;
+    }
+
+    print_call_counts(*callCounts, out);
+    return 0;
+  }
+
+  if (!data.startswith(llvm::StringRef(JVS_TRACE_FILE_MAGIC,
+    sizeof(JVS_TRACE_FILE_MAGIC) - 1)))
+  {
+    decode_text_trace(data, out);
+    return 0;
+  }
+
+  auto trace = read_binary_trace(data);
+  if (!trace)
+  {
+    llvm::WithColor::error() << InputPath << ": "
+      << llvm::toString(trace.takeError()) << '\n';
+    return 1;
+  }
+
+  switch (Format)
+  {
+  case OutputFormat::Text:
+    print_binary_trace(*trace, out);
+    break;
+  case OutputFormat::Chrome:
+    write_chrome_trace(*trace, out);
+    break;
+  }
+
+  return 0;
+}